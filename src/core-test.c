@@ -0,0 +1,851 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "core.h"
+#include "images.h"
+#include "summary.h"
+#include "diff.h"
+#include "strscan.h"
+#include "minimize.h"
+#include "dsc.h"
+#include "stream.h"
+#include "pages.h"
+#include "util.h"
+#include "test.h"
+
+/* core_segment_find as it was before segidx: first segment in load command order containing vmaddr */
+static const struct core_segment *test_segment_scan(const struct core *core, uint64_t vmaddr) {
+    for (size_t i = 0; i < core->segc; ++i) {
+        if (vmaddr - core->segv[i].vmbase < core->segv[i].vmsize) {
+            return &core->segv[i];
+        }
+    }
+    return NULL;
+}
+
+struct test_segment {
+    uint64_t vmaddr;
+    uint64_t vmsize;
+};
+
+static void test_open_core(struct test_image *img, const struct test_segment *segv, size_t segc, struct core *core) {
+    test_image_init(img, true, false, MH_CORE);
+    for (size_t i = 0; i < segc; ++i) {
+        const size_t filesize = segv[i].vmsize != 0 ? CORE_PAGE_SIZE : 0;
+        const size_t fileoff = test_image_data(img, NULL, filesize, CORE_PAGE_SIZE);
+        memset(img->buf + fileoff, 'a' + i, filesize);
+        test_image_segment(img, "", segv[i].vmaddr, segv[i].vmsize, fileoff, filesize, VM_PROT_READ, 0);
+    }
+    test_check(core_open(test_image_file(img), core, NULL) == 0);
+    test_check(core->segc == segc);
+}
+
+static void test_segment_sweep(const struct core *core, uint64_t lo, uint64_t hi) {
+    for (uint64_t vmaddr = lo; vmaddr < hi; vmaddr += 0x100) {
+        test_check(core_segment_find(core, vmaddr) == test_segment_scan(core, vmaddr));
+        test_check(core_segment_find(core, vmaddr - 1) == test_segment_scan(core, vmaddr - 1));
+    }
+}
+
+/* zero-size segments are left out of the index instead of hiding the segment they sit in */
+static void test_segment_empty(void) {
+    const struct test_segment segv[] = {
+        {0x30000, 0x1000},
+        {0x18000, 0},
+        {0x10000, 0x10000},
+        {0x20000, 0},
+    };
+    struct test_image img;
+    struct core core;
+    test_open_core(&img, segv, sizeof(segv) / sizeof(*segv), &core);
+    
+    test_check(core.segidxc == 2 && !core.segoverlap);
+    test_check(core.segidx[0] == &core.segv[2] && core.segidx[1] == &core.segv[0]);
+    test_check(core_segment_find(&core, 0x18000) == &core.segv[2]);
+    test_check(core_segment_find(&core, 0x20000) == NULL);
+    test_segment_sweep(&core, 0, 0x40000);
+    
+    char c;
+    test_check(core_vm_pread(&core, &c, 1, 0x10800) == 1 && c == 'c');
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+/* overlapping segments resolve to the first in load command order, as the scan did */
+static void test_segment_overlap(void) {
+    const struct test_segment segv[] = {
+        {0x18000, 0x10000},
+        {0x10000, 0x10000},
+        {0x40000, 0x1000},
+        {0x1c000, 0x1000},
+    };
+    struct test_image img;
+    struct core core;
+    test_open_core(&img, segv, sizeof(segv) / sizeof(*segv), &core);
+    
+    test_check(core.segidxc == 4 && core.segoverlap);
+    test_check(core_segment_find(&core, 0x10000) == &core.segv[1]);
+    test_check(core_segment_find(&core, 0x18000) == &core.segv[0]);
+    test_check(core_segment_find(&core, 0x1c000) == &core.segv[0]);
+    test_check(core_segment_find(&core, 0x28000) == NULL);
+    test_segment_sweep(&core, 0, 0x50000);
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+/* disjoint segments in any order, including adjacent ones and one reaching the top of the address space */
+static void test_segment_disjoint(void) {
+    const struct test_segment segv[] = {
+        {0x20000, 0x1000},
+        {0x21000, 0x3000},
+        {0x8000, 0x8000},
+        {UINT64_MAX - 0xfff, 0x1000},
+    };
+    struct test_image img;
+    struct core core;
+    test_open_core(&img, segv, sizeof(segv) / sizeof(*segv), &core);
+    
+    test_check(core.segidxc == 4 && !core.segoverlap);
+    test_segment_sweep(&core, 0, 0x30000);
+    test_check(core_segment_find(&core, UINT64_MAX) == &core.segv[3]);
+    test_check(core_segment_find(&core, UINT64_MAX - 0x1000) == NULL);
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+/* duplicate pages counted by the summary match a byte-for-byte comparison against every earlier page */
+static void test_summary_duplicates(void) {
+    const size_t pagec = 48;
+    struct test_image img;
+    test_image_init(&img, true, false, MH_CORE);
+    const size_t fileoff = test_image_data(&img, NULL, pagec * CORE_PAGE_SIZE, CORE_PAGE_SIZE);
+    uint64_t seed = 3;
+    for (size_t p = 0; p < pagec; ++p) {
+        /* a handful of distinct contents, some zero pages, and a partial page at the end */
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        const unsigned kind = (seed >> 33) % 6;
+        if (kind != 0) {
+            memset(img.buf + fileoff + p * CORE_PAGE_SIZE, kind, CORE_PAGE_SIZE);
+        }
+    }
+    test_image_segment(&img, "a", 0x100000, 32 * CORE_PAGE_SIZE, fileoff, 32 * CORE_PAGE_SIZE, VM_PROT_READ, 0);
+    test_image_segment(&img, "b", 0x200000, 16 * CORE_PAGE_SIZE, fileoff + 32 * CORE_PAGE_SIZE, 16 * CORE_PAGE_SIZE - 8, VM_PROT_READ, 0);
+    struct core core;
+    test_check(core_open(test_image_file(&img), &core, NULL) == 0);
+    
+    uint64_t expect = 0, expect_zero[2] = {0, 0};
+    for (size_t p = 0; p < pagec; ++p) {
+        const uint8_t *page = img.buf + fileoff + p * CORE_PAGE_SIZE;
+        uint8_t copy[CORE_PAGE_SIZE];
+        memcpy(copy, page, CORE_PAGE_SIZE);
+        if (p == pagec - 1) {
+            memset(copy + CORE_PAGE_SIZE - 8, 0, 8);
+        }
+        bool zero = true;
+        for (size_t i = 0; i < CORE_PAGE_SIZE && zero; ++i) {
+            zero = copy[i] == 0;
+        }
+        bool dup = false;
+        for (size_t q = 0; q < p && !zero && !dup; ++q) {
+            dup = memcmp(img.buf + fileoff + q * CORE_PAGE_SIZE, copy, CORE_PAGE_SIZE) == 0;
+        }
+        expect += dup;
+        expect_zero[p >= 32] += zero;
+    }
+    
+    struct core_summary sum;
+    test_check(core_summarize(&core, &sum, 4) == 0);
+    test_check(sum.pages == pagec && sum.duplicate == expect && expect > 0);
+    
+    /* counted per segment across workers; every nonzero page is a single repeated byte, so compressible */
+    test_check(sum.segc == 2 && sum.segv[0].zero == expect_zero[0] && sum.segv[1].zero == expect_zero[1]);
+    test_check(sum.zero == expect_zero[0] + expect_zero[1] && sum.zero > 0);
+    test_check(sum.segv[0].compressible == 32 - expect_zero[0] && sum.compressible == pagec - sum.zero);
+    core_summary_free(&sum);
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+static int test_pages_fail(void *ctx, uint64_t unit, void *buf) {
+    (void) ctx;
+    (void) buf;
+    if (unit == 37) {
+        errno = EDOM;
+        errfn = "test_pages_fail";
+        return -1;
+    }
+    return 0;
+}
+
+/* a worker's errno and errfn, both thread-local, reach the caller of pages_parallel */
+static void test_pages_error(void) {
+    for (unsigned nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        errno = 0;
+        errfn = NULL;
+        test_check(pages_parallel(1000, nthreads, 64, &test_pages_fail, NULL) == -1);
+        test_check(errno == EDOM && errfn != NULL && strcmp(errfn, "test_pages_fail") == 0);
+    }
+}
+
+/* one readable segment per entry of sizev, in pages, each filled with fill and placed one after the other from 0x100000 */
+static void test_open_filled(struct test_image *img, const size_t *sizev, size_t segc, uint8_t fill, struct core *core) {
+    test_image_init(img, true, false, MH_CORE);
+    uint64_t vmaddr = 0x100000;
+    for (size_t i = 0; i < segc; ++i) {
+        const size_t size = sizev[i] * CORE_PAGE_SIZE;
+        const size_t fileoff = test_image_data(img, NULL, size, CORE_PAGE_SIZE);
+        memset(img->buf + fileoff, fill, size);
+        test_image_segment(img, "", vmaddr, size, fileoff, size, VM_PROT_READ, 0);
+        vmaddr += size;
+    }
+    test_check(core_open(test_image_file(img), core, NULL) == 0);
+}
+
+/* changed pages are found across chunk boundaries, and b's extra segment is reported as added */
+static void test_diff(void) {
+    const size_t sizev[] = {600, 8};
+    struct test_image imga, imgb;
+    struct core a, b;
+    test_open_filled(&imga, sizev, 1, 'x', &a);
+    test_open_filled(&imgb, sizev, 2, 'x', &b);
+    core_close(&b);
+    const size_t data = TEST_IMAGE_DATA;
+    const size_t changedv[] = {3, 255, 256, 599};
+    for (size_t i = 0; i < sizeof(changedv) / sizeof(*changedv); ++i) {
+        imgb.buf[data + changedv[i] * CORE_PAGE_SIZE + 17] = 'y';
+    }
+    test_check(core_open(test_image_file(&imgb), &b, NULL) == 0);
+    
+    struct core_diff diff;
+    test_check(core_diff(&a, &b, &diff, 3) == 0);
+    test_check(diff.pages == 600 && diff.changed == 4);
+    test_check(diff.rangec == 4);
+    test_check(diff.rangev[0].kind == CORE_DIFF_CHANGED && diff.rangev[0].vmbase == 0x100000 + 3 * CORE_PAGE_SIZE && diff.rangev[0].vmsize == CORE_PAGE_SIZE);
+    test_check(diff.rangev[1].kind == CORE_DIFF_CHANGED && diff.rangev[1].vmbase == 0x100000 + 255 * CORE_PAGE_SIZE && diff.rangev[1].vmsize == 2 * CORE_PAGE_SIZE);
+    test_check(diff.rangev[2].kind == CORE_DIFF_CHANGED && diff.rangev[2].vmbase == 0x100000 + 599 * CORE_PAGE_SIZE);
+    test_check(diff.rangev[3].kind == CORE_DIFF_ADDED && diff.rangev[3].vmbase == 0x100000 + 600 * CORE_PAGE_SIZE && diff.rangev[3].vmsize == 8 * CORE_PAGE_SIZE);
+    core_diff_free(&diff);
+    
+    core_close(&a);
+    core_close(&b);
+    test_image_free(&imga);
+    test_image_free(&imgb);
+}
+
+struct test_strings_ctx {
+    size_t hitc;
+    size_t stop; // stop after this many hits, 0 for never
+    uint64_t vmaddrv[4];
+    int encodingv[4];
+};
+
+static int test_collect_string(const struct core_string *str, struct test_strings_ctx *ctx) {
+    if (ctx->hitc < 4) {
+        ctx->vmaddrv[ctx->hitc] = str->vmaddr;
+        ctx->encodingv[ctx->hitc] = str->encoding;
+    }
+    ++ctx->hitc;
+    return ctx->hitc == ctx->stop;
+}
+
+/* strings in separate segments are found once each, and a callback can stop the scan */
+static void test_strings(void) {
+    const size_t sizev[] = {300, 4};
+    struct test_image img;
+    struct core core;
+    test_open_filled(&img, sizev, 2, 0, &core);
+    core_close(&core);
+    memcpy(img.buf + TEST_IMAGE_DATA + 256 * CORE_PAGE_SIZE - 3, "straddle", 8);
+    const char wide[] = {'w', 0, 'i', 0, 'd', 0, 'e', 0};
+    memcpy(img.buf + TEST_IMAGE_DATA + 301 * CORE_PAGE_SIZE + 1, wide, sizeof(wide));
+    test_check(core_open(test_image_file(&img), &core, NULL) == 0);
+    
+    const struct core_strings_opts opts = {CORE_STRINGS_ASCII | CORE_STRINGS_UTF16LE, 4, 2};
+    struct test_strings_ctx ctx = {0};
+    test_check(core_strings(&core, &opts, (core_strings_fn *) &test_collect_string, &ctx) == 0);
+    test_check(ctx.hitc == 2);
+    for (size_t i = 0; i < 2; ++i) {
+        if (ctx.encodingv[i] == CORE_STRINGS_ASCII) {
+            test_check(ctx.vmaddrv[i] == 0x100000 + 256 * CORE_PAGE_SIZE - 3);
+        } else {
+            test_check(ctx.encodingv[i] == CORE_STRINGS_UTF16LE && ctx.vmaddrv[i] == 0x100000 + 301 * CORE_PAGE_SIZE + 1);
+        }
+    }
+    
+    struct test_strings_ctx stop = {0};
+    stop.stop = 1;
+    test_check(core_strings(&core, &opts, (core_strings_fn *) &test_collect_string, &stop) == 0);
+    test_check(stop.hitc == 1);
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+#define TEST_IMAGE_BASE 0x100000000ULL
+#define TEST_IMAGE_TEXT (4 * CORE_PAGE_SIZE)
+#define TEST_IMAGE_SLID 0x7000000ULL
+
+/* add img's __TEXT and __LINKEDIT to the core under construction, __TEXT at vmaddr */
+static void test_add_image(struct test_image *cimg, struct test_image *img, uint64_t vmaddr) {
+    fclose(test_image_file(img)); // writes img's header
+    
+    const size_t text = test_image_data(cimg, NULL, TEST_IMAGE_TEXT, CORE_PAGE_SIZE);
+    memcpy(cimg->buf + text, img->buf, TEST_IMAGE_DATA);
+    test_image_segment(cimg, "", vmaddr, TEST_IMAGE_TEXT, text, TEST_IMAGE_TEXT, VM_PROT_READ | VM_PROT_EXECUTE, 0);
+    const size_t size = img->size - TEST_IMAGE_DATA;
+    const size_t linkedit = test_image_data(cimg, img->buf + TEST_IMAGE_DATA, size, CORE_PAGE_SIZE);
+    test_image_segment(cimg, "", vmaddr + TEST_IMAGE_TEXT, size, linkedit, size, VM_PROT_READ, 0);
+}
+
+/* core holding img's __TEXT and __LINKEDIT at TEST_IMAGE_SLID, plus an r-x segment that is not an image */
+static void test_open_image_core(struct test_image *img, struct test_image *cimg, struct core *core) {
+    test_image_init(cimg, true, false, MH_CORE);
+    test_add_image(cimg, img, TEST_IMAGE_SLID);
+    const size_t other = test_image_data(cimg, "not an image", 12, CORE_PAGE_SIZE);
+    test_image_segment(cimg, "", 0x9000000, 12, other, 12, VM_PROT_READ | VM_PROT_EXECUTE, 0);
+    test_check(core_open(test_image_file(cimg), core, NULL) == 0);
+}
+
+struct test_foreach_ctx {
+    size_t symc;
+    size_t stop; // return 7 on this call, 0 for never
+    char *namev[64];
+    uint64_t vmaddrv[64];
+};
+
+static int test_collect_symbol(const struct core_image *img, const char *name, uint64_t vmaddr, struct test_foreach_ctx *ctx) {
+    test_check(img->slide == (int64_t) (TEST_IMAGE_SLID - TEST_IMAGE_BASE) && ctx->symc < 64);
+    test_check((ctx->namev[ctx->symc] = strdup(name)) != NULL);
+    ctx->vmaddrv[ctx->symc] = vmaddr;
+    return ++ctx->symc == ctx->stop ? 7 : 0;
+}
+
+static void test_foreach_free(struct test_foreach_ctx *ctx) {
+    for (size_t i = 0; i < ctx->symc; ++i) {
+        free(ctx->namev[i]);
+    }
+}
+
+/* symbols streamed from the images of a core match the image's own symbol table, slid; failures are reported */
+static void test_foreach_symbol(void) {
+    const struct test_symbol symv[] = {
+        {"_c", N_SECT, 1, TEST_IMAGE_BASE + 0x300},
+        {"_a", N_SECT, 1, TEST_IMAGE_BASE + 0x100},
+        {"_ext", N_SECT | N_EXT, 1, TEST_IMAGE_BASE + 0x180},
+        {"_b", N_SECT, 1, TEST_IMAGE_BASE + 0x200},
+    };
+    struct test_image img, cimg;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    const size_t symtab = test_image_symtab(&img, symv, sizeof(symv) / sizeof(*symv));
+    test_image_segments(&img, TEST_IMAGE_BASE, TEST_IMAGE_TEXT);
+    struct core core;
+    test_open_image_core(&img, &cimg, &core);
+    
+    /* the locals, in symbol table order */
+    struct test_foreach_ctx ctx = {0};
+    test_check(core_foreach_symbol(&core, (core_symbol_fn *) &test_collect_symbol, &ctx) == 0);
+    test_check(ctx.symc == 3);
+    const size_t order[] = {0, 1, 3};
+    for (size_t i = 0; i < 3; ++i) {
+        test_check(strcmp(ctx.namev[i], symv[order[i]].name) == 0);
+        test_check(ctx.vmaddrv[i] == symv[order[i]].vmaddr - TEST_IMAGE_BASE + TEST_IMAGE_SLID);
+    }
+    
+    /* same set as the image's symbol table built by symbols_open */
+    struct core_images imgs;
+    test_check(core_images_open(&core, &imgs) == 0 && imgs.imgc == 1);
+    const struct symbols *syms = core_image_symbols(&imgs.imgv[0], 0);
+    test_check(syms != NULL && syms->symc == ctx.symc);
+    for (size_t i = 0; i < syms->symc; ++i) {
+        bool found = false;
+        for (size_t j = 0; j < ctx.symc && !found; ++j) {
+            found = strcmp(syms->symv[i].name, ctx.namev[j]) == 0 && syms->symv[i].vmaddr + imgs.imgv[0].slide == ctx.vmaddrv[j];
+        }
+        test_check(found);
+    }
+    core_images_close(&imgs);
+    test_foreach_free(&ctx);
+    
+    char **namev = NULL;
+    const ssize_t namec = core_symbols(&core, &namev);
+    test_check(namec == 3);
+    for (ssize_t i = 0; i < namec; ++i) {
+        free(namev[i]);
+    }
+    free(namev);
+    
+    /* fn's result stops the walk and is returned */
+    struct test_foreach_ctx stop = {0};
+    stop.stop = 2;
+    test_check(core_foreach_symbol(&core, (core_symbol_fn *) &test_collect_symbol, &stop) == 7 && stop.symc == 2);
+    test_foreach_free(&stop);
+    core_close(&core);
+    test_image_free(&cimg);
+    
+    /* an image whose string table lies outside it is skipped, and doesn't hide the images after it */
+    test_image_field(&img, symtab, struct symtab_command, stroff, 0x100000);
+    struct test_image good;
+    const struct test_symbol goodv[] = {
+        {"_good", N_SECT, 1, TEST_IMAGE_BASE + 0x100000 + 0x100},
+    };
+    test_image_init(&good, true, false, MH_EXECUTE);
+    test_image_symtab(&good, goodv, 1);
+    test_image_segments(&good, TEST_IMAGE_BASE + 0x100000, TEST_IMAGE_TEXT);
+    test_image_init(&cimg, true, false, MH_CORE);
+    test_add_image(&cimg, &img, TEST_IMAGE_SLID);
+    test_add_image(&cimg, &good, TEST_IMAGE_SLID + 0x100000);
+    test_check(core_open(test_image_file(&cimg), &core, NULL) == 0);
+    struct test_foreach_ctx bad = {0};
+    test_check(core_foreach_symbol(&core, (core_symbol_fn *) &test_collect_symbol, &bad) == 0 && bad.symc == 1);
+    test_check(strcmp(bad.namev[0], "_good") == 0 && bad.vmaddrv[0] == TEST_IMAGE_SLID + 0x100000 + 0x100);
+    test_foreach_free(&bad);
+    namev = NULL;
+    test_check(core_symbols(&core, &namev) == 1 && strcmp(namev[0], "_good") == 0);
+    free(namev[0]);
+    free(namev);
+    core_close(&core);
+    test_image_free(&cimg);
+    test_image_free(&good);
+    test_image_free(&img);
+}
+
+static bool test_stream_want(const struct core_segment *seg, const uint64_t *skip) {
+    return seg->vmbase != *skip;
+}
+
+/* a core streamed through a pipe matches its source, except that the segment not wanted, the last in the file, reads as zeros */
+static void test_stream(void) {
+    struct test_image img;
+    test_image_init(&img, true, false, MH_CORE);
+    for (size_t i = 0; i < 3; ++i) {
+        const size_t fileoff = test_image_data(&img, NULL, 2 * CORE_PAGE_SIZE, CORE_PAGE_SIZE);
+        memset(img.buf + fileoff, 'a' + 2 * i, CORE_PAGE_SIZE);
+        memset(img.buf + fileoff + CORE_PAGE_SIZE, 'b' + 2 * i, CORE_PAGE_SIZE);
+        test_image_segment(&img, "", 0x100000 + i * 0x10000, 2 * CORE_PAGE_SIZE, fileoff, 2 * CORE_PAGE_SIZE, VM_PROT_READ, 0);
+    }
+    struct core src;
+    test_check(core_open(test_image_file(&img), &src, NULL) == 0);
+    
+    /* the writer may block until the reader drains the pipe */
+    int fdv[2];
+    test_check(pipe(fdv) == 0);
+    pid_t pid;
+    test_check((pid = fork()) >= 0);
+    if (pid == 0) {
+        close(fdv[0]);
+        for (size_t off = 0; off < img.size;) {
+            const ssize_t n = write(fdv[1], img.buf + off, img.size - off);
+            if (n <= 0) {
+                _exit(EXIT_FAILURE);
+            }
+            off += n;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(fdv[1]);
+    FILE *in;
+    test_check((in = fdopen(fdv[0], "r")) != NULL);
+    
+    const uint64_t skip = 0x120000;
+    struct core_stream cs;
+    test_check(core_stream_open(in, NULL, &cs, (core_stream_want_fn *) &test_stream_want, NULL, (void *) &skip) == 0);
+    test_check(core_stream_finish(&cs) == 0);
+    int status;
+    test_check(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    fclose(in);
+    
+    char want[2 * CORE_PAGE_SIZE], got[2 * CORE_PAGE_SIZE];
+    for (size_t i = 0; i < 3; ++i) {
+        const uint64_t vmaddr = 0x100000 + i * 0x10000;
+        if (vmaddr == skip) {
+            memset(want, 0, sizeof(want));
+        } else {
+            test_check(core_vm_pread(&src, want, sizeof(want), vmaddr) == sizeof(want));
+        }
+        test_check(core_stream_received(&cs, vmaddr, sizeof(want)) == (vmaddr != skip));
+        test_check(core_vm_pread(&cs.core, got, sizeof(got), vmaddr) == sizeof(got));
+        test_check(memcmp(want, got, sizeof(got)) == 0);
+        
+        memset(got, 'z', sizeof(got));
+        test_check(fseek(cs.core.vm, vmaddr, SEEK_SET) == 0 && fread(got, sizeof(got), 1, cs.core.vm) == 1);
+        test_check(memcmp(want, got, sizeof(got)) == 0);
+    }
+    
+    core_stream_close(&cs);
+    core_close(&src);
+    test_image_free(&img);
+}
+
+#define TEST_DSC_BASE 0x180000000ULL
+#define TEST_DSC_SIZE 0xc000
+#define TEST_DSC_SLIDE 0x20000ULL
+
+static const struct test_symbol test_dsc_symv[2][2] = {
+    {{"_a", N_SECT | N_EXT, 1, TEST_DSC_BASE + 0x4100}, {"_b", N_SECT | N_EXT, 1, TEST_DSC_BASE + 0x4200}},
+    {{"_c", N_SECT | N_EXT, 1, TEST_DSC_BASE + 0x8100}, {"_d", N_SECT | N_EXT, 1, TEST_DSC_BASE + 0x8200}},
+};
+static const char *const test_dsc_pathv[2] = {"/usr/lib/liba.dylib", "/usr/lib/libb.dylib"};
+
+static void test_dsc_put32(uint8_t *cache, size_t off, uint32_t value) {
+    memcpy(cache + off, &value, sizeof(value));
+}
+
+static void test_dsc_put64(uint8_t *cache, size_t off, uint64_t value) {
+    memcpy(cache + off, &value, sizeof(value));
+}
+
+/* one mapping over the whole cache holding two images at 0x4000 and 0x8000, listed in reverse address order.
+ * The image list is found through the pre-2020 header fields, or through the ones at the end of the current header. */
+static uint8_t *test_dsc_cache(bool old) {
+    uint8_t *cache;
+    test_check((cache = calloc(1, TEST_DSC_SIZE)) != NULL);
+    memcpy(cache, "dyld_v1   arm64", 16);
+    const size_t mapoff = old ? 0x20 : 0x1c8;
+    const size_t imgoff = mapoff + 0x20;
+    test_dsc_put32(cache, 0x10, mapoff);
+    test_dsc_put32(cache, 0x14, 1);
+    test_dsc_put32(cache, old ? 0x18 : 0x1c0, imgoff);
+    test_dsc_put32(cache, old ? 0x1c : 0x1c4, 2);
+    
+    test_dsc_put64(cache, mapoff, TEST_DSC_BASE);
+    test_dsc_put64(cache, mapoff + 0x08, TEST_DSC_SIZE);
+    test_dsc_put32(cache, mapoff + 0x18, VM_PROT_READ | VM_PROT_EXECUTE);
+    test_dsc_put32(cache, mapoff + 0x1c, VM_PROT_READ | VM_PROT_EXECUTE);
+    
+    for (size_t i = 0; i < 2; ++i) {
+        const size_t fileoff = 0x4000 * (i + 1);
+        const size_t info = imgoff + 0x20 * (1 - i);
+        const size_t path = 0x1000 + 0x100 * i;
+        test_dsc_put64(cache, info, TEST_DSC_BASE + fileoff);
+        test_dsc_put32(cache, info + 0x18, path);
+        strcpy((char *) cache + path, test_dsc_pathv[i]);
+        
+        struct test_image img;
+        test_image_init(&img, true, false, MH_DYLIB);
+        test_image_symtab(&img, test_dsc_symv[i], 2);
+        test_image_segments(&img, TEST_DSC_BASE + fileoff, TEST_IMAGE_DATA);
+        fclose(test_image_file(&img)); // writes img's header
+        test_check(img.size <= 0x4000);
+        memcpy(cache + fileoff, img.buf, img.size);
+        test_image_free(&img);
+    }
+    return cache;
+}
+
+/* images are indexed by address, and their symbols found at runtime addresses */
+static void test_dsc_check(struct dsc *dsc, int64_t slide) {
+    test_check(dsc->mapc == 1 && dsc->imgc == 2 && dsc->slide == slide);
+    for (size_t i = 0; i < 2; ++i) {
+        const struct dsc_image *img = &dsc->imgv[i];
+        test_check(img->vmbase == TEST_DSC_BASE + 0x4000 * (i + 1) && img->vmend == img->vmbase + 0x4000);
+        test_check(strcmp(img->path, test_dsc_pathv[i]) == 0);
+    }
+    test_check(dsc_find_image(dsc, TEST_DSC_BASE + 0x3fff) == NULL);
+    test_check(dsc_find_image(dsc, TEST_DSC_BASE + 0x7fff) == &dsc->imgv[0]);
+    test_check(dsc_find_image(dsc, TEST_DSC_BASE + 0x8000) == &dsc->imgv[1]);
+    test_check(dsc_find_image(dsc, TEST_DSC_BASE + TEST_DSC_SIZE) == NULL);
+    
+    struct dsc_image *img = NULL;
+    const struct symbol *sym = dsc_find(dsc, TEST_DSC_BASE + 0x4250 + slide, &img);
+    test_check(sym != NULL && strcmp(sym->name, "_b") == 0 && sym->vmaddr == TEST_DSC_BASE + 0x4200 && img == &dsc->imgv[0]);
+    sym = dsc_find(dsc, TEST_DSC_BASE + 0x8100 + slide, &img);
+    test_check(sym != NULL && strcmp(sym->name, "_c") == 0 && img == &dsc->imgv[1]);
+    test_check(dsc_find(dsc, TEST_DSC_BASE + 0x100 + slide, NULL) == NULL);
+}
+
+/* a synthetic cache with either header layout, read from a file and from inside a core */
+static void test_dsc(void) {
+    for (int old = 0; old < 2; ++old) {
+        uint8_t *cache = test_dsc_cache(old);
+        
+        char path[] = "/tmp/core-test.XXXXXX";
+        int fd;
+        test_check((fd = mkstemp(path)) >= 0);
+        test_check(write(fd, cache, TEST_DSC_SIZE) == TEST_DSC_SIZE && close(fd) == 0);
+        struct dsc dsc;
+        test_check(dsc_open_file(path, &dsc) == 0);
+        unlink(path);
+        test_dsc_check(&dsc, 0);
+        dsc.slide = TEST_DSC_SLIDE;
+        test_dsc_check(&dsc, TEST_DSC_SLIDE);
+        dsc_close(&dsc);
+        
+        struct test_image cimg;
+        test_image_init(&cimg, true, false, MH_CORE);
+        const size_t fileoff = test_image_data(&cimg, cache, TEST_DSC_SIZE, CORE_PAGE_SIZE);
+        test_image_segment(&cimg, "", TEST_DSC_BASE + TEST_DSC_SLIDE, TEST_DSC_SIZE, fileoff, TEST_DSC_SIZE, VM_PROT_READ | VM_PROT_EXECUTE, 0);
+        struct core core;
+        test_check(core_open(test_image_file(&cimg), &core, NULL) == 0);
+        test_check(dsc_open_core(&core, &dsc) == 0);
+        test_dsc_check(&dsc, TEST_DSC_SLIDE);
+        dsc_close(&dsc);
+        core_close(&core);
+        test_image_free(&cimg);
+        free(cache);
+    }
+    
+    /* a core without a cache */
+    const struct test_segment segv[] = {{0x10000, 0x1000}};
+    struct test_image img;
+    struct core core;
+    struct dsc dsc;
+    test_open_core(&img, segv, 1, &core);
+    test_check(dsc_open_core(&core, &dsc) == -1 && errno == ENOENT);
+    core_close(&core);
+    test_image_free(&img);
+}
+
+struct test_run {
+    uint8_t size;
+    uint16_t count;
+};
+
+struct test_state {
+    uint32_t flavor;
+    const struct test_run *runv;
+    size_t runc;
+};
+
+#define TEST_STATE(flavor, runv) {flavor, runv, sizeof(runv) / sizeof(*runv)}
+
+static size_t test_state_size(const struct test_state *state) {
+    size_t size = 0;
+    for (size_t i = 0; i < state->runc; ++i) {
+        size += (size_t) state->runv[i].size * state->runv[i].count;
+    }
+    return size;
+}
+
+/* MH_CORE with an LC_THREAD holding statev, every field a distinct value in the image's byte order;
+ * returns the offset of the first state's flavor */
+static size_t test_thread_image(struct test_image *img, bool swap, cpu_type_t cputype,
+                                const struct test_state *statev, size_t statec) {
+    test_image_init(img, true, swap, MH_CORE);
+    img->cputype = cputype;
+    size_t cmdsize = sizeof(struct thread_command);
+    for (size_t i = 0; i < statec; ++i) {
+        cmdsize += 2 * sizeof(uint32_t) + test_state_size(&statev[i]);
+    }
+    const size_t first = test_image_cmd(img, LC_THREAD, cmdsize) + sizeof(struct thread_command);
+    
+    size_t off = first;
+    uint64_t value = 0x1122334455667788ULL;
+    for (size_t i = 0; i < statec; ++i) {
+        const struct test_state *state = &statev[i];
+        test_image_put(img, off, state->flavor, sizeof(uint32_t));
+        test_image_put(img, off + sizeof(uint32_t), test_state_size(state) / sizeof(uint32_t), sizeof(uint32_t));
+        off += 2 * sizeof(uint32_t);
+        for (size_t j = 0; j < state->runc; ++j) {
+            const struct test_run *run = &state->runv[j];
+            for (size_t k = 0; k < run->count; ++k, off += run->size, value += 0x0101010101010101ULL) {
+                if (run->size == 16) {
+                    test_image_put(img, off + (img->swap ? 8 : 0), value, sizeof(uint64_t));
+                    test_image_put(img, off + (img->swap ? 0 : 8), ~value, sizeof(uint64_t));
+                } else if (run->size == 1) {
+                    img->buf[off] = value;
+                } else {
+                    test_image_put(img, off, value, run->size);
+                }
+            }
+        }
+    }
+    return first;
+}
+
+/* thread states of an opposite-endian core come out as those of the same core written in host order.
+ * patches are (offset from the first state, 32-bit value) pairs applied to both. */
+static void test_thread_swap(cpu_type_t cputype, const struct test_state *statev, size_t statec,
+                             const uint32_t (*patchv)[2], size_t patchc) {
+    struct test_image imgv[2];
+    struct core corev[2];
+    for (int swap = 0; swap < 2; ++swap) {
+        const size_t first = test_thread_image(&imgv[swap], swap, cputype, statev, statec);
+        for (size_t i = 0; i < patchc; ++i) {
+            test_image_put(&imgv[swap], first + patchv[i][0], patchv[i][1], sizeof(uint32_t));
+        }
+        test_check(core_open(test_image_file(&imgv[swap]), &corev[swap], NULL) == 0);
+        test_check(corev[swap].swap == swap && corev[swap].thrc == 1);
+    }
+    
+    const struct thread_command *a = corev[0].thrv[0], *b = corev[1].thrv[0];
+    test_check(a->cmd == LC_THREAD && b->cmd == LC_THREAD && a->cmdsize == b->cmdsize);
+    test_check(memcmp(a, b, a->cmdsize) == 0);
+    
+    for (int swap = 0; swap < 2; ++swap) {
+        core_close(&corev[swap]);
+        test_image_free(&imgv[swap]);
+    }
+}
+
+/* the same core written in host order opens, but the opposite-endian one fails with err */
+static void test_thread_reject(cpu_type_t cputype, const struct test_state *statev, size_t statec,
+                               size_t patch, uint32_t value, int err) {
+    for (int swap = 0; swap < 2; ++swap) {
+        struct test_image img;
+        struct core core;
+        const size_t first = test_thread_image(&img, swap, cputype, statev, statec);
+        test_image_put(&img, first + patch, value, sizeof(value));
+        errno = 0;
+        if (swap) {
+            test_check(core_open(test_image_file(&img), &core, NULL) < 0);
+            test_check(errno == err);
+        } else {
+            test_check(core_open(test_image_file(&img), &core, NULL) == 0);
+        }
+        core_close(&core);
+        test_image_free(&img);
+    }
+}
+
+static const struct test_run test_arm_thread64[] = {{8, 33}, {4, 2}};        // x[29], fp, lr, sp, pc; cpsr, pad
+static const struct test_run test_arm_exception64[] = {{8, 1}, {4, 2}};      // far; esr, exception
+static const struct test_run test_arm_neon64[] = {{16, 32}, {4, 2}};         // v[32]; fpsr, fpcr
+static const struct test_run test_arm_debug64[] = {{8, 65}};
+static const struct test_run test_arm_debug32[] = {{4, 64}, {8, 1}};         // bvr, bcr, wvr, wcr; mdscr_el1
+static const struct test_run test_arm_unified64[] = {{4, 2}, {8, 33}, {4, 2}}; // arm_state_hdr, then as above
+static const struct test_run test_x86_thread64[] = {{8, 21}};
+static const struct test_run test_x86_exception64[] = {{2, 2}, {4, 1}, {8, 1}}; // trapno, cpu; err; faultvaddr
+static const struct test_run test_x86_float64[] = {
+    {4, 2}, {2, 2}, {1, 2}, {2, 1}, {4, 1}, {2, 2}, {4, 1}, {2, 2}, {4, 2}, {1, 480}, {4, 1},
+};
+
+static void test_thread_states(void) {
+    const struct test_state arm64[] = {
+        TEST_STATE(6, test_arm_thread64),    // ARM_THREAD_STATE64
+        TEST_STATE(7, test_arm_exception64), // ARM_EXCEPTION_STATE64
+        TEST_STATE(17, test_arm_neon64),     // ARM_NEON_STATE64
+        TEST_STATE(15, test_arm_debug64),    // ARM_DEBUG_STATE64
+        TEST_STATE(14, test_arm_debug32),    // ARM_DEBUG_STATE32
+    };
+    test_thread_swap(CPU_TYPE_ARM64, arm64, sizeof(arm64) / sizeof(*arm64), NULL, 0);
+    
+    /* ARM_THREAD_STATE names its ARM_THREAD_STATE64 in an arm_state_hdr */
+    const struct test_state unified[] = {TEST_STATE(1, test_arm_unified64)};
+    const uint32_t hdr[][2] = {{8, 6}, {12, 68}};
+    test_thread_swap(CPU_TYPE_ARM64, unified, 1, hdr, 2);
+    
+    const struct test_state x86_64[] = {
+        TEST_STATE(4, test_x86_thread64),    // x86_THREAD_STATE64
+        TEST_STATE(5, test_x86_float64),     // x86_FLOAT_STATE64
+        TEST_STATE(6, test_x86_exception64), // x86_EXCEPTION_STATE64
+    };
+    test_thread_swap(CPU_TYPE_X86_64, x86_64, sizeof(x86_64) / sizeof(*x86_64), NULL, 0);
+    
+    const struct test_state arm[] = {TEST_STATE(14, test_arm_debug32)}; // ARM_DEBUG_STATE32
+    test_thread_swap(CPU_TYPE_ARM, arm, 1, NULL, 0);
+    
+    /* unknown flavors, including those of the other architecture */
+    test_thread_reject(CPU_TYPE_ARM64, arm64, 1, 0, 99, ENOTSUP);
+    test_thread_reject(CPU_TYPE_ARM64, &x86_64[1], 1, 0, 5, ENOTSUP);
+    /* counts that disagree with the flavor or overrun the command */
+    test_thread_reject(CPU_TYPE_ARM64, arm64, 1, 4, 66, EINVAL);
+    test_thread_reject(CPU_TYPE_ARM64, arm64, 1, 4, 0x1000, EINVAL);
+    test_thread_reject(CPU_TYPE_X86_64, &x86_64[2], 1, 4, 3, EINVAL);
+    
+    /* header naming more state than follows it */
+    struct test_image img;
+    struct core core;
+    const size_t first = test_thread_image(&img, true, CPU_TYPE_ARM64, unified, 1);
+    test_image_put(&img, first + 8, 6, sizeof(uint32_t));
+    test_image_put(&img, first + 12, 69, sizeof(uint32_t));
+    errno = 0;
+    test_check(core_open(test_image_file(&img), &core, NULL) < 0);
+    test_check(errno == EINVAL);
+    core_close(&core);
+    test_image_free(&img);
+}
+
+#define TEST_STACK 0x10000ULL
+
+/* arm64 core with a two-page stack, pages reached from it and from lr, and a page nothing points at */
+static void test_minimize_image(struct test_image *img, bool swap) {
+    const struct test_segment segv[] = {
+        {TEST_STACK, 2 * CORE_PAGE_SIZE},
+        {0x20000, CORE_PAGE_SIZE},
+        {0x30000, CORE_PAGE_SIZE},
+        {0x40000, CORE_PAGE_SIZE},
+    };
+    test_image_init(img, true, swap, MH_CORE);
+    for (size_t i = 0; i < sizeof(segv) / sizeof(*segv); ++i) {
+        const size_t fileoff = test_image_data(img, NULL, segv[i].vmsize, CORE_PAGE_SIZE);
+        memset(img->buf + fileoff, 'a' + i, segv[i].vmsize);
+        test_image_segment(img, "", segv[i].vmaddr, segv[i].vmsize, fileoff, segv[i].vmsize, VM_PROT_READ | VM_PROT_WRITE, 0);
+    }
+    /* the stack holds a pointer into 0x20000 */
+    test_image_put(img, TEST_IMAGE_DATA + 0x800, 0x20010, sizeof(uint64_t));
+    
+    /* ARM_THREAD_STATE64 with lr into 0x30000 and sp in the middle of the first stack page */
+    const size_t cmd = test_image_cmd(img, LC_THREAD, sizeof(struct thread_command) + 2 * sizeof(uint32_t) + 68 * sizeof(uint32_t));
+    const size_t state = cmd + sizeof(struct thread_command) + 2 * sizeof(uint32_t);
+    test_image_put(img, state - 2 * sizeof(uint32_t), 6, sizeof(uint32_t));
+    test_image_put(img, state - sizeof(uint32_t), 68, sizeof(uint32_t));
+    test_image_put(img, state + 30 * sizeof(uint64_t), 0x30008, sizeof(uint64_t));
+    test_image_put(img, state + 31 * sizeof(uint64_t), TEST_STACK + 0x800, sizeof(uint64_t));
+    test_image_put(img, state + 33 * sizeof(uint64_t), 0x60000000, sizeof(uint32_t)); // cpsr
+}
+
+/* minimizing an opposite-endian core follows its pointers and writes a core in its byte order,
+ * holding the same pages and threads as minimizing the same core written in host order */
+static void test_minimize_swapped(void) {
+    const uint64_t keptv[] = {TEST_STACK, TEST_STACK + CORE_PAGE_SIZE, 0x20000, 0x30000};
+    const struct core_minimize_opts opts = {CORE_MINIMIZE_STACKS, 1, 0, NULL};
+    struct test_image imgv[2];
+    struct core corev[2], minv[2];
+    for (int swap = 0; swap < 2; ++swap) {
+        test_minimize_image(&imgv[swap], swap);
+        test_check(core_open(test_image_file(&imgv[swap]), &corev[swap], NULL) == 0);
+        
+        FILE *out;
+        test_check((out = tmpfile()) != NULL);
+        test_check(core_minimize(&corev[swap], &opts, out) == 0);
+        test_check(fflush(out) == 0);
+        test_check(core_open(out, &minv[swap], NULL) == 0);
+        test_check(minv[swap].swap == swap && minv[swap].cputype == CPU_TYPE_ARM64);
+        
+        /* the stack, its pointee and lr's page, but not the page nothing points at */
+        test_check(core_segment_find(&minv[swap], 0x40000) == NULL);
+        for (size_t i = 0; i < sizeof(keptv) / sizeof(*keptv); ++i) {
+            uint8_t a[CORE_PAGE_SIZE], b[CORE_PAGE_SIZE];
+            test_check(core_segment_find(&minv[swap], keptv[i]) != NULL);
+            test_check(fseek(corev[swap].vm, keptv[i], SEEK_SET) == 0 && fread(a, 1, sizeof(a), corev[swap].vm) == sizeof(a));
+            test_check(fseek(minv[swap].vm, keptv[i], SEEK_SET) == 0 && fread(b, 1, sizeof(b), minv[swap].vm) == sizeof(b));
+            test_check(memcmp(a, b, sizeof(a)) == 0);
+        }
+        
+        test_check(minv[swap].thrc == 1);
+        const struct thread_command *thr = corev[swap].thrv[0];
+        test_check(memcmp(minv[swap].thrv[0], thr, thr->cmdsize) == 0);
+    }
+    test_check(memcmp(minv[0].thrv[0], minv[1].thrv[0], minv[0].thrv[0]->cmdsize) == 0);
+    
+    for (int swap = 0; swap < 2; ++swap) {
+        core_close(&minv[swap]);
+        core_close(&corev[swap]);
+        test_image_free(&imgv[swap]);
+    }
+}
+
+int main(void) {
+    test_segment_empty();
+    test_segment_overlap();
+    test_segment_disjoint();
+    test_summary_duplicates();
+    test_pages_error();
+    test_diff();
+    test_strings();
+    test_foreach_symbol();
+    test_dsc();
+    test_stream();
+    test_thread_states();
+    test_minimize_swapped();
+    return EXIT_SUCCESS;
+}
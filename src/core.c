@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include <mach-o/loader.h>
 
@@ -10,21 +11,52 @@
 #include "macho.h"
 #include "bound.h"
 #include "symbols.h"
+#include "images.h"
 
 static int core_open_macho32(FILE *f, struct core *core);
 static int core_open_macho64(FILE *f, struct core *core);
 static int core_open_vm(struct core *core);
+static int core_index_segments(struct core *core);
 
 _Thread_local const char *errfn = NULL;
 
 static void core_init(struct core *core, FILE *f) {
     core->f    = f;
     core->fmt  = CORE_INVALID;
+    core->swap = false;
+    core->cputype    = 0;
+    core->cpusubtype = 0;
     core->segc = 0;
     core->segv = NULL;
+    core->segidxc = 0;
+    core->segidx = NULL;
+    core->segoverlap = false;
+    core->thrc = 0;
+    core->thrv = NULL;
+    core->has_uuid = false;
+    memset(core->uuid, 0, sizeof(core->uuid));
     core->vm   = NULL;
 }
 
+void core_close(struct core *core) {
+    if (core->vm != NULL && core->vm != core->f) {
+        fclose(core->vm);
+    }
+    if (core->f != NULL) {
+        fclose(core->f);
+    }
+    for (size_t i = 0; i < core->segc; ++i) {
+        free(core->segv[i].name);
+    }
+    free(core->segv);
+    free(core->segidx);
+    for (size_t i = 0; i < core->thrc; ++i) {
+        free(core->thrv[i]);
+    }
+    free(core->thrv);
+    core_init(core, NULL);
+}
+
 void core_perror(const char *s) {
     fprintf(stderr, "%s: %s: %s\n", s, errfn, strerror(errno));
 }
@@ -36,6 +68,13 @@ static int core_reserve_segments(struct core *core, size_t count) {
     return 0;
 }
 
+static int core_reserve_threads(struct core *core, size_t count) {
+    if ((core->thrv = calloc(count, sizeof(struct thread_command *))) == NULL) {
+        return -1;
+    }
+    return 0;
+}
+
 int core_fopen(const char *path, struct core *core) {
     FILE *f;
     if ((f = fopen(path, "r")) == NULL) {
@@ -63,12 +102,18 @@ int core_open(FILE *f, struct core *core, FILE *vm) {
     fseek_chk(f, -4, SEEK_CUR);
     
     int res;
-    if (magic == MH_MAGIC) {
+    core->swap = magic == MH_CIGAM || magic == MH_CIGAM_64;
+    if (magic == MH_MAGIC || magic == MH_CIGAM) {
         res = core_open_macho32(f, core);
-    } else if (magic == MH_MAGIC_64) {
+    } else if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
         res = core_open_macho64(f, core);
     } else {
-        errfn = EINVAL;
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    if (res == 0 && core_index_segments(core) < 0) {
         goto error;
     }
     
@@ -91,6 +136,10 @@ error:
 static int core_open_macho32(FILE *f, struct core *core) {
     struct mach_header hdr;
     fread_one_chk(hdr, f);
+    if (core->swap) {
+        macho_swap_header((struct mach_header *) &hdr);
+    }
+    core->fmt = CORE_MACHO32;
     
 #if 0
     if (hdr.filetype != MH_CORE) {
@@ -100,13 +149,17 @@ static int core_open_macho32(FILE *f, struct core *core) {
     }
 #endif
     
-    if (core_reserve_segments(core, hdr.ncmds) < 0) {
+    core->cputype    = hdr.cputype;
+    core->cpusubtype = hdr.cpusubtype;
+    
+    if (core_reserve_segments(core, hdr.ncmds) < 0 ||
+        core_reserve_threads(core, hdr.ncmds) < 0) {
         goto error;
     }
     
     for (size_t i = 0; i < hdr.ncmds; ++i) {
         struct load_command *cmd;
-        if ((cmd = macho_parse_lc(f)) == NULL) {
+        if ((cmd = macho_parse_lc_swap(f, core->swap, core->cputype)) == NULL) {
             goto error;
         }
         switch (cmd->cmd) {
@@ -122,6 +175,19 @@ static int core_open_macho32(FILE *f, struct core *core) {
                 break;
             }
                 
+            case LC_THREAD:
+            case LC_UNIXTHREAD:
+                core->thrv[core->thrc++] = (struct thread_command *) cmd;
+                cmd = NULL;
+                break;
+                
+            case LC_UUID:
+                if (cmd->cmdsize >= sizeof(struct uuid_command)) {
+                    memcpy(core->uuid, ((struct uuid_command *) cmd)->uuid, sizeof(core->uuid));
+                    core->has_uuid = true;
+                }
+                break;
+                
             default:
                 break;
         }
@@ -138,6 +204,10 @@ error:
 static int core_open_macho64(FILE *f, struct core *core) {
     struct mach_header_64 hdr;
     fread_one_chk(hdr, f);
+    if (core->swap) {
+        macho_swap_header((struct mach_header *) &hdr);
+    }
+    core->fmt = CORE_MACHO64;
     
 #if 0
     if (hdr.filetype != MH_CORE) {
@@ -147,13 +217,17 @@ static int core_open_macho64(FILE *f, struct core *core) {
     }
 #endif
     
-    if (core_reserve_segments(core, hdr.ncmds) < 0) {
+    core->cputype    = hdr.cputype;
+    core->cpusubtype = hdr.cpusubtype;
+    
+    if (core_reserve_segments(core, hdr.ncmds) < 0 ||
+        core_reserve_threads(core, hdr.ncmds) < 0) {
         goto error;
     }
     
     for (size_t i = 0; i < hdr.ncmds; ++i) {
         struct load_command *cmd;
-        if ((cmd = macho_parse_lc(f)) == NULL) {
+        if ((cmd = macho_parse_lc_swap(f, core->swap, core->cputype)) == NULL) {
             goto error;
         }
         
@@ -169,6 +243,19 @@ static int core_open_macho64(FILE *f, struct core *core) {
                 strdup_chk(cseg->name, mseg->segname);
                 break;
             }
+                
+            case LC_THREAD:
+            case LC_UNIXTHREAD:
+                core->thrv[core->thrc++] = (struct thread_command *) cmd;
+                cmd = NULL;
+                break;
+                
+            case LC_UUID:
+                if (cmd->cmdsize >= sizeof(struct uuid_command)) {
+                    memcpy(core->uuid, ((struct uuid_command *) cmd)->uuid, sizeof(core->uuid));
+                    core->has_uuid = true;
+                }
+                break;
         }
         
         free(cmd);
@@ -180,20 +267,114 @@ error:
     return -1;
 }
 
-// find segment containing vmaddr
-static struct core_segment *core_find_vmaddr(struct core *core, uint64_t vmaddr) {
+static int core_index_cmp(const struct core_segment **a, const struct core_segment **b) {
+    return ((*a)->vmbase > (*b)->vmbase) - ((*a)->vmbase < (*b)->vmbase);
+}
+
+static int core_index_segments(struct core *core) {
+    if ((core->segidx = calloc(core->segc, sizeof(struct core_segment *))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    
+    /* zero-size segments contain nothing, and would shadow their predecessor in the search */
     for (size_t i = 0; i < core->segc; ++i) {
-        struct core_segment *seg = &core->segv[i];
-        if (seg->vmbase <= vmaddr && vmaddr < seg->vmbase + seg->vmsize) {
-            return seg;
+        if (core->segv[i].vmsize != 0) {
+            core->segidx[core->segidxc++] = &core->segv[i];
+        }
+    }
+    qsort(core->segidx, core->segidxc, sizeof(struct core_segment *), (int (*)(const void *, const void *)) &core_index_cmp);
+    
+    /* the search assumes disjoint segments; otherwise fall back to the scan in load command order */
+    uint64_t end = 0;
+    for (size_t i = 0; i < core->segidxc; ++i) {
+        const struct core_segment *seg = core->segidx[i];
+        if (i > 0 && seg->vmbase < end) {
+            core->segoverlap = true;
+            break;
+        }
+        end = seg->vmbase + seg->vmsize < seg->vmbase ? UINT64_MAX : seg->vmbase + seg->vmsize;
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+const struct core_segment *core_segment_find(const struct core *core, uint64_t vmaddr) {
+    if (core->segoverlap) {
+        for (size_t i = 0; i < core->segc; ++i) {
+            const struct core_segment *seg = &core->segv[i];
+            if (vmaddr - seg->vmbase < seg->vmsize) {
+                return seg;
+            }
         }
+        return NULL;
+    }
+    
+    /* find last segment starting at or below vmaddr */
+    size_t lo = 0, hi = core->segidxc;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (core->segidx[mid]->vmbase <= vmaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    const struct core_segment *seg = core->segidx[lo - 1];
+    if (vmaddr - seg->vmbase < seg->vmsize) {
+        return seg;
     }
     return NULL;
 }
 
+ssize_t core_vm_pread(const struct core *core, void *buf, size_t len, uint64_t vmaddr) {
+    int fd;
+    if ((fd = fileno(core->f)) < 0) {
+        errno = EBADF; // not backed by a file descriptor (e.g. an image opened on a funopen(3) stream)
+        errfn = "fileno";
+        goto error;
+    }
+    
+    size_t total = 0;
+    while (total < len) {
+        const struct core_segment *seg;
+        if ((seg = core_segment_find(core, vmaddr + total)) == NULL) {
+            break;
+        }
+        const uint64_t offset = vmaddr + total - seg->vmbase;
+        if (offset >= seg->filesize) {
+            break;
+        }
+        const size_t size = min(seg->filesize - offset, len - total);
+        const ssize_t bytes_read = pread(fd, (char *) buf + total, size, seg->filebase + offset);
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            errfn = "pread";
+            goto error;
+        }
+        if (bytes_read == 0) {
+            break; // truncated core
+        }
+        total += bytes_read;
+    }
+    
+    return total;
+    
+error:
+    return -1;
+}
+
 /* create vm file using funopen(3) */
 typedef int core_vm_read_t(void *, char *, int);
 typedef fpos_t core_vm_seek_t(void *, fpos_t, int);
+typedef int core_vm_close_t(void *);
 
 struct core_vm {
     struct core *core;
@@ -208,8 +389,8 @@ static int core_vm_read(struct core_vm *vm, char *buf, int size) {
     int total = 0;
     while (size > 0) {
         /* find segment containing vm_addr */
-        struct core_segment *seg;
-        if ((seg = core_find_vmaddr(vm->core, *vmaddr)) == NULL) {
+        const struct core_segment *seg;
+        if ((seg = core_segment_find(vm->core, *vmaddr)) == NULL) {
             break;
         }
         const uint64_t offset = *vmaddr - seg->vmbase;
@@ -233,6 +414,11 @@ error:
     return -1;
 }
 
+static int core_vm_close(struct core_vm *vm) {
+    free(vm);
+    return 0;
+}
+
 static fpos_t core_vm_seek(struct core_vm *vm, fpos_t pos, int whence) {
     switch (whence) {
         case SEEK_SET:
@@ -261,13 +447,13 @@ static int core_open_vm(struct core *core) {
     vm->core = core;
     vm->pos = 0;
     
-    if ((core->vm = funopen(vm, (core_vm_read_t *) &core_vm_read, NULL, (core_vm_seek_t *) &core_vm_seek, NULL)) == NULL) {
+    if ((core->vm = funopen(vm, (core_vm_read_t *) &core_vm_read, NULL, (core_vm_seek_t *) &core_vm_seek, (core_vm_close_t *) &core_vm_close)) == NULL) {
         errfn = "funopen";
         goto error;
     }
     
     return 0;
-
+    
 error:
     return -1;
 }
@@ -278,7 +464,6 @@ off_t core_ftovm(const struct core *core, off_t fileoff) {
     for (size_t i = 0; i < core->segc; ++i) {
         const struct core_segment *seg = &core->segv[i];
         if (seg->filebase <= fileoff && fileoff < seg->filebase + seg->filesize) {
-            fprintf(stderr, "%s: match: filebase=%08llx vmbase=%08llx\n", __FUNCTION__, seg->filebase, seg->vmbase);
             return seg->vmbase + (fileoff - seg->filebase);
         }
     }
@@ -288,46 +473,46 @@ off_t core_ftovm(const struct core *core, off_t fileoff) {
 }
 
 
+struct core_symbols_ctx {
+    char **symv;
+    size_t symc;
+    size_t cap;
+};
+
+static int core_symbols_add(const struct core_image *img, const char *name, uint64_t vmaddr, struct core_symbols_ctx *ctx) {
+    if (ctx->symc == ctx->cap) {
+        ctx->cap = max(ctx->cap * 2, 256);
+        char **symv;
+        if ((symv = realloc(ctx->symv, sizeof(char *) * ctx->cap)) == NULL) {
+            errfn = "realloc";
+            return -1;
+        }
+        ctx->symv = symv;
+    }
+    if ((ctx->symv[ctx->symc] = strdup(name)) == NULL) {
+        errfn = "strdup";
+        return -1;
+    }
+    ++ctx->symc;
+    return 0;
+}
+
 ssize_t core_symbols(const struct core *core, char ***symvecp) {
     free(*symvecp);
+    *symvecp = NULL;
     
-    size_t count = 0;
-    for (size_t i = 0; i < core->segc; ++i) {
-        const struct core_segment *seg = &core->segv[i];
-        
-        if (seg->prot != (VM_PROT_READ | VM_PROT_EXECUTE)) {
-            continue;
-        }
-        
-        FILE *seg_f;
-        if ((seg_f = lbound_open(core->vm, seg->vmbase)) == NULL) {
-            goto error;
-        }
-        
-        struct core incore;
-        if (core_open(seg_f, &incore, seg_f) < 0) {
-            continue;
-        }
-        
-        struct symbols syms;
-        if (symbols_open(&incore, &syms) < 0) {
-            continue;
-        }
-        
-        const size_t newcount = count + syms.symc;
-        if ((*symvecp = reallocf(*symvecp, sizeof(char *) * newcount)) == NULL) {
-            goto error;
-        }
-        
-        for (size_t i = 0; i < syms.symc; ++i) {
-            (*symvecp)[count + i] = syms.symv[i].name;
-        }
-        
-        count = newcount;
+    struct core_symbols_ctx ctx = {NULL, 0, 0};
+    if (core_foreach_symbol(core, (core_symbol_fn *) &core_symbols_add, &ctx) != 0) {
+        goto error;
     }
     
-    return count;
+    *symvecp = ctx.symv;
+    return ctx.symc;
     
 error:
+    for (size_t i = 0; i < ctx.symc; ++i) {
+        free(ctx.symv[i]);
+    }
+    free(ctx.symv);
     return -1;
 }
@@ -4,11 +4,15 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <mach/vm_prot.h>
+#include <mach/machine.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define CORE_PAGE_SHIFT 12
+#define CORE_PAGE_SIZE (1ULL << CORE_PAGE_SHIFT)
+
 struct core_segment {
     uint64_t filebase;
     uint64_t filesize;
@@ -24,22 +28,42 @@ enum core_format {
     CORE_MACHO64,
 };
 
+struct thread_command;
+
 struct core {
     FILE *f; // backing file
     enum core_format fmt; // format of core
+    bool swap; // opposite-endian (MH_CIGAM*) file; parsed fields are converted to host order
+    cpu_type_t cputype;
+    cpu_subtype_t cpusubtype;
     size_t segc;
     struct core_segment *segv;
+    size_t segidxc;
+    const struct core_segment **segidx; // non-empty segments sorted by vmbase
+    bool segoverlap; // some segments overlap, so lookups scan segv in order
+    size_t thrc;
+    struct thread_command **thrv; // raw LC_THREAD/LC_UNIXTHREAD commands
+    bool has_uuid;
+    uint8_t uuid[16]; // from LC_UUID
     FILE *vm;
 };
 
 int core_fopen(const char *path, struct core *core);
 int core_open(FILE *f, struct core *core, FILE *vm); // vm may be null
+void core_close(struct core *core); // closes f and vm
+
+/* find segment containing vmaddr; where segments overlap, the first in load command order wins */
+const struct core_segment *core_segment_find(const struct core *core, uint64_t vmaddr);
+
+/* read VM memory with pread(2) on the backing file; no shared position, so safe to call from many threads.
+ * returns bytes read, short if the range leaves the core's file-backed memory. */
+ssize_t core_vm_pread(const struct core *core, void *buf, size_t len, uint64_t vmaddr);
 
 void core_perror(const char *s);
 
 off_t core_ftovm(const struct core *core, off_t fileoff);
 
-/* this lists all symbols in a core file */
+/* this lists all symbols in a core file; names are strdup'd, so free each of them and the vector */
 ssize_t core_symbols(const struct core *core, char ***symvecp);
 
 #ifdef __cplusplus
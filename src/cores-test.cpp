@@ -0,0 +1,150 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <mach-o/nlist.h>
+
+#include "cores.hpp"
+#include "test.h"
+
+/* the header-only C++ interface compiles, moves ownership, and reports failures through Expected */
+
+using cores::Core;
+using cores::Expected;
+using cores::LoadCommands;
+using cores::Symbols;
+
+static_assert(!std::is_copy_constructible_v<Core> && !std::is_copy_assignable_v<Core>);
+static_assert(std::is_nothrow_move_constructible_v<Core> && std::is_nothrow_move_assignable_v<Core>);
+static_assert(!std::is_copy_constructible_v<Symbols> && !std::is_copy_assignable_v<Symbols>);
+static_assert(std::is_nothrow_move_constructible_v<Symbols> && std::is_nothrow_move_assignable_v<Symbols>);
+static_assert(std::ranges::forward_range<LoadCommands> && std::ranges::view<LoadCommands>);
+
+static constexpr uint64_t test_base = 0x100000000ULL;
+static constexpr uint64_t test_text = 4 * CORE_PAGE_SIZE;
+
+static const test_symbol test_symv[] = {
+    {"_b", N_SECT, 1, test_base + 0x200},
+    {"_a", N_SECT, 1, test_base + 0x100},
+};
+
+static std::string test_save(test_image& img, const char *name) {
+    std::string path = std::string("/tmp/cores-test.") + std::to_string(getpid()) + "." + name;
+    test_image_save(&img, path.c_str());
+    test_image_free(&img);
+    return path;
+}
+
+static std::string test_image_path() {
+    test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    test_image_symtab(&img, test_symv, std::size(test_symv));
+    test_image_segments(&img, test_base, test_text);
+    return test_save(img, "image");
+}
+
+/* same image, but with a string table past the end of the file */
+static std::string test_bad_symtab_path() {
+    test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    const size_t symtab = test_image_symtab(&img, test_symv, std::size(test_symv));
+    test_image_field(&img, symtab, struct symtab_command, stroff, 0x100000);
+    test_image_segments(&img, test_base, test_text);
+    return test_save(img, "bad-symtab");
+}
+
+static void test_open_error() {
+    Expected<Core> core = Core::open("/nonexistent/core");
+    test_check(!core && !core.has_value());
+    test_check(core.error().err == ENOENT && core.error().fn != nullptr);
+    test_check(std::strcmp(core.error().what(), std::strerror(ENOENT)) == 0);
+}
+
+static void test_core(const std::string& path) {
+    Expected<Core> opened = Core::open(path.c_str());
+    test_check(opened.has_value());
+    Core core = std::move(opened).value();
+    
+    /* segments as a span and filtered by protection */
+    std::span<const core_segment> segs = core.segments();
+    test_check(segs.size() == 2);
+    test_check(std::strcmp(segs[0].name, SEG_TEXT) == 0 && std::strcmp(segs[1].name, SEG_LINKEDIT) == 0);
+    size_t textc = 0;
+    for (const core_segment& seg : core.segments(VM_PROT_READ | VM_PROT_EXECUTE)) {
+        test_check(seg.vmbase == test_base);
+        ++textc;
+    }
+    test_check(textc == 1);
+    
+    /* memory starts with the header, and stays within one segment's file data */
+    std::span<const std::byte> text = core.memory(segs[0]);
+    test_check(text.size() == TEST_IMAGE_DATA);
+    uint32_t magic;
+    std::memcpy(&magic, text.data(), sizeof(magic));
+    test_check(magic == MH_MAGIC_64);
+    Expected<std::span<const std::byte>> bytes = core.memory(test_base + 4, 8);
+    test_check(bytes && bytes->data() == text.data() + 4 && bytes->size() == 8);
+    test_check(!core.memory(test_base + TEST_IMAGE_DATA - 4, 8) && core.memory(test_base + TEST_IMAGE_DATA - 4, 8).error().err == ERANGE);
+    test_check(!core.memory(test_base - 1, 1) && core.memory(test_base - 1, 1).error().err == ERANGE);
+    
+    /* load commands in file order, as many as the header says */
+    uint32_t cmds[3] = {};
+    size_t cmdc = 0;
+    for (const load_command& cmd : core.load_commands()) {
+        test_check(cmdc < std::size(cmds));
+        cmds[cmdc++] = cmd.cmd;
+    }
+    test_check(cmdc == 3 && cmds[0] == LC_SYMTAB && cmds[1] == LC_SEGMENT_64 && cmds[2] == LC_SEGMENT_64);
+    test_check(std::ranges::distance(core.load_commands()) == 3);
+    test_check(std::ranges::distance(LoadCommands()) == 0);
+    
+    /* moving leaves the source empty and keeps the mapping valid */
+    Core moved = std::move(core);
+    test_check(moved.memory(segs[0]).data() == text.data());
+    core = std::move(moved);
+    test_check(core.segments().size() == 2);
+    
+    Expected<Symbols> opened_syms = Symbols::open(core);
+    test_check(opened_syms.has_value());
+    Symbols syms = std::move(*opened_syms);
+    test_check(syms.symbols().size() == 2);
+    std::string names;
+    for (std::string_view name : syms.names()) {
+        names += name;
+    }
+    test_check(names == "_a_b");
+    test_check(syms.find(test_base + 0x250) != nullptr && std::strcmp(syms.find(test_base + 0x250)->name, "_b") == 0);
+    test_check(syms.lookup("_a") != nullptr && syms.lookup("_a")->vmaddr == test_base + 0x100);
+    
+    Symbols other = std::move(syms);
+    test_check(syms.symbols().empty() && other.symbols().size() == 2);
+    size_t symc = 0;
+    for (const symbol& sym : other) {
+        test_check(sym.vmaddr >= test_base);
+        ++symc;
+    }
+    test_check(symc == 2);
+}
+
+static void test_symbols_error(const std::string& path) {
+    Expected<Core> core = Core::open(path.c_str());
+    test_check(core.has_value());
+    Expected<Symbols> syms = Symbols::open(*core);
+    test_check(!syms && syms.error().fn != nullptr && syms.error().err != 0);
+}
+
+int main() {
+    test_open_error();
+    
+    const std::string image = test_image_path();
+    test_core(image);
+    unlink(image.c_str());
+    
+    const std::string bad = test_bad_symtab_path();
+    test_symbols_error(bad);
+    unlink(bad.c_str());
+    return EXIT_SUCCESS;
+}
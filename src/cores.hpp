@@ -0,0 +1,288 @@
+#pragma once
+
+/* header-only C++20 interface over core.h and symbols.h */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <algorithm>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mach-o/loader.h>
+
+#include "core.h"
+#include "symbols.h"
+
+extern "C" thread_local const char *errfn;
+
+namespace cores {
+
+struct Error {
+    const char *fn; // failing function, as recorded in errfn
+    int err;        // errno value
+
+    const char *what() const noexcept { return std::strerror(err); }
+
+    static Error last() noexcept { return Error {errfn, errno}; }
+};
+
+/* minimal std::expected stand-in: holds either a T or an Error */
+template <typename T>
+class Expected {
+public:
+    Expected(T&& value): v(std::move(value)) {}
+    Expected(const Error& error): v(error) {}
+
+    bool has_value() const noexcept { return v.index() == 0; }
+    explicit operator bool() const noexcept { return has_value(); }
+
+    T& value() & { return std::get<0>(v); }
+    T&& value() && { return std::get<0>(std::move(v)); }
+    const T& value() const & { return std::get<0>(v); }
+    const Error& error() const { return std::get<1>(v); }
+
+    T& operator*() & { return value(); }
+    T&& operator*() && { return std::move(*this).value(); }
+    const T& operator*() const & { return value(); }
+    T *operator->() { return &value(); }
+    const T *operator->() const { return &value(); }
+
+private:
+    std::variant<T, Error> v;
+};
+
+/* forward range over the load commands of a mapped Mach-O header */
+class LoadCommands: public std::ranges::view_interface<LoadCommands> {
+public:
+    class iterator {
+    public:
+        using value_type = load_command;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() = default;
+        iterator(const std::byte *p, const std::byte *end, uint32_t remaining): p(p), end(end), remaining(remaining) {
+            validate();
+        }
+
+        const load_command& operator*() const { return *reinterpret_cast<const load_command *>(p); }
+        const load_command *operator->() const { return &**this; }
+
+        iterator& operator++() {
+            p += (**this).cmdsize;
+            --remaining;
+            validate();
+            return *this;
+        }
+        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+
+        bool operator==(const iterator& other) const { return p == other.p && remaining == other.remaining; }
+        bool operator==(std::default_sentinel_t) const { return remaining == 0; }
+
+    private:
+        const std::byte *p = nullptr;
+        const std::byte *end = nullptr;
+        uint32_t remaining = 0;
+
+        /* stop at the first truncated or malformed command */
+        void validate() {
+            if (remaining == 0) {
+                return;
+            }
+            if (end - p < static_cast<std::ptrdiff_t>(sizeof(load_command)) ||
+                (**this).cmdsize < sizeof(load_command) ||
+                end - p < static_cast<std::ptrdiff_t>((**this).cmdsize)) {
+                remaining = 0;
+            }
+        }
+    };
+
+    LoadCommands() = default;
+    LoadCommands(const std::byte *begin, const std::byte *end, uint32_t ncmds): first(begin), last(end), ncmds(ncmds) {}
+
+    iterator begin() const { return iterator(first, last, ncmds); }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    const std::byte *first = nullptr;
+    const std::byte *last = nullptr;
+    uint32_t ncmds = 0;
+};
+
+/* opened core with its backing file mapped read-only */
+class Core {
+public:
+    static Expected<Core> open(const char *path) {
+        Core c;
+        /* the vm stream keeps a pointer to the struct core, so it must not move */
+        c.c = std::make_unique<struct core>();
+        if (core_fopen(path, c.c.get()) < 0) {
+            c.c.reset();
+            return Error::last();
+        }
+
+        struct stat st;
+        if (fstat(fileno(c.c->f), &st) < 0) {
+            return Error {"fstat", errno};
+        }
+        void *map;
+        if ((map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fileno(c.c->f), 0)) == MAP_FAILED) {
+            return Error {"mmap", errno};
+        }
+        c.map = static_cast<const std::byte *>(map);
+        c.mapsize = st.st_size;
+
+        return c;
+    }
+
+    Core(Core&& other) noexcept: c(std::move(other.c)), map(std::exchange(other.map, nullptr)),
+    mapsize(std::exchange(other.mapsize, 0)) {}
+
+    Core& operator=(Core&& other) noexcept {
+        if (this != &other) {
+            reset();
+            c = std::move(other.c);
+            map = std::exchange(other.map, nullptr);
+            mapsize = std::exchange(other.mapsize, 0);
+        }
+        return *this;
+    }
+
+    Core(const Core&) = delete;
+    Core& operator=(const Core&) = delete;
+
+    ~Core() { reset(); }
+
+    struct core& get() noexcept { return *c; }
+    const struct core& get() const noexcept { return *c; }
+
+    std::span<const core_segment> segments() const noexcept {
+        return {c->segv, c->segc};
+    }
+
+    auto segments(vm_prot_t prot) const {
+        return segments() | std::views::filter([prot] (const core_segment& seg) { return seg.prot == prot; });
+    }
+
+    /* file-backed bytes of a segment */
+    std::span<const std::byte> memory(const core_segment& seg) const noexcept {
+        if (seg.filebase >= mapsize) {
+            return {};
+        }
+        return {map + seg.filebase, static_cast<size_t>(std::min<uint64_t>(seg.filesize, mapsize - seg.filebase))};
+    }
+
+    /* len bytes at vmaddr; fails with ERANGE unless wholly inside one segment's file data */
+    Expected<std::span<const std::byte>> memory(uint64_t vmaddr, size_t len) const {
+        const core_segment *seg;
+        if ((seg = core_segment_find(c.get(), vmaddr)) == nullptr) {
+            return Error {"Core::memory", ERANGE};
+        }
+        const std::span<const std::byte> bytes = memory(*seg);
+        const uint64_t offset = vmaddr - seg->vmbase;
+        if (offset > bytes.size() || bytes.size() - offset < len) {
+            return Error {"Core::memory", ERANGE};
+        }
+        return bytes.subspan(offset, len);
+    }
+
+    /* raw commands in file byte order; empty for opposite-endian cores */
+    LoadCommands load_commands() const noexcept {
+        if (c->swap) {
+            return {};
+        }
+        const size_t hdrsize = c->fmt == CORE_MACHO64 ? sizeof(mach_header_64) : sizeof(mach_header);
+        if (mapsize < hdrsize) {
+            return {};
+        }
+        const auto *hdr = reinterpret_cast<const mach_header *>(map);
+        return {map + hdrsize, map + mapsize, hdr->ncmds};
+    }
+
+private:
+    std::unique_ptr<struct core> c;
+    const std::byte *map = nullptr;
+    size_t mapsize = 0;
+
+    Core() = default;
+
+    void reset() noexcept {
+        if (map != nullptr) {
+            munmap(const_cast<std::byte *>(map), mapsize);
+            map = nullptr;
+        }
+        if (c != nullptr) {
+            core_close(c.get());
+            c.reset();
+        }
+    }
+};
+
+/* symbol table of an image; must not outlive the core it was opened from */
+class Symbols {
+public:
+    static Expected<Symbols> open(struct core& core, int flags = 0) {
+        Symbols s;
+        if (symbols_open_flags(&core, &s.s, flags) < 0) {
+            return Error::last();
+        }
+        s.opened = true;
+        return s;
+    }
+
+    static Expected<Symbols> open(Core& core, int flags = 0) {
+        return open(core.get(), flags);
+    }
+
+    Symbols(Symbols&& other) noexcept: s(std::exchange(other.s, {})), opened(std::exchange(other.opened, false)) {}
+
+    Symbols& operator=(Symbols&& other) noexcept {
+        if (this != &other) {
+            reset();
+            s = std::exchange(other.s, {});
+            opened = std::exchange(other.opened, false);
+        }
+        return *this;
+    }
+
+    Symbols(const Symbols&) = delete;
+    Symbols& operator=(const Symbols&) = delete;
+
+    ~Symbols() { reset(); }
+
+    const struct symbols& get() const noexcept { return s; }
+
+    std::span<const symbol> symbols() const noexcept { return {s.symv, s.symc}; }
+    auto begin() const noexcept { return symbols().begin(); }
+    auto end() const noexcept { return symbols().end(); }
+
+    auto names() const {
+        return symbols() | std::views::transform([] (const symbol& sym) { return std::string_view(sym.name); });
+    }
+
+    const symbol *find(uint64_t vmaddr) const noexcept { return symbols_find(&s, vmaddr); }
+    const symbol *lookup(const char *name) { return symbols_lookup_name(&s, name); }
+
+private:
+    struct symbols s {};
+    bool opened = false;
+
+    Symbols() = default;
+
+    void reset() noexcept {
+        if (opened) {
+            symbols_close(&s);
+            opened = false;
+        }
+    }
+};
+
+}
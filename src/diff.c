@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "diff.h"
+#include "pages.h"
+#include "symbols.h"
+#include "util.h"
+
+#define DIFF_CHUNK_PAGES 256 // pages per unit of work
+
+/* a VM range mapped in both cores */
+struct diff_pair {
+    const struct core_segment *a;
+    const struct core_segment *b;
+    uint64_t vmbase;
+    uint64_t vmsize;
+    uint64_t first; // global index of the first page
+};
+
+struct diff_job {
+    const struct core *a;
+    const struct core *b;
+    size_t pairc;
+    size_t paircap;
+    struct diff_pair *pairv;
+    uint64_t pagec;
+    uint8_t *changedv; // per global page
+};
+
+static size_t diff_pair_of(const struct diff_job *job, uint64_t page) {
+    size_t lo = 0, hi = job->pairc;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (job->pairv[mid].first <= page) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+/* buf holds a chunk of a, then the same chunk of b */
+static int diff_chunk(struct diff_job *job, uint64_t chunk, uint64_t *buf) {
+    uint64_t *bufa = buf, *bufb = buf + DIFF_CHUNK_PAGES * (CORE_PAGE_SIZE / sizeof(uint64_t));
+    
+    /* a chunk may straddle pairs; read each piece separately */
+    const uint64_t first = chunk * DIFF_CHUNK_PAGES;
+    const uint64_t last = min(first + DIFF_CHUNK_PAGES, job->pagec);
+    for (uint64_t base = first; base < last; ) {
+        const size_t pi = diff_pair_of(job, base);
+        const struct diff_pair *pair = &job->pairv[pi];
+        const uint64_t end = min(last, pi + 1 < job->pairc ? job->pairv[pi + 1].first : job->pagec);
+        const uint64_t vmaddr = pair->vmbase + (base - pair->first) * CORE_PAGE_SIZE;
+        const size_t len = min((end - base) * CORE_PAGE_SIZE, pair->vmbase + pair->vmsize - vmaddr);
+        
+        /* memory past either core's file data reads as zero */
+        memset(bufa, 0, (end - base) * CORE_PAGE_SIZE);
+        memset(bufb, 0, (end - base) * CORE_PAGE_SIZE);
+        if (core_vm_pread(job->a, bufa, len, vmaddr) < 0 || core_vm_pread(job->b, bufb, len, vmaddr) < 0) {
+            return -1;
+        }
+        
+        /* both chunks are read in full above; the comparison only stops early within a changed page */
+        const size_t wordc = CORE_PAGE_SIZE / sizeof(uint64_t);
+        for (uint64_t p = base; p < end; ++p) {
+            job->changedv[p] = memcmp(bufa + (p - base) * wordc, bufb + (p - base) * wordc, CORE_PAGE_SIZE) != 0;
+        }
+        
+        base = end;
+    }
+    return 0;
+}
+
+static int diff_push_range(struct core_diff *diff, size_t *cap, enum core_diff_kind kind, uint64_t vmbase, uint64_t vmsize,
+                           const struct core_segment *a, const struct core_segment *b) {
+    if (diff->rangec == *cap) {
+        *cap = max(*cap * 2, 16);
+        if ((diff->rangev = reallocf(diff->rangev, *cap * sizeof(struct core_diff_range))) == NULL) {
+            errfn = "reallocf";
+            return -1;
+        }
+    }
+    struct core_diff_range *range = &diff->rangev[diff->rangec++];
+    range->kind = kind;
+    range->vmbase = vmbase;
+    range->vmsize = vmsize;
+    range->a = a;
+    range->b = b;
+    return 0;
+}
+
+static int diff_push_pair(struct diff_job *job, const struct core_segment *a, const struct core_segment *b, uint64_t vmbase, uint64_t vmsize) {
+    if (job->pairc == job->paircap) {
+        job->paircap = max(job->paircap * 2, 16);
+        if ((job->pairv = reallocf(job->pairv, job->paircap * sizeof(struct diff_pair))) == NULL) {
+            errfn = "reallocf";
+            return -1;
+        }
+    }
+    struct diff_pair *pair = &job->pairv[job->pairc++];
+    pair->a = a;
+    pair->b = b;
+    pair->vmbase = vmbase;
+    pair->vmsize = vmsize;
+    pair->first = job->pagec;
+    job->pagec += (vmsize + CORE_PAGE_SIZE - 1) / CORE_PAGE_SIZE;
+    return 0;
+}
+
+/* walk x's segments against y's in VM order; overlaps become pairs (x = a only), the rest is reported as kind */
+static int diff_sweep(struct diff_job *job, struct core_diff *diff, size_t *rangecap, const struct core *x, const struct core *y, bool pairs, enum core_diff_kind kind) {
+    size_t j = 0;
+    for (size_t i = 0; i < x->segidxc; ++i) {
+        const struct core_segment *s = x->segidx[i];
+        const uint64_t end = s->vmbase + s->vmsize;
+        const struct core_segment *sa = pairs ? s : NULL, *sb = pairs ? NULL : s;
+        uint64_t cursor = s->vmbase;
+        while (j < y->segidxc && y->segidx[j]->vmbase < end) {
+            const struct core_segment *t = y->segidx[j];
+            const uint64_t tend = t->vmbase + t->vmsize;
+            if (tend <= cursor) {
+                ++j;
+                continue;
+            }
+            if (t->vmbase > cursor && diff_push_range(diff, rangecap, kind, cursor, t->vmbase - cursor, sa, sb) < 0) {
+                return -1;
+            }
+            const uint64_t lo = max(cursor, t->vmbase), hi = min(end, tend);
+            if (pairs && diff_push_pair(job, s, t, lo, hi - lo) < 0) {
+                return -1;
+            }
+            cursor = hi;
+            if (tend > end) {
+                break;
+            }
+            ++j;
+        }
+        if (cursor < end && diff_push_range(diff, rangecap, kind, cursor, end - cursor, sa, sb) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* coalesce runs of changed pages into ranges */
+static int diff_coalesce(struct diff_job *job, struct core_diff *diff, size_t *rangecap) {
+    for (size_t i = 0; i < job->pairc; ++i) {
+        const struct diff_pair *pair = &job->pairv[i];
+        const uint64_t pagec = (pair->vmsize + CORE_PAGE_SIZE - 1) / CORE_PAGE_SIZE;
+        for (uint64_t p = 0; p < pagec; ) {
+            if (!job->changedv[pair->first + p]) {
+                ++p;
+                continue;
+            }
+            uint64_t q = p;
+            while (q < pagec && job->changedv[pair->first + q]) {
+                ++q;
+            }
+            const uint64_t vmbase = pair->vmbase + p * CORE_PAGE_SIZE;
+            const uint64_t vmend = min(pair->vmbase + q * CORE_PAGE_SIZE, pair->vmbase + pair->vmsize);
+            if (diff_push_range(diff, rangecap, CORE_DIFF_CHANGED, vmbase, vmend - vmbase, pair->a, pair->b) < 0) {
+                return -1;
+            }
+            diff->changed += q - p;
+            p = q;
+        }
+    }
+    return 0;
+}
+
+static int diff_range_cmp(const struct core_diff_range *a, const struct core_diff_range *b) {
+    return (a->vmbase > b->vmbase) - (a->vmbase < b->vmbase);
+}
+
+void core_diff_free(struct core_diff *diff) {
+    free(diff->rangev);
+    memset(diff, 0, sizeof(*diff));
+}
+
+int core_diff(const struct core *a, const struct core *b, struct core_diff *diff, unsigned nthreads) {
+    struct diff_job *job = NULL;
+    size_t rangecap = 0;
+    
+    memset(diff, 0, sizeof(*diff));
+    if ((job = calloc(1, sizeof(*job))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    job->a = a;
+    job->b = b;
+    
+    if (diff_sweep(job, diff, &rangecap, a, b, true, CORE_DIFF_REMOVED) < 0 ||
+        diff_sweep(job, diff, &rangecap, b, a, false, CORE_DIFF_ADDED) < 0) {
+        goto error;
+    }
+    malloc_chk(job->changedv, max(job->pagec, 1));
+    
+    const uint64_t chunkc = (job->pagec + DIFF_CHUNK_PAGES - 1) / DIFF_CHUNK_PAGES;
+    if (pages_parallel(chunkc, nthreads, 2 * DIFF_CHUNK_PAGES * CORE_PAGE_SIZE, (pages_fn *) &diff_chunk, job) < 0) {
+        goto error;
+    }
+    
+    diff->pages = job->pagec;
+    if (diff_coalesce(job, diff, &rangecap) < 0) {
+        goto error;
+    }
+    qsort(diff->rangev, diff->rangec, sizeof(struct core_diff_range), (int (*)(const void *, const void *)) &diff_range_cmp);
+    
+    free(job->pairv);
+    free(job->changedv);
+    free(job);
+    return 0;
+    
+error:
+    if (job != NULL) {
+        free(job->pairv);
+        free(job->changedv);
+        free(job);
+    }
+    core_diff_free(diff);
+    return -1;
+}
+
+void core_diff_print(const struct core_diff *diff, const struct core_images *imgs, FILE *f) {
+    static const char kinds[] = {
+        [CORE_DIFF_CHANGED] = '~',
+        [CORE_DIFF_ADDED]   = '+',
+        [CORE_DIFF_REMOVED] = '-',
+    };
+    for (size_t i = 0; i < diff->rangec; ++i) {
+        const struct core_diff_range *range = &diff->rangev[i];
+        const struct core_segment *seg = range->b != NULL ? range->b : range->a;
+        fprintf(f, "%c %018llx %018llx %s", kinds[range->kind], (unsigned long long) range->vmbase,
+                (unsigned long long) (range->vmbase + range->vmsize), seg->name);
+                
+        struct core_image *img;
+        const struct symbols *syms;
+        const struct symbol *sym;
+        if (imgs != NULL && (img = core_images_find(imgs, range->vmbase)) != NULL &&
+            (syms = core_image_symbols(img, SYMBOLS_PAGE_INDEX)) != NULL &&
+            (sym = symbols_find(syms, range->vmbase - img->slide)) != NULL) {
+            fprintf(f, " %s+0x%llx", sym->name, (unsigned long long) (range->vmbase - img->slide - sym->vmaddr));
+        }
+        fputc('\n', f);
+    }
+    fprintf(f, "%llu of %llu pages changed\n", (unsigned long long) diff->changed, (unsigned long long) diff->pages);
+}
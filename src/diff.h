@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "images.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* page-granular comparison of two cores of the same process */
+
+enum core_diff_kind {
+    CORE_DIFF_CHANGED, // mapped in both, contents differ
+    CORE_DIFF_ADDED,   // mapped only in b
+    CORE_DIFF_REMOVED, // mapped only in a
+};
+
+struct core_diff_range {
+    enum core_diff_kind kind;
+    uint64_t vmbase;
+    uint64_t vmsize;
+    const struct core_segment *a; // segment of a holding the range; NULL if added
+    const struct core_segment *b; // segment of b holding the range; NULL if removed
+};
+
+struct core_diff {
+    size_t rangec;
+    struct core_diff_range *rangev; // sorted by vmbase
+    uint64_t pages;   // pages compared
+    uint64_t changed; // pages that differ
+};
+
+/* segments are matched by VM overlap; nthreads == 0 picks the number of online CPUs */
+int core_diff(const struct core *a, const struct core *b, struct core_diff *diff, unsigned nthreads);
+
+/* imgs may be NULL; otherwise each range is annotated with the nearest preceding symbol */
+void core_diff_print(const struct core_diff *diff, const struct core_images *imgs, FILE *f);
+void core_diff_free(struct core_diff *diff);
+
+#ifdef __cplusplus
+}
+#endif
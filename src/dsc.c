@@ -0,0 +1,431 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dsc.h"
+#include "bound.h"
+#include "util.h"
+
+#define DSC_MAGIC "dyld_v1"
+
+/* dyld_cache_header field offsets */
+#define DSC_HDR_MAPPING_OFFSET    0x10
+#define DSC_HDR_MAPPING_COUNT     0x14
+#define DSC_HDR_IMAGES_OFFSET_OLD 0x18
+#define DSC_HDR_IMAGES_COUNT_OLD  0x1c
+#define DSC_HDR_IMAGES_OFFSET     0x1c0
+#define DSC_HDR_IMAGES_COUNT      0x1c4
+#define DSC_HDR_SIZE              0x1c8
+
+#define DSC_PATH_MAX 1024
+
+struct dsc_mapping_info {
+    uint64_t address;
+    uint64_t size;
+    uint64_t fileOffset;
+    uint32_t maxProt;
+    uint32_t initProt;
+};
+
+struct dsc_image_info {
+    uint64_t address;
+    uint64_t modTime;
+    uint64_t inode;
+    uint32_t pathFileOffset;
+    uint32_t pad;
+};
+
+static void dsc_init(struct dsc *dsc) {
+    dsc->core    = NULL;
+    dsc->slide   = 0;
+    dsc->map     = NULL;
+    dsc->mapsize = 0;
+    dsc->mapc    = 0;
+    dsc->mapv    = NULL;
+    dsc->imgc    = 0;
+    dsc->imgv    = NULL;
+    dsc->vm      = NULL;
+}
+
+ssize_t dsc_read(const struct dsc *dsc, void *buf, size_t len, uint64_t vmaddr) {
+    if (dsc->core != NULL) {
+        return core_vm_pread(dsc->core, buf, len, vmaddr + dsc->slide);
+    }
+    
+    for (size_t i = 0; i < dsc->mapc; ++i) {
+        const struct dsc_mapping *m = &dsc->mapv[i];
+        if (m->vmbase <= vmaddr && vmaddr < m->vmbase + m->vmsize) {
+            const uint64_t fileoff = m->filebase + (vmaddr - m->vmbase);
+            if (fileoff >= dsc->mapsize) {
+                return 0;
+            }
+            const size_t size = min(min(len, m->vmbase + m->vmsize - vmaddr), dsc->mapsize - fileoff);
+            memcpy(buf, dsc->map + fileoff, size);
+            return size;
+        }
+    }
+    return 0;
+}
+
+/* read at a cache file offset; header reads in a core go through hdraddr until mappings are known */
+static int dsc_read_fileoff(const struct dsc *dsc, uint64_t hdraddr, void *buf, size_t len, uint64_t fileoff) {
+    ssize_t bytes_read = -1;
+    if (dsc->map != NULL) {
+        if (fileoff < dsc->mapsize) {
+            bytes_read = min(len, dsc->mapsize - fileoff);
+            memcpy(buf, dsc->map + fileoff, bytes_read);
+        } else {
+            bytes_read = 0;
+        }
+    } else {
+        for (size_t i = 0; i < dsc->mapc; ++i) {
+            const struct dsc_mapping *m = &dsc->mapv[i];
+            if (m->filebase <= fileoff && fileoff < m->filebase + m->vmsize) {
+                bytes_read = dsc_read(dsc, buf, len, m->vmbase + (fileoff - m->filebase));
+                break;
+            }
+        }
+        if (bytes_read < 0 && dsc->mapc == 0) {
+            bytes_read = core_vm_pread(dsc->core, buf, len, hdraddr + fileoff);
+        }
+    }
+    
+    if (bytes_read < 0) {
+        goto error;
+    }
+    if ((size_t) bytes_read < len) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* vm stream over cache addresses */
+struct dsc_vm {
+    const struct dsc *dsc;
+    fpos_t pos;
+};
+
+static int dsc_vm_read(struct dsc_vm *vm, char *buf, int size) {
+    const ssize_t bytes_read = dsc_read(vm->dsc, buf, size, vm->pos);
+    if (bytes_read > 0) {
+        vm->pos += bytes_read;
+    }
+    return bytes_read;
+}
+
+static fpos_t dsc_vm_seek(struct dsc_vm *vm, fpos_t pos, int whence) {
+    switch (whence) {
+        case SEEK_SET:
+            vm->pos = pos;
+            break;
+            
+        case SEEK_CUR:
+            vm->pos += pos;
+            break;
+            
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    return vm->pos;
+}
+
+static int dsc_vm_close(struct dsc_vm *vm) {
+    free(vm);
+    return 0;
+}
+
+static int dsc_open_vm(struct dsc *dsc) {
+    struct dsc_vm *vm;
+    malloc_chk(vm, sizeof(*vm));
+    vm->dsc = dsc;
+    vm->pos = 0;
+    if ((dsc->vm = funopen(vm, (int (*)(void *, char *, int)) &dsc_vm_read, NULL, (fpos_t (*)(void *, fpos_t, int)) &dsc_vm_seek, (int (*)(void *)) &dsc_vm_close)) == NULL) {
+        free(vm);
+        errfn = "funopen";
+        goto error;
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int dsc_image_cmp(const struct dsc_image *a, const struct dsc_image *b) {
+    return (a->vmbase > b->vmbase) - (a->vmbase < b->vmbase);
+}
+
+/* parse header, mappings and image list */
+static int dsc_parse(struct dsc *dsc, uint64_t hdraddr) {
+    char hdr[DSC_HDR_SIZE];
+    struct dsc_mapping_info *infov = NULL;
+    struct dsc_image_info *imginfov = NULL;
+    
+    if (dsc_read_fileoff(dsc, hdraddr, hdr, DSC_HDR_MAPPING_OFFSET + 8, 0) < 0) {
+        goto error;
+    }
+    if (strncmp(hdr, DSC_MAGIC, strlen(DSC_MAGIC)) != 0) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    uint32_t mapoff, mapc;
+    memcpy(&mapoff, hdr + DSC_HDR_MAPPING_OFFSET, sizeof(mapoff));
+    memcpy(&mapc, hdr + DSC_HDR_MAPPING_COUNT, sizeof(mapc));
+    
+    /* the header grew over time; mapping info starts where it ends */
+    const size_t hdrsize = min(mapoff, DSC_HDR_SIZE);
+    if (dsc_read_fileoff(dsc, hdraddr, hdr, hdrsize, 0) < 0) {
+        goto error;
+    }
+    uint32_t imgoff = 0, imgc = 0;
+    if (hdrsize >= DSC_HDR_IMAGES_COUNT_OLD + sizeof(imgc)) {
+        memcpy(&imgoff, hdr + DSC_HDR_IMAGES_OFFSET_OLD, sizeof(imgoff));
+        memcpy(&imgc, hdr + DSC_HDR_IMAGES_COUNT_OLD, sizeof(imgc));
+    }
+    if (imgc == 0 && hdrsize >= DSC_HDR_SIZE) {
+        memcpy(&imgoff, hdr + DSC_HDR_IMAGES_OFFSET, sizeof(imgoff));
+        memcpy(&imgc, hdr + DSC_HDR_IMAGES_COUNT, sizeof(imgc));
+    }
+    
+    /* mappings */
+    malloc_chk(infov, sizeof(struct dsc_mapping_info) * mapc);
+    if (dsc_read_fileoff(dsc, hdraddr, infov, sizeof(struct dsc_mapping_info) * mapc, mapoff) < 0) {
+        goto error;
+    }
+    if ((dsc->mapv = calloc(mapc, sizeof(struct dsc_mapping))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    for (size_t i = 0; i < mapc; ++i) {
+        struct dsc_mapping *m = &dsc->mapv[i];
+        m->vmbase   = infov[i].address;
+        m->vmsize   = infov[i].size;
+        m->filebase = infov[i].fileOffset;
+        m->prot     = infov[i].initProt;
+    }
+    dsc->mapc = mapc;
+    if (dsc->core != NULL && mapc > 0) {
+        dsc->slide = hdraddr - dsc->mapv[0].vmbase;
+    }
+    
+    /* images */
+    malloc_chk(imginfov, sizeof(struct dsc_image_info) * imgc);
+    if (dsc_read_fileoff(dsc, hdraddr, imginfov, sizeof(struct dsc_image_info) * imgc, imgoff) < 0) {
+        goto error;
+    }
+    if ((dsc->imgv = calloc(imgc, sizeof(struct dsc_image))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    for (size_t i = 0; i < imgc; ++i) {
+        struct dsc_image *img = &dsc->imgv[dsc->imgc];
+        char path[DSC_PATH_MAX];
+        
+        img->vmbase = imginfov[i].address;
+        img->open = false;
+        
+        /* path may end near the end of its mapping, so read what is there */
+        ssize_t len = 0;
+        for (size_t j = 0; j < dsc->mapc; ++j) {
+            const struct dsc_mapping *m = &dsc->mapv[j];
+            const uint64_t off = imginfov[i].pathFileOffset;
+            if (m->filebase <= off && off < m->filebase + m->vmsize) {
+                len = dsc_read(dsc, path, sizeof(path) - 1, m->vmbase + (off - m->filebase));
+                break;
+            }
+        }
+        path[max(len, 0)] = '\0';
+        strdup_chk(img->path, path);
+        ++dsc->imgc;
+    }
+    
+    /* address index */
+    qsort(dsc->imgv, dsc->imgc, sizeof(struct dsc_image), (int (*)(const void *, const void *)) &dsc_image_cmp);
+    for (size_t i = 0; i < dsc->imgc; ++i) {
+        struct dsc_image *img = &dsc->imgv[i];
+        img->vmend = img->vmbase;
+        for (size_t j = 0; j < dsc->mapc; ++j) {
+            const struct dsc_mapping *m = &dsc->mapv[j];
+            if (m->vmbase <= img->vmbase && img->vmbase < m->vmbase + m->vmsize) {
+                img->vmend = m->vmbase + m->vmsize;
+                break;
+            }
+        }
+        if (i + 1 < dsc->imgc) {
+            img->vmend = min(img->vmend, dsc->imgv[i + 1].vmbase);
+        }
+    }
+    
+    free(infov);
+    free(imginfov);
+    return 0;
+    
+error:
+    free(infov);
+    free(imginfov);
+    return -1;
+}
+
+int dsc_open_file(const char *path, struct dsc *dsc) {
+    dsc_init(dsc);
+    
+    int fd;
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        errfn = "open";
+        goto error;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        errfn = "fstat";
+        close(fd);
+        goto error;
+    }
+    void *map;
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        errfn = "mmap";
+        close(fd);
+        goto error;
+    }
+    close(fd);
+    dsc->map = map;
+    dsc->mapsize = st.st_size;
+    
+    if (dsc_parse(dsc, 0) < 0 || dsc_open_vm(dsc) < 0) {
+        goto error;
+    }
+    
+    return 0;
+    
+error:
+    dsc_close(dsc);
+    return -1;
+}
+
+int dsc_open_core(const struct core *core, struct dsc *dsc) {
+    dsc_init(dsc);
+    dsc->core = core;
+    
+    /* the cache header starts its first mapping */
+    const struct core_segment *seg = NULL;
+    for (size_t i = 0; i < core->segidxc && seg == NULL; ++i) {
+        const struct core_segment *it = core->segidx[i];
+        char magic[sizeof(DSC_MAGIC) - 1];
+        if (!(it->prot & VM_PROT_READ)) {
+            continue;
+        }
+        if (core_vm_pread(core, magic, sizeof(magic), it->vmbase) == sizeof(magic) &&
+            memcmp(magic, DSC_MAGIC, sizeof(magic)) == 0) {
+            seg = it;
+        }
+    }
+    if (seg == NULL) {
+        errno = ENOENT;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    if (dsc_parse(dsc, seg->vmbase) < 0 || dsc_open_vm(dsc) < 0) {
+        goto error;
+    }
+    
+    return 0;
+    
+error:
+    dsc_close(dsc);
+    return -1;
+}
+
+void dsc_close(struct dsc *dsc) {
+    for (size_t i = 0; i < dsc->imgc; ++i) {
+        struct dsc_image *img = &dsc->imgv[i];
+        if (img->open) {
+            symbols_close(&img->syms);
+            core_close(&img->core);
+        }
+        free(img->path);
+    }
+    free(dsc->imgv);
+    free(dsc->mapv);
+    if (dsc->vm != NULL) {
+        fclose(dsc->vm);
+    }
+    if (dsc->map != NULL) {
+        munmap((void *) dsc->map, dsc->mapsize);
+    }
+    dsc_init(dsc);
+}
+
+struct dsc_image *dsc_find_image(const struct dsc *dsc, uint64_t vmaddr) {
+    size_t lo = 0, hi = dsc->imgc;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (dsc->imgv[mid].vmbase <= vmaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || vmaddr >= dsc->imgv[lo - 1].vmend) {
+        return NULL;
+    }
+    return &dsc->imgv[lo - 1];
+}
+
+struct symbols *dsc_image_symbols(struct dsc *dsc, struct dsc_image *img) {
+    if (img->open) {
+        return &img->syms;
+    }
+    
+    FILE *img_f = NULL, *img_vm = NULL;
+    if ((img_f = lbound_open(dsc->vm, img->vmbase)) == NULL ||
+        (img_vm = lbound_open(dsc->vm, 0)) == NULL) {
+        goto error;
+    }
+    if (core_open(img_f, &img->core, img_vm) < 0) {
+        goto error;
+    }
+    /* exported names are all most cache images keep in their symtab */
+    if (symbols_open_flags(&img->core, &img->syms, SYMBOLS_EXTDEF | SYMBOLS_EXPORTS | SYMBOLS_PAGE_INDEX) < 0) {
+        core_close(&img->core);
+        return NULL;
+    }
+    img->open = true;
+    
+    return &img->syms;
+    
+error:
+    if (img_vm != NULL) {
+        fclose(img_vm);
+    }
+    if (img_f != NULL) {
+        fclose(img_f);
+    }
+    return NULL;
+}
+
+const struct symbol *dsc_find(struct dsc *dsc, uint64_t vmaddr, struct dsc_image **imgp) {
+    const uint64_t unslid = vmaddr - dsc->slide;
+    struct dsc_image *img;
+    if ((img = dsc_find_image(dsc, unslid)) == NULL) {
+        return NULL;
+    }
+    if (imgp != NULL) {
+        *imgp = img;
+    }
+    
+    const struct symbols *syms;
+    if ((syms = dsc_image_symbols(dsc, img)) == NULL) {
+        return NULL;
+    }
+    return symbols_find(syms, unslid);
+}
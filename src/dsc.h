@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "symbols.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dyld shared cache, either mapped from a local file or found inside a core.
+ * All addresses below are unslid cache addresses unless noted.
+ *
+ * Only the main cache file is read. Since macOS 12 the cache is split into subcaches (.01, .02, ..., .symbols);
+ * dsc_open_file does not load them, so images and symbol tables that live there are not found. In a core the
+ * subcaches are mapped as well and can be read, but the image list still comes from the main header only. */
+
+struct dsc_mapping {
+    uint64_t vmbase;
+    uint64_t vmsize;
+    uint64_t filebase;
+    vm_prot_t prot;
+};
+
+struct dsc_image {
+    uint64_t vmbase; // address of the image's Mach-O header
+    uint64_t vmend;  // next image's header, or end of its mapping
+    char *path;
+    bool open;       // core and syms are loaded
+    struct core core;
+    struct symbols syms;
+};
+
+struct dsc {
+    const struct core *core; // core holding the cache, or NULL if mapped from a file
+    int64_t slide;           // runtime address - cache address; callers may set it for file-backed caches
+    const char *map;
+    size_t mapsize;
+    size_t mapc;
+    struct dsc_mapping *mapv;
+    size_t imgc;
+    struct dsc_image *imgv;  // sorted by vmbase
+    FILE *vm;                // stream addressed by cache address; refers back to this struct, so don't move it
+};
+
+int dsc_open_file(const char *path, struct dsc *dsc);
+int dsc_open_core(const struct core *core, struct dsc *dsc); // fails with ENOENT if no cache is mapped
+void dsc_close(struct dsc *dsc);
+
+/* read cache memory at a cache address */
+ssize_t dsc_read(const struct dsc *dsc, void *buf, size_t len, uint64_t vmaddr);
+
+/* address index: image containing a cache address */
+struct dsc_image *dsc_find_image(const struct dsc *dsc, uint64_t vmaddr);
+
+/* symbols are parsed on first use and owned by the image */
+struct symbols *dsc_image_symbols(struct dsc *dsc, struct dsc_image *img);
+
+/* symbolicate a runtime address; returned symbol's vmaddr is a cache address */
+const struct symbol *dsc_find(struct dsc *dsc, uint64_t vmaddr, struct dsc_image **imgp);
+
+#ifdef __cplusplus
+}
+#endif
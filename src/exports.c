@@ -0,0 +1,327 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <mach-o/loader.h>
+
+#include "exports.h"
+#include "core.h"
+#include "macho.h"
+#include "util.h"
+
+#define EXPORTS_WINDOW 256
+#define EXPORTS_MAX_DEPTH 1024
+
+/* buffered cursor over the trie; only the bytes around the cursor are read */
+struct exports_reader {
+    const struct exports *exps;
+    uint64_t off;
+    uint64_t bufoff;
+    size_t buflen;
+    uint8_t buf[EXPORTS_WINDOW];
+};
+
+static void exports_reader_init(struct exports_reader *r, const struct exports *exps, uint64_t off) {
+    r->exps = exps;
+    r->off = off;
+    r->bufoff = 0;
+    r->buflen = 0;
+}
+
+static int exports_byte(struct exports_reader *r, uint8_t *byte) {
+    if (r->off >= r->exps->size) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    if (r->off < r->bufoff || r->off >= r->bufoff + r->buflen) {
+        const size_t len = min(EXPORTS_WINDOW, r->exps->size - r->off);
+        fseek_chk(r->exps->vm, r->exps->vmbase + r->off, SEEK_SET);
+        fread_chk(r->buf, len, r->exps->vm);
+        r->bufoff = r->off;
+        r->buflen = len;
+    }
+    *byte = r->buf[r->off++ - r->bufoff];
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int exports_uleb128(struct exports_reader *r, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        uint8_t byte;
+        if (exports_byte(r, &byte) < 0) {
+            return -1;
+        }
+        if (shift < 64) {
+            *value |= (uint64_t) (byte & 0x7f) << shift;
+        }
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+}
+
+/* parse terminal info at the cursor */
+static int exports_terminal(struct exports_reader *r, struct export *exp) {
+    uint64_t flags, addr = 0;
+    if (exports_uleb128(r, &flags) < 0) {
+        goto error;
+    }
+    if (!(flags & EXPORT_SYMBOL_FLAGS_REEXPORT)) {
+        if (exports_uleb128(r, &addr) < 0) {
+            goto error;
+        }
+        if ((flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) != EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE) {
+            addr += r->exps->imagebase;
+        }
+    }
+    exp->vmaddr = addr;
+    exp->flags = flags;
+    return 0;
+    
+error:
+    return -1;
+}
+
+int exports_open(struct core *core, struct exports *exps) {
+    exps->vm = core->vm;
+    exps->vmbase = 0;
+    exps->size = 0;
+    exps->imagebase = 0;
+    
+    uint32_t dataoff = 0, datasize = 0;
+    
+    rewind(core->f);
+    uint32_t magic;
+    fread_one_chk(magic, core->f);
+    rewind(core->f);
+    struct mach_header_64 hdr;
+    if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        fread_one_chk(hdr, core->f);
+    } else {
+        fread_chk((struct mach_header *) &hdr, 1, core->f);
+    }
+    if (core->swap) {
+        macho_swap_header((struct mach_header *) &hdr);
+    }
+    
+    for (size_t i = 0; i < hdr.ncmds; ++i) {
+        struct load_command *cmd;
+        if ((cmd = macho_parse_lc_swap(core->f, core->swap, core->cputype)) == NULL) {
+            goto error;
+        }
+        switch (cmd->cmd) {
+            case LC_DYLD_INFO:
+            case LC_DYLD_INFO_ONLY: {
+                const struct dyld_info_command *info = (struct dyld_info_command *) cmd;
+                dataoff  = info->export_off;
+                datasize = info->export_size;
+                break;
+            }
+            
+            case LC_DYLD_EXPORTS_TRIE: {
+                const struct linkedit_data_command *trie = (struct linkedit_data_command *) cmd;
+                dataoff  = trie->dataoff;
+                datasize = trie->datasize;
+                break;
+            }
+        }
+        free(cmd);
+    }
+    
+    if (datasize == 0) {
+        errno = ENOENT;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    off_t vm_dataoff;
+    if ((vm_dataoff = core_ftovm(core, dataoff)) < 0) {
+        goto error;
+    }
+    exps->vmbase = vm_dataoff;
+    exps->size = datasize;
+    
+    for (size_t i = 0; i < core->segc; ++i) {
+        if (strcmp(core->segv[i].name, SEG_TEXT) == 0) {
+            exps->imagebase = core->segv[i].vmbase;
+            break;
+        }
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+int exports_lookup(const struct exports *exps, const char *name, struct export *exp) {
+    struct exports_reader r;
+    exports_reader_init(&r, exps, 0);
+    
+    for (unsigned depth = 0; depth < EXPORTS_MAX_DEPTH; ++depth) {
+        uint64_t terminal_size;
+        if (exports_uleb128(&r, &terminal_size) < 0) {
+            goto error;
+        }
+        if (*name == '\0') {
+            if (terminal_size == 0) {
+                return 0;
+            }
+            if (exports_terminal(&r, exp) < 0) {
+                goto error;
+            }
+            return 1;
+        }
+        r.off += terminal_size;
+        
+        uint8_t childc;
+        if (exports_byte(&r, &childc) < 0) {
+            goto error;
+        }
+        
+        /* edges are prefix-free, so at most one can match */
+        bool found = false;
+        for (unsigned i = 0; i < childc && !found; ++i) {
+            const char *it = name;
+            bool match = true;
+            uint8_t byte;
+            while (true) {
+                if (exports_byte(&r, &byte) < 0) {
+                    goto error;
+                }
+                if (byte == '\0') {
+                    break;
+                }
+                if (match && (unsigned char) *it == byte) {
+                    ++it;
+                } else {
+                    match = false;
+                }
+            }
+            uint64_t child;
+            if (exports_uleb128(&r, &child) < 0) {
+                goto error;
+            }
+            if (match) {
+                name = it;
+                r.off = child;
+                found = true;
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+    }
+    
+    errno = ELOOP;
+    errfn = __FUNCTION__;
+    
+error:
+    return -1;
+}
+
+struct exports_walk {
+    const struct exports *exps;
+    exports_fn *fn;
+    void *ctx;
+    char *name;
+    size_t namecap;
+};
+
+static int exports_walk_reserve(struct exports_walk *walk, size_t len) {
+    if (len > walk->namecap) {
+        walk->namecap = max(len, walk->namecap * 2);
+        if ((walk->name = reallocf(walk->name, walk->namecap)) == NULL) {
+            errfn = "reallocf";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int exports_walk_node(struct exports_walk *walk, uint64_t off, size_t namelen, unsigned depth) {
+    if (depth >= EXPORTS_MAX_DEPTH) {
+        errno = ELOOP;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    struct exports_reader r;
+    exports_reader_init(&r, walk->exps, off);
+    
+    uint64_t terminal_size;
+    if (exports_uleb128(&r, &terminal_size) < 0) {
+        goto error;
+    }
+    if (terminal_size > 0) {
+        struct export exp;
+        const uint64_t children = r.off + terminal_size;
+        if (exports_terminal(&r, &exp) < 0) {
+            goto error;
+        }
+        walk->name[namelen] = '\0';
+        exp.name = walk->name;
+        int res;
+        if ((res = walk->fn(&exp, walk->ctx)) != 0) {
+            return res;
+        }
+        r.off = children;
+    }
+    
+    uint8_t childc;
+    if (exports_byte(&r, &childc) < 0) {
+        goto error;
+    }
+    for (unsigned i = 0; i < childc; ++i) {
+        size_t len = namelen;
+        uint8_t byte;
+        while (true) {
+            if (exports_byte(&r, &byte) < 0) {
+                goto error;
+            }
+            if (exports_walk_reserve(walk, len + 1) < 0) {
+                goto error;
+            }
+            walk->name[len] = byte;
+            if (byte == '\0') {
+                break;
+            }
+            ++len;
+        }
+        uint64_t child;
+        if (exports_uleb128(&r, &child) < 0) {
+            goto error;
+        }
+        
+        int res;
+        if ((res = exports_walk_node(walk, child, len, depth + 1)) != 0) {
+            return res;
+        }
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+int exports_foreach(const struct exports *exps, exports_fn *fn, void *ctx) {
+    struct exports_walk walk;
+    walk.exps = exps;
+    walk.fn = fn;
+    walk.ctx = ctx;
+    walk.name = NULL;
+    walk.namecap = 0;
+    
+    int res = -1;
+    if (exports_walk_reserve(&walk, 256) == 0) {
+        res = exports_walk_node(&walk, 0, 0, 0);
+    }
+    free(walk.name);
+    return res;
+}
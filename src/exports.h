@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct core;
+
+/* dyld export trie of an image, read in place from the image's vm */
+struct exports {
+    FILE *vm;
+    uint64_t vmbase;    // address of the trie
+    uint64_t size;
+    uint64_t imagebase; // __TEXT vmaddr; export offsets are relative to it
+};
+
+struct export {
+    const char *name;
+    uint64_t vmaddr; // 0 for re-exports
+    uint64_t flags;  // EXPORT_SYMBOL_FLAGS_*
+};
+
+typedef int exports_fn(const struct export *exp, void *ctx); // return nonzero to stop
+
+/* fails with ENOENT if the image has no LC_DYLD_INFO(_ONLY) or LC_DYLD_EXPORTS_TRIE */
+int exports_open(struct core *core, struct exports *exps);
+
+/* returns 1 and fills exp (name excepted) if found, 0 if not */
+int exports_lookup(const struct exports *exps, const char *name, struct export *exp);
+
+/* depth-first walk; returns fn's nonzero result if it stopped early */
+int exports_foreach(const struct exports *exps, exports_fn *fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include <mach-o/loader.h>
+
+#include "images.h"
+#include "bound.h"
+#include "util.h"
+
+static void core_images_init(struct core_images *imgs) {
+    imgs->imgc = 0;
+    imgs->imgv = NULL;
+}
+
+static bool core_image_magic(const struct core *core, const struct core_segment *seg) {
+    uint32_t magic;
+    if (seg->filesize < sizeof(magic)) {
+        return false;
+    }
+    if (fseek(core->vm, seg->vmbase, SEEK_SET) < 0 ||
+        fread(&magic, sizeof(magic), 1, core->vm) != 1) {
+        return false;
+    }
+    return magic == MH_MAGIC || magic == MH_MAGIC_64 || magic == MH_CIGAM || magic == MH_CIGAM_64;
+}
+
+/* open image whose header lies at the start of seg */
+static int core_image_open(const struct core *core, const struct core_segment *seg, struct core_image *img) {
+    FILE *seg_f;
+    if ((seg_f = lbound_open(core->vm, seg->vmbase)) == NULL) {
+        goto error;
+    }
+    
+    img->seg = seg;
+    img->slide = 0;
+    img->syms_open = false;
+    if (core_open(seg_f, &img->core, seg_f) < 0) {
+        fclose(seg_f);
+        goto error;
+    }
+    
+    /* re-point the image's vm so that unslid addresses land on the mapping */
+    const struct core_segment *text;
+    if ((text = core_image_segment(img, SEG_TEXT)) != NULL) {
+        img->slide = seg->vmbase - text->vmbase;
+    }
+    FILE *vm;
+    if ((vm = lbound_open(core->vm, img->slide)) == NULL) {
+        core_close(&img->core);
+        goto error;
+    }
+    img->core.vm = vm;
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+int core_images_open(const struct core *core, struct core_images *imgs) {
+    core_images_init(imgs);
+    
+    if ((imgs->imgv = calloc(core->segc, sizeof(struct core_image))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    
+    for (size_t i = 0; i < core->segc; ++i) {
+        const struct core_segment *seg = &core->segv[i];
+        if (seg->prot != (VM_PROT_READ | VM_PROT_EXECUTE) || !core_image_magic(core, seg)) {
+            continue;
+        }
+        if (core_image_open(core, seg, &imgs->imgv[imgs->imgc]) < 0) {
+            continue; // not a parseable image
+        }
+        ++imgs->imgc;
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+void core_images_close(struct core_images *imgs) {
+    for (size_t i = 0; i < imgs->imgc; ++i) {
+        struct core_image *img = &imgs->imgv[i];
+        if (img->syms_open) {
+            symbols_close(&img->syms);
+        }
+        core_close(&img->core);
+    }
+    free(imgs->imgv);
+    core_images_init(imgs);
+}
+
+struct core_image *core_images_find(const struct core_images *imgs, uint64_t vmaddr) {
+    for (size_t i = 0; i < imgs->imgc; ++i) {
+        struct core_image *img = &imgs->imgv[i];
+        const uint64_t unslid = vmaddr - img->slide;
+        for (size_t j = 0; j < img->core.segc; ++j) {
+            const struct core_segment *seg = &img->core.segv[j];
+            if (seg->prot != VM_PROT_NONE && seg->vmbase <= unslid && unslid < seg->vmbase + seg->vmsize) {
+                return img;
+            }
+        }
+    }
+    return NULL;
+}
+
+const struct core_segment *core_image_segment(const struct core_image *img, const char *name) {
+    for (size_t i = 0; i < img->core.segc; ++i) {
+        if (strcmp(img->core.segv[i].name, name) == 0) {
+            return &img->core.segv[i];
+        }
+    }
+    return NULL;
+}
+
+struct symbols *core_image_symbols(struct core_image *img, int flags) {
+    if (!img->syms_open) {
+        if (symbols_open_flags(&img->core, &img->syms, flags) < 0) {
+            return NULL;
+        }
+        img->syms_open = true;
+    }
+    return &img->syms;
+}
+
+struct core_foreach_ctx {
+    const struct core_image *img;
+    core_symbol_fn *fn;
+    void *ctx;
+    int res; // fn's nonzero result, told apart from a failure to read the image
+};
+
+static int core_foreach_slide(const char *name, uint64_t vmaddr, struct core_foreach_ctx *fctx) {
+    return fctx->res = fctx->fn(fctx->img, name, vmaddr + fctx->img->slide, fctx->ctx);
+}
+
+int core_foreach_symbol(const struct core *core, core_symbol_fn *fn, void *ctx) {
+    for (size_t i = 0; i < core->segc; ++i) {
+        const struct core_segment *seg = &core->segv[i];
+        if (seg->prot != (VM_PROT_READ | VM_PROT_EXECUTE) || !core_image_magic(core, seg)) {
+            continue;
+        }
+        
+        struct core_image img;
+        if (core_image_open(core, seg, &img) < 0) {
+            continue; // not a parseable image
+        }
+        struct core_foreach_ctx fctx = {&img, fn, ctx, 0};
+        symbols_foreach(&img.core, 0, (symbols_fn *) &core_foreach_slide, &fctx);
+        core_close(&img.core);
+        if (fctx.res != 0) {
+            return fctx.res;
+        }
+        /* an image whose symbols can't be read is skipped, like one that doesn't parse */
+    }
+    
+    return 0;
+}
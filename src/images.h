@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+#include "symbols.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a Mach-O image mapped into a core's memory */
+struct core_image {
+    const struct core_segment *seg; // segment of the parent core holding the image's header
+    struct core core;               // image's own load commands; vm is addressed by unslid vmaddr
+    int64_t slide;                  // seg->vmbase - image __TEXT vmaddr
+    bool syms_open;
+    struct symbols syms;
+};
+
+struct core_images {
+    size_t imgc;
+    struct core_image *imgv;
+};
+
+int core_images_open(const struct core *core, struct core_images *imgs);
+void core_images_close(struct core_images *imgs);
+
+/* find image with a segment containing (slid) vmaddr */
+struct core_image *core_images_find(const struct core_images *imgs, uint64_t vmaddr);
+
+/* image segment by name, e.g. SEG_LINKEDIT; vmbase is unslid */
+const struct core_segment *core_image_segment(const struct core_image *img, const char *name);
+
+/* symbols are opened on first use and owned by the image */
+struct symbols *core_image_symbols(struct core_image *img, int flags);
+
+/* called for each symbol with its slid address; return nonzero to stop */
+typedef int core_symbol_fn(const struct core_image *img, const char *name, uint64_t vmaddr, void *ctx);
+
+/* walk the local symbols of every image in the core in symbol table order, one image at a time, without building
+ * symbol tables; images that do not parse or whose symbols cannot be read are skipped, as by core_images_open.
+ * returns 0, or the nonzero value returned by fn. */
+int core_foreach_symbol(const struct core *core, core_symbol_fn *fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
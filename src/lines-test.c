@@ -0,0 +1,454 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mach-o/loader.h>
+
+#include "lines.h"
+#include "test.h"
+
+#define TEST_BASE 0x100000000ULL
+
+static const uint8_t test_uuid[16] = {0x6c, 0x69, 0x6e, 0x65, 0x73, 0x2d, 0x74, 0x65, 0x73, 0x74, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05};
+static const uint8_t test_other_uuid[16] = {0xff};
+
+/* little-endian DWARF under construction */
+struct test_dwarf {
+    size_t len;
+    uint8_t buf[1024];
+};
+
+static void test_dwarf_uint(struct test_dwarf *d, uint64_t value, size_t size) {
+    test_check(d->len + size <= sizeof(d->buf));
+    for (size_t i = 0; i < size; ++i) {
+        d->buf[d->len++] = value >> (8 * i);
+    }
+}
+
+static void test_dwarf_uleb(struct test_dwarf *d, uint64_t value) {
+    do {
+        test_dwarf_uint(d, (value & 0x7f) | (value >= 0x80 ? 0x80 : 0), 1);
+        value >>= 7;
+    } while (value != 0);
+}
+
+static void test_dwarf_sleb(struct test_dwarf *d, int64_t value) {
+    for (bool more = true; more; ) {
+        const uint8_t b = value & 0x7f;
+        value >>= 7;
+        more = !((value == 0 && !(b & 0x40)) || (value == -1 && (b & 0x40)));
+        test_dwarf_uint(d, b | (more ? 0x80 : 0), 1);
+    }
+}
+
+static void test_dwarf_str(struct test_dwarf *d, const char *s) {
+    const size_t len = strlen(s) + 1;
+    test_check(d->len + len <= sizeof(d->buf));
+    memcpy(d->buf + d->len, s, len);
+    d->len += len;
+}
+
+/* 32-bit length field at off, covering everything after it */
+static void test_dwarf_length(struct test_dwarf *d, size_t off) {
+    const size_t len = d->len;
+    d->len = off;
+    test_dwarf_uint(d, len - off - 4, 4);
+    d->len = len;
+}
+
+/* version, then the fields every unit header shares up to the standard opcode lengths;
+ * returns the offset of header_length, to be patched once the tables are written */
+static size_t test_dwarf_header(struct test_dwarf *d, uint16_t version) {
+    static const uint8_t lengths[12] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+    test_dwarf_uint(d, version, 2);
+    if (version >= 5) {
+        test_dwarf_uint(d, 8, 1); // address_size
+        test_dwarf_uint(d, 0, 1); // segment_selector_size
+    }
+    const size_t header_length = d->len;
+    test_dwarf_uint(d, 0, 4);
+    test_dwarf_uint(d, 1, 1);    // minimum_instruction_length
+    if (version >= 4) {
+        test_dwarf_uint(d, 1, 1); // maximum_operations_per_instruction
+    }
+    test_dwarf_uint(d, 1, 1);    // default_is_stmt
+    test_dwarf_uint(d, -5, 1);   // line_base
+    test_dwarf_uint(d, 14, 1);   // line_range
+    test_dwarf_uint(d, 13, 1);   // opcode_base
+    for (size_t i = 0; i < sizeof(lengths); ++i) {
+        test_dwarf_uint(d, lengths[i], 1);
+    }
+    return header_length;
+}
+
+static void test_dwarf_set_address(struct test_dwarf *d, uint64_t vmaddr) {
+    test_dwarf_uint(d, 0, 1);
+    test_dwarf_uleb(d, 9);
+    test_dwarf_uint(d, 0x02, 1); // DW_LNE_set_address
+    test_dwarf_uint(d, vmaddr, 8);
+}
+
+static void test_dwarf_end_sequence(struct test_dwarf *d) {
+    test_dwarf_uint(d, 0, 1);
+    test_dwarf_uleb(d, 1);
+    test_dwarf_uint(d, 0x01, 1); // DW_LNE_end_sequence
+}
+
+/* special opcode advancing the address by addr and the line by line */
+static void test_dwarf_special(struct test_dwarf *d, unsigned addr, int line) {
+    test_dwarf_uint(d, (line + 5) + 14 * addr + 13, 1);
+}
+
+struct test_row {
+    uint64_t vmaddr;
+    const char *file; // NULL for the end of a sequence
+    uint32_t line;
+};
+
+/* the rows the units below decode to, in address order */
+static const struct test_row test_rows[] = {
+    {TEST_BASE + 0x1000, "/src/a.c", 10},
+    {TEST_BASE + 0x1004, "/src/a.c", 11},
+    {TEST_BASE + 0x100c, "/abs/b.h", 8},
+    {TEST_BASE + 0x1020, NULL, 0},
+    {TEST_BASE + 0x1020, "/v5/inc/x.h", 7},
+    {TEST_BASE + 0x1024, NULL, 0},
+    {TEST_BASE + 0x2000, "/v5/inc/x.h", 1},
+    {TEST_BASE + 0x2002, "/v5/main.c", 42},
+    {TEST_BASE + 0x2008, NULL, 0},
+};
+
+/* a DWARF 5 unit and a DWARF 4 unit, in that order so that rows need sorting, and the v5 unit's
+ * second sequence starts where the v4 one ends; line_str receives the strings the v5 directory table points at */
+static void test_dwarf_units(struct test_dwarf *d, struct test_dwarf *line_str) {
+    test_dwarf_str(line_str, "/v5");
+    test_dwarf_str(line_str, "/v5/inc");
+    
+    size_t unit = d->len;
+    test_dwarf_uint(d, 0, 4);
+    size_t header_length = test_dwarf_header(d, 5);
+    test_dwarf_uint(d, 1, 1);     // directory_entry_format_count
+    test_dwarf_uleb(d, 0x1);      // DW_LNCT_path
+    test_dwarf_uleb(d, 0x1f);     // DW_FORM_line_strp
+    test_dwarf_uleb(d, 2);
+    test_dwarf_uint(d, 0, 4);     // "/v5"
+    test_dwarf_uint(d, 4, 4);     // "/v5/inc"
+    test_dwarf_uint(d, 2, 1);     // file_name_entry_format_count
+    test_dwarf_uleb(d, 0x1);      // DW_LNCT_path
+    test_dwarf_uleb(d, 0x08);     // DW_FORM_string
+    test_dwarf_uleb(d, 0x2);      // DW_LNCT_directory_index
+    test_dwarf_uleb(d, 0x0f);     // DW_FORM_udata
+    test_dwarf_uleb(d, 2);
+    test_dwarf_str(d, "main.c");
+    test_dwarf_uleb(d, 0);
+    test_dwarf_str(d, "x.h");
+    test_dwarf_uleb(d, 1);
+    test_dwarf_length(d, header_length);
+    test_dwarf_set_address(d, TEST_BASE + 0x2000);
+    test_dwarf_uint(d, 0x01, 1);  // DW_LNS_copy: x.h:1
+    test_dwarf_uint(d, 0x04, 1);  // DW_LNS_set_file
+    test_dwarf_uleb(d, 0);
+    test_dwarf_uint(d, 0x03, 1);  // DW_LNS_advance_line
+    test_dwarf_sleb(d, 41);
+    test_dwarf_special(d, 2, 0);  // main.c:42
+    test_dwarf_uint(d, 0x02, 1);  // DW_LNS_advance_pc
+    test_dwarf_uleb(d, 6);
+    test_dwarf_end_sequence(d);
+    test_dwarf_set_address(d, TEST_BASE + 0x1020);
+    test_dwarf_uint(d, 0x03, 1);  // DW_LNS_advance_line
+    test_dwarf_sleb(d, 6);
+    test_dwarf_uint(d, 0x01, 1);  // DW_LNS_copy: x.h:7
+    test_dwarf_uint(d, 0x02, 1);  // DW_LNS_advance_pc
+    test_dwarf_uleb(d, 4);
+    test_dwarf_end_sequence(d);
+    test_dwarf_length(d, unit);
+    
+    unit = d->len;
+    test_dwarf_uint(d, 0, 4);
+    header_length = test_dwarf_header(d, 4);
+    test_dwarf_str(d, "/src");    // include_directories
+    test_dwarf_str(d, "");
+    test_dwarf_str(d, "a.c");     // file_names: name, directory, mtime, length
+    test_dwarf_uleb(d, 1);
+    test_dwarf_uleb(d, 0);
+    test_dwarf_uleb(d, 0);
+    test_dwarf_str(d, "/abs/b.h");
+    test_dwarf_uleb(d, 0);
+    test_dwarf_uleb(d, 0);
+    test_dwarf_uleb(d, 0);
+    test_dwarf_str(d, "");
+    test_dwarf_length(d, header_length);
+    test_dwarf_set_address(d, TEST_BASE + 0x1000);
+    test_dwarf_uint(d, 0x03, 1);  // DW_LNS_advance_line
+    test_dwarf_sleb(d, 9);
+    test_dwarf_uint(d, 0x01, 1);  // DW_LNS_copy: a.c:10
+    test_dwarf_special(d, 4, 1);  // a.c:11
+    test_dwarf_uint(d, 0x04, 1);  // DW_LNS_set_file
+    test_dwarf_uleb(d, 2);
+    test_dwarf_uint(d, 0x02, 1);  // DW_LNS_advance_pc
+    test_dwarf_uleb(d, 8);
+    test_dwarf_uint(d, 0x03, 1);  // DW_LNS_advance_line
+    test_dwarf_sleb(d, -3);
+    test_dwarf_uint(d, 0x01, 1);  // DW_LNS_copy: b.h:8
+    test_dwarf_uint(d, 0x08, 1);  // DW_LNS_const_add_pc: 17
+    test_dwarf_uint(d, 0x09, 1);  // DW_LNS_fixed_advance_pc
+    test_dwarf_uint(d, 3, 2);
+    test_dwarf_end_sequence(d);
+    test_dwarf_length(d, unit);
+}
+
+/* dSYM companion holding the given __DWARF sections at path */
+static void test_save_dsym(const char *path, bool swap, const uint8_t *uuid,
+                           const struct test_dwarf *line, const struct test_dwarf *line_str) {
+    struct test_image img;
+    test_image_init(&img, true, swap, MH_DSYM);
+    test_image_uuid(&img, uuid);
+    const size_t lineoff = test_image_data(&img, line->buf, line->len, 1);
+    const size_t stroff = test_image_data(&img, line_str->buf, line_str->len, 1);
+    const size_t size = img.size - lineoff;
+    const size_t seg = test_image_segment(&img, "__DWARF", TEST_BASE + 0x10000, size, lineoff, size, VM_PROT_READ, 2);
+    test_image_section(&img, seg, 0, "__debug_line", TEST_BASE + 0x10000, line->len, lineoff);
+    test_image_section(&img, seg, 1, "__debug_line_str", TEST_BASE + 0x10000 + stroff - lineoff, line_str->len, stroff);
+    test_image_save(&img, path);
+    test_image_free(&img);
+}
+
+/* row covering vmaddr according to test_rows, or NULL */
+static const struct test_row *test_row_find(uint64_t vmaddr) {
+    const struct test_row *row = NULL;
+    for (size_t i = 0; i < sizeof(test_rows) / sizeof(*test_rows) && test_rows[i].vmaddr <= vmaddr; ++i) {
+        row = &test_rows[i];
+    }
+    return row != NULL && row->file != NULL ? row : NULL;
+}
+
+static bool test_same_row(const struct lines *lines, const struct line *line, const struct test_row *row) {
+    if (line == NULL || row == NULL) {
+        return line == NULL && row == NULL;
+    }
+    return line->vmaddr == row->vmaddr && line->line == row->line && strcmp(lines_file(lines, line), row->file) == 0;
+}
+
+/* lines_find and lines_find_batch, sorted and not, agree with a linear scan of test_rows */
+static void test_lookups(const struct lines *lines) {
+    test_check(lines->linec == sizeof(test_rows) / sizeof(*test_rows));
+    test_check(memcmp(lines->uuid, test_uuid, sizeof(test_uuid)) == 0);
+    for (size_t i = 0; i < lines->linec; ++i) {
+        test_check(lines->linev[i].vmaddr == test_rows[i].vmaddr);
+        test_check((lines->linev[i].file == LINES_END_SEQUENCE) == (test_rows[i].file == NULL));
+    }
+    
+    uint64_t addrv[0x1400 / 2];
+    const struct line *resv[0x1400 / 2];
+    const size_t addrc = sizeof(addrv) / sizeof(*addrv);
+    for (size_t i = 0; i < addrc; ++i) {
+        addrv[i] = TEST_BASE + 0xf00 + 2 * i;
+        test_check(test_same_row(lines, lines_find(lines, addrv[i]), test_row_find(addrv[i])));
+    }
+    lines_find_batch(lines, addrv, addrc, resv);
+    for (size_t i = 0; i < addrc; ++i) {
+        test_check(test_same_row(lines, resv[i], test_row_find(addrv[i])));
+    }
+    
+    /* runs that go back down restart the search */
+    for (size_t i = 0; i < addrc; ++i) {
+        addrv[i] = TEST_BASE + 0xf00 + (i * 37 % 0x1400);
+    }
+    lines_find_batch(lines, addrv, addrc, resv);
+    for (size_t i = 0; i < addrc; ++i) {
+        test_check(test_same_row(lines, resv[i], test_row_find(addrv[i])));
+    }
+}
+
+static char test_dir[] = "/tmp/lines-test.XXXXXX";
+
+static char *test_path(const char *name) {
+    char *path;
+    test_check(asprintf(&path, "%s/%s", test_dir, name) > 0);
+    return path;
+}
+
+static void test_write_file(const char *path, const void *data, size_t size) {
+    FILE *f;
+    test_check((f = fopen(path, "w")) != NULL);
+    test_check(fwrite(data, 1, size, f) == size);
+    test_check(fclose(f) == 0);
+}
+
+/* v4 and v5 units decode to the expected rows; the uuid must match */
+static void test_open(const char *dsym) {
+    struct lines lines;
+    test_check(lines_open(dsym, test_uuid, &lines) == 0);
+    test_check(!lines.mapped);
+    test_lookups(&lines);
+    lines_close(&lines);
+    
+    test_check(lines_open(dsym, NULL, &lines) == 0);
+    lines_close(&lines);
+    
+    errno = 0;
+    test_check(lines_open(dsym, test_other_uuid, &lines) < 0);
+    test_check(errno == ENOENT);
+}
+
+/* a unit whose length runs past the section ends decoding without losing the units before it */
+static void test_open_truncated(void) {
+    struct test_dwarf line = {0}, line_str = {0};
+    test_dwarf_units(&line, &line_str);
+    test_dwarf_uint(&line, 0x1000, 4);
+    test_dwarf_uint(&line, 4, 2);
+    
+    char *dsym = test_path("truncated");
+    test_save_dsym(dsym, false, test_uuid, &line, &line_str);
+    struct lines lines;
+    test_check(lines_open(dsym, test_uuid, &lines) == 0);
+    test_lookups(&lines);
+    lines_close(&lines);
+    
+    /* no __debug_line at all */
+    struct test_dwarf empty = {0};
+    test_save_dsym(dsym, false, test_uuid, &empty, &line_str);
+    errno = 0;
+    test_check(lines_open(dsym, test_uuid, &lines) < 0);
+    test_check(errno == ENOENT);
+    
+    /* opposite-endian dSYMs carry big-endian DWARF, which is not decoded */
+    test_save_dsym(dsym, true, test_uuid, &line, &line_str);
+    errno = 0;
+    test_check(lines_open(dsym, test_uuid, &lines) < 0);
+    test_check(errno == ENOTSUP);
+    
+    unlink(dsym);
+    free(dsym);
+}
+
+/* bytes of the cache lines_save writes for dsym */
+static uint8_t *test_saved(const char *dsym, size_t *size) {
+    struct lines lines;
+    test_check(lines_open(dsym, test_uuid, &lines) == 0);
+    FILE *f;
+    uint8_t *buf;
+    test_check((f = tmpfile()) != NULL);
+    test_check(lines_save(&lines, f) == 0);
+    test_check((*size = ftell(f)) == lines.size);
+    test_check((buf = malloc(*size)) != NULL);
+    rewind(f);
+    test_check(fread(buf, 1, *size, f) == *size);
+    fclose(f);
+    lines_close(&lines);
+    return buf;
+}
+
+static int test_load_patched(const char *cache, const uint8_t *buf, size_t size, size_t off, const void *patch, size_t len) {
+    uint8_t *copy;
+    test_check((copy = malloc(size)) != NULL);
+    memcpy(copy, buf, size);
+    memcpy(copy + off, patch, len);
+    test_write_file(cache, copy, size);
+    free(copy);
+    
+    struct lines lines;
+    errno = 0;
+    const int res = lines_load(cache, test_uuid, &lines);
+    if (res == 0) {
+        lines_close(&lines);
+    }
+    return res;
+}
+
+/* a saved table maps back to the same lookups; truncated, foreign or inconsistent caches are refused */
+static void test_cache(const char *dsym) {
+    size_t size;
+    uint8_t *buf = test_saved(dsym, &size);
+    char *cache = test_path("cache");
+    
+    test_write_file(cache, buf, size);
+    struct lines lines;
+    test_check(lines_load(cache, test_uuid, &lines) == 0);
+    test_check(lines.mapped && lines.size == size);
+    test_lookups(&lines);
+    lines_close(&lines);
+    
+    errno = 0;
+    test_check(lines_load(cache, test_other_uuid, &lines) < 0 && errno == EINVAL);
+    
+    /* header: magic, version, uuid, then linec, filec and namesize */
+    const size_t linec = sizeof(test_rows) / sizeof(*test_rows);
+    const size_t hdrsize = 48;
+    const size_t filev = hdrsize + 16 * linec;
+    uint32_t word = 0;
+    uint64_t count;
+    test_check(test_load_patched(cache, buf, size, 0, &word, sizeof(word)) < 0 && errno == EINVAL);
+    word = 2;
+    test_check(test_load_patched(cache, buf, size, 4, &word, sizeof(word)) < 0 && errno == EINVAL);
+    count = linec + 1;
+    test_check(test_load_patched(cache, buf, size, 24, &count, sizeof(count)) < 0 && errno == EINVAL);
+    count = UINT64_MAX / 8;
+    test_check(test_load_patched(cache, buf, size, 32, &count, sizeof(count)) < 0 && errno == EINVAL);
+    /* a row naming a file past filev, and a file past the names */
+    word = 4;
+    test_check(test_load_patched(cache, buf, size, hdrsize + 8, &word, sizeof(word)) < 0 && errno == EINVAL);
+    word = size - filev;
+    test_check(test_load_patched(cache, buf, size, filev, &word, sizeof(word)) < 0 && errno == EINVAL);
+    /* unterminated names */
+    test_check(test_load_patched(cache, buf, size, size - 1, "x", 1) < 0 && errno == EINVAL);
+    /* truncated, down to less than a header */
+    const size_t lenv[] = {size - 1, size - 8, filev, hdrsize, hdrsize - 1};
+    for (size_t i = 0; i < sizeof(lenv) / sizeof(*lenv); ++i) {
+        test_write_file(cache, buf, lenv[i]);
+        errno = 0;
+        test_check(lines_load(cache, test_uuid, &lines) < 0 && errno == EINVAL);
+    }
+    /* the unpatched bytes still load, so the refusals above come from the patches */
+    test_check(test_load_patched(cache, buf, size, 0, buf, 1) == 0);
+    
+    unlink(cache);
+    free(cache);
+    free(buf);
+}
+
+/* the first open decodes the dSYM and writes the cache, the next maps the cache alone */
+static void test_cached(const char *dsym) {
+    char *cache = test_path("cached");
+    struct lines lines;
+    test_check(lines_open_cached(dsym, cache, test_uuid, &lines) == 0);
+    test_check(!lines.mapped);
+    test_lookups(&lines);
+    lines_close(&lines);
+    test_check(access(cache, R_OK) == 0);
+    
+    char *moved = test_path("moved");
+    test_check(rename(dsym, moved) == 0);
+    test_check(lines_open_cached(dsym, cache, test_uuid, &lines) == 0);
+    test_check(lines.mapped);
+    test_lookups(&lines);
+    lines_close(&lines);
+    
+    /* a cache for another uuid is ignored, and fails over to the missing dSYM */
+    errno = 0;
+    test_check(lines_open_cached(dsym, cache, test_other_uuid, &lines) < 0 && errno == ENOENT);
+    test_check(rename(moved, dsym) == 0);
+    
+    unlink(cache);
+    free(cache);
+    free(moved);
+}
+
+int main(void) {
+    test_check(mkdtemp(test_dir) != NULL);
+    
+    struct test_dwarf line = {0}, line_str = {0};
+    test_dwarf_units(&line, &line_str);
+    char *dsym = test_path("dsym");
+    test_save_dsym(dsym, false, test_uuid, &line, &line_str);
+    
+    test_open(dsym);
+    test_open_truncated();
+    test_cache(dsym);
+    test_cached(dsym);
+    
+    unlink(dsym);
+    free(dsym);
+    rmdir(test_dir);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1006 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <mach-o/loader.h>
+
+#include "lines.h"
+#include "core.h"
+#include "macho.h"
+#include "util.h"
+
+#define LINES_MAGIC 0x786e696c // 'linx'
+#define LINES_VERSION 1
+
+/* cache file: header, then struct line[linec], uint32_t[filec] and namesize bytes of NUL-terminated paths */
+struct lines_header {
+    uint32_t magic;
+    uint32_t version;
+    uint8_t uuid[16];
+    uint64_t linec;
+    uint64_t filec;
+    uint64_t namesize;
+};
+
+_Static_assert(sizeof(struct lines_header) % 8 == 0 && sizeof(struct line) == 16, "unexpected lines layout");
+
+#define DW_LNS_copy               0x01
+#define DW_LNS_advance_pc         0x02
+#define DW_LNS_advance_line       0x03
+#define DW_LNS_set_file           0x04
+#define DW_LNS_const_add_pc       0x08
+#define DW_LNS_fixed_advance_pc   0x09
+
+#define DW_LNE_end_sequence       0x01
+#define DW_LNE_set_address        0x02
+#define DW_LNE_define_file        0x03
+
+#define DW_LNCT_path              0x1
+#define DW_LNCT_directory_index   0x2
+
+#define DW_FORM_block2            0x03
+#define DW_FORM_block4            0x04
+#define DW_FORM_data2             0x05
+#define DW_FORM_data4             0x06
+#define DW_FORM_data8             0x07
+#define DW_FORM_string            0x08
+#define DW_FORM_block             0x09
+#define DW_FORM_block1            0x0a
+#define DW_FORM_data1             0x0b
+#define DW_FORM_sdata             0x0d
+#define DW_FORM_strp              0x0e
+#define DW_FORM_udata             0x0f
+#define DW_FORM_data16            0x1e
+#define DW_FORM_line_strp         0x1f
+
+/* bounds-checked reader over a section; overruns set err and read as zero */
+struct lines_cursor {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool err;
+};
+
+struct lines_section {
+    const char *name;
+    uint8_t *data;
+    size_t size;
+};
+
+enum {
+    LINES_DEBUG_LINE,
+    LINES_DEBUG_LINE_STR,
+    LINES_DEBUG_STR,
+    LINES_SECTIONS,
+};
+
+/* a decoded row before sorting; ord keeps rows at the same address in program order */
+struct lines_row {
+    uint64_t vmaddr;
+    uint32_t file;
+    uint32_t line;
+    uint64_t ord;
+};
+
+struct lines_build {
+    size_t rowc, rowcap;
+    struct lines_row *rowv;
+    size_t filec, filecap;
+    uint32_t *filev;
+    size_t namesize, namecap;
+    char *names;
+    
+    /* path hash: open-addressed table of filev indices plus one (0 = empty) */
+    size_t hashc;
+    uint32_t *hashv;
+};
+
+/* one unit's header, as far as the line program needs it */
+struct lines_unit {
+    uint16_t version;
+    bool dwarf64;
+    uint8_t min_inst_length;
+    int8_t line_base;
+    uint8_t line_range;
+    uint8_t opcode_base;
+    const uint8_t *opcode_lengths;
+    size_t dirc;
+    const char **dirv;
+    size_t filec, filecap;
+    uint32_t *filev; // unit file numbers to build file indices
+};
+
+static bool lines_need(struct lines_cursor *c, size_t n) {
+    if (c->err || (size_t) (c->end - c->p) < n) {
+        c->err = true;
+        c->p = c->end;
+        return false;
+    }
+    return true;
+}
+
+static uint64_t lines_uint(struct lines_cursor *c, size_t n) {
+    if (!lines_need(c, n)) {
+        return 0;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; ++i) {
+        v |= (uint64_t) c->p[i] << (8 * i);
+    }
+    c->p += n;
+    return v;
+}
+
+static uint64_t lines_uleb(struct lines_cursor *c) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; lines_need(c, 1); shift += 7) {
+        const uint8_t b = *c->p++;
+        if (shift < 64) {
+            v |= (uint64_t) (b & 0x7f) << shift;
+        }
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return v;
+}
+
+static int64_t lines_sleb(struct lines_cursor *c) {
+    uint64_t v = 0;
+    unsigned shift = 0;
+    uint8_t b = 0;
+    while (lines_need(c, 1)) {
+        b = *c->p++;
+        if (shift < 64) {
+            v |= (uint64_t) (b & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    if (shift < 64 && (b & 0x40)) {
+        v |= ~(uint64_t) 0 << shift;
+    }
+    return (int64_t) v;
+}
+
+static const char *lines_cstr(struct lines_cursor *c) {
+    const uint8_t *nul;
+    if (c->err || (nul = memchr(c->p, '\0', c->end - c->p)) == NULL) {
+        c->err = true;
+        c->p = c->end;
+        return "";
+    }
+    const char *s = (const char *) c->p;
+    c->p = nul + 1;
+    return s;
+}
+
+static void lines_skip(struct lines_cursor *c, uint64_t n) {
+    if (lines_need(c, n)) {
+        c->p += n;
+    }
+}
+
+/* string at an offset into one of the string sections; the sections are read with a trailing NUL */
+static const char *lines_strp(struct lines_cursor *c, const struct lines_unit *u, const struct lines_section *sect) {
+    const uint64_t off = lines_uint(c, u->dwarf64 ? 8 : 4);
+    if (off >= sect->size) {
+        c->err = true;
+        return "";
+    }
+    return (const char *) sect->data + off;
+}
+
+/* read one attribute of a v5 directory or file entry; strings land in *str, constants in *num */
+static void lines_form(struct lines_cursor *c, const struct lines_unit *u, const struct lines_section *sectv, uint64_t form, const char **str, uint64_t *num) {
+    switch (form) {
+        case DW_FORM_string:
+            *str = lines_cstr(c);
+            break;
+            
+        case DW_FORM_line_strp:
+            *str = lines_strp(c, u, &sectv[LINES_DEBUG_LINE_STR]);
+            break;
+            
+        case DW_FORM_strp:
+            *str = lines_strp(c, u, &sectv[LINES_DEBUG_STR]);
+            break;
+            
+        case DW_FORM_udata:
+            *num = lines_uleb(c);
+            break;
+            
+        case DW_FORM_sdata:
+            *num = lines_sleb(c);
+            break;
+            
+        case DW_FORM_data1:
+            *num = lines_uint(c, 1);
+            break;
+            
+        case DW_FORM_data2:
+            *num = lines_uint(c, 2);
+            break;
+            
+        case DW_FORM_data4:
+            *num = lines_uint(c, 4);
+            break;
+            
+        case DW_FORM_data8:
+            *num = lines_uint(c, 8);
+            break;
+            
+        case DW_FORM_data16:
+            lines_skip(c, 16);
+            break;
+            
+        case DW_FORM_block1:
+            lines_skip(c, lines_uint(c, 1));
+            break;
+            
+        case DW_FORM_block2:
+            lines_skip(c, lines_uint(c, 2));
+            break;
+            
+        case DW_FORM_block4:
+            lines_skip(c, lines_uint(c, 4));
+            break;
+            
+        case DW_FORM_block:
+            lines_skip(c, lines_uleb(c));
+            break;
+            
+        default:
+            c->err = true; // e.g. DW_FORM_strx, which needs .debug_str_offsets
+            break;
+    }
+}
+
+static uint64_t lines_hash(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s != '\0'; ++s) {
+        h = (h ^ (uint8_t) *s) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int lines_rehash(struct lines_build *b, size_t hashc) {
+    uint32_t *hashv;
+    if ((hashv = calloc(hashc, sizeof(uint32_t))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    for (size_t i = 0; i < b->filec; ++i) {
+        size_t h = lines_hash(b->names + b->filev[i]) & (hashc - 1);
+        while (hashv[h] != 0) {
+            h = (h + 1) & (hashc - 1);
+        }
+        hashv[h] = i + 1;
+    }
+    free(b->hashv);
+    b->hashc = hashc;
+    b->hashv = hashv;
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* index of the path dir/name, added on first sight; absolute names ignore dir */
+static int lines_build_file(struct lines_build *b, const char *dir, const char *name, uint32_t *filep) {
+    char *path = NULL;
+    if (name[0] == '/' || dir[0] == '\0') {
+        strdup_chk(path, name);
+    } else if (asprintf(&path, "%s/%s", dir, name) < 0) {
+        errfn = "asprintf";
+        path = NULL;
+        goto error;
+    }
+    
+    if (2 * (b->filec + 1) > b->hashc && lines_rehash(b, max(b->hashc * 2, 256)) < 0) {
+        goto error;
+    }
+    size_t h = lines_hash(path) & (b->hashc - 1);
+    for (; b->hashv[h] != 0; h = (h + 1) & (b->hashc - 1)) {
+        const uint32_t i = b->hashv[h] - 1;
+        if (strcmp(b->names + b->filev[i], path) == 0) {
+            *filep = i;
+            free(path);
+            return 0;
+        }
+    }
+    
+    const size_t len = strlen(path) + 1;
+    if (b->filec == b->filecap) {
+        b->filecap = max(b->filecap * 2, 64);
+        if ((b->filev = reallocf(b->filev, sizeof(uint32_t) * b->filecap)) == NULL) {
+            errfn = "reallocf";
+            goto error;
+        }
+    }
+    if (b->namesize + len > b->namecap) {
+        b->namecap = max(b->namecap * 2, b->namesize + len);
+        if ((b->names = reallocf(b->names, b->namecap)) == NULL) {
+            errfn = "reallocf";
+            goto error;
+        }
+    }
+    if (b->namesize + len > UINT32_MAX) {
+        errno = EFBIG;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    memcpy(b->names + b->namesize, path, len);
+    b->filev[b->filec] = b->namesize;
+    b->namesize += len;
+    b->hashv[h] = b->filec + 1;
+    *filep = b->filec++;
+    free(path);
+    return 0;
+    
+error:
+    free(path);
+    return -1;
+}
+
+static int lines_build_row(struct lines_build *b, uint64_t vmaddr, uint32_t file, uint32_t line) {
+    if (b->rowc == b->rowcap) {
+        b->rowcap = max(b->rowcap * 2, 4096);
+        if ((b->rowv = reallocf(b->rowv, sizeof(struct lines_row) * b->rowcap)) == NULL) {
+            errfn = "reallocf";
+            goto error;
+        }
+    }
+    b->rowv[b->rowc] = (struct lines_row) {vmaddr, file, line, b->rowc};
+    ++b->rowc;
+    return 0;
+    
+error:
+    return -1;
+}
+
+static void lines_build_free(struct lines_build *b) {
+    free(b->rowv);
+    free(b->filev);
+    free(b->names);
+    free(b->hashv);
+}
+
+/* a NULL name stands for a file number that may not be referenced; rows using it end the sequence */
+static int lines_unit_file(struct lines_unit *u, struct lines_build *b, const char *dir, const char *name) {
+    if (u->filec == u->filecap) {
+        u->filecap = max(u->filecap * 2, 16);
+        if ((u->filev = reallocf(u->filev, sizeof(uint32_t) * u->filecap)) == NULL) {
+            errfn = "reallocf";
+            goto error;
+        }
+    }
+    if (name == NULL) {
+        u->filev[u->filec] = LINES_END_SEQUENCE;
+    } else if (lines_build_file(b, dir, name, &u->filev[u->filec]) < 0) {
+        goto error;
+    }
+    ++u->filec;
+    return 0;
+    
+error:
+    return -1;
+}
+
+static const char *lines_unit_dir(const struct lines_unit *u, uint64_t i) {
+    /* before v5, directory 0 is the compilation directory, which lives in .debug_info */
+    if (u->version < 5 && i == 0) {
+        return "";
+    }
+    return i < u->dirc ? u->dirv[i] : "";
+}
+
+static int lines_unit_dirs(struct lines_unit *u, size_t dirc) {
+    if ((u->dirv = reallocf(u->dirv, sizeof(const char *) * max(dirc, 1))) == NULL) {
+        errfn = "reallocf";
+        return -1;
+    }
+    return 0;
+}
+
+/* v5 directory or file table: a format description, then the entries */
+static int lines_unit_table5(struct lines_cursor *c, struct lines_unit *u, struct lines_build *b, const struct lines_section *sectv, bool files) {
+    uint64_t formatv[2 * 16];
+    const uint8_t formatc = lines_uint(c, 1);
+    if (formatc > 16) {
+        c->err = true;
+        return 0;
+    }
+    for (uint8_t i = 0; i < formatc; ++i) {
+        formatv[2 * i] = lines_uleb(c);
+        formatv[2 * i + 1] = lines_uleb(c);
+    }
+    
+    const uint64_t entryc = lines_uleb(c);
+    if (entryc > (uint64_t) (c->end - c->p)) {
+        c->err = true;
+        return 0;
+    }
+    if (!files && lines_unit_dirs(u, entryc) < 0) {
+        return -1;
+    }
+    for (uint64_t e = 0; e < entryc && !c->err; ++e) {
+        const char *path = "";
+        uint64_t dir = 0;
+        for (uint8_t i = 0; i < formatc; ++i) {
+            const char *str = "";
+            uint64_t num = 0;
+            lines_form(c, u, sectv, formatv[2 * i + 1], &str, &num);
+            if (formatv[2 * i] == DW_LNCT_path) {
+                path = str;
+            } else if (formatv[2 * i] == DW_LNCT_directory_index) {
+                dir = num;
+            }
+        }
+        if (c->err) {
+            break;
+        }
+        if (files) {
+            if (lines_unit_file(u, b, lines_unit_dir(u, dir), path) < 0) {
+                return -1;
+            }
+        } else {
+            u->dirv[u->dirc++] = path;
+        }
+    }
+    return 0;
+}
+
+/* v2-4 include_directories and file_names, each terminated by an empty string */
+static int lines_unit_tables(struct lines_cursor *c, struct lines_unit *u, struct lines_build *b) {
+    const struct lines_cursor start = *c;
+    size_t dirc = 1;
+    while (!c->err && *lines_cstr(c) != '\0') {
+        ++dirc;
+    }
+    *c = start;
+    if (lines_unit_dirs(u, dirc) < 0) {
+        return -1;
+    }
+    u->dirv[u->dirc++] = "";
+    for (const char *dir; !c->err && *(dir = lines_cstr(c)) != '\0'; ) {
+        u->dirv[u->dirc++] = dir;
+    }
+    
+    /* file numbers start at 1 */
+    if (lines_unit_file(u, b, "", NULL) < 0) {
+        return -1;
+    }
+    for (const char *name; !c->err && *(name = lines_cstr(c)) != '\0'; ) {
+        const uint64_t dir = lines_uleb(c);
+        lines_uleb(c); // mtime
+        lines_uleb(c); // length
+        if (lines_unit_file(u, b, lines_unit_dir(u, dir), name) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* run the line program of one unit, appending a row per emitted state and an end row per sequence */
+static int lines_unit_program(struct lines_cursor *c, struct lines_unit *u, struct lines_build *b) {
+    uint64_t address = 0, file = 1, line = 1;
+    
+#define lines_emit(f) do { \
+if (lines_build_row(b, address, (f), line) < 0) { \
+goto error; \
+} \
+} while (0)
+
+#define lines_unit_fileidx (file < u->filec ? u->filev[file] : LINES_END_SEQUENCE)
+
+    while (c->p < c->end && !c->err) {
+        const uint8_t op = lines_uint(c, 1);
+        if (op >= u->opcode_base) {
+            const uint8_t adj = op - u->opcode_base;
+            address += (uint64_t) (adj / u->line_range) * u->min_inst_length;
+            line += u->line_base + adj % u->line_range;
+            lines_emit(lines_unit_fileidx);
+            continue;
+        }
+        
+        switch (op) {
+            case 0: {
+                const uint64_t len = lines_uleb(c);
+                if (len == 0 || !lines_need(c, len)) {
+                    break;
+                }
+                const uint8_t *next = c->p + len;
+                switch (lines_uint(c, 1)) {
+                    case DW_LNE_end_sequence:
+                        lines_emit(LINES_END_SEQUENCE);
+                        address = 0;
+                        file = 1;
+                        line = 1;
+                        break;
+                        
+                    case DW_LNE_set_address:
+                        address = lines_uint(c, min(len - 1, 8));
+                        break;
+                        
+                    case DW_LNE_define_file: {
+                        const char *name = lines_cstr(c);
+                        const uint64_t dir = lines_uleb(c);
+                        if (!c->err && lines_unit_file(u, b, lines_unit_dir(u, dir), name) < 0) {
+                            goto error;
+                        }
+                        break;
+                    }
+                }
+                c->p = next;
+                break;
+            }
+            
+            case DW_LNS_copy:
+                lines_emit(lines_unit_fileidx);
+                break;
+                
+            case DW_LNS_advance_pc:
+                address += lines_uleb(c) * u->min_inst_length;
+                break;
+                
+            case DW_LNS_advance_line:
+                line += lines_sleb(c);
+                break;
+                
+            case DW_LNS_set_file:
+                file = lines_uleb(c);
+                break;
+                
+            case DW_LNS_const_add_pc:
+                address += (uint64_t) ((255 - u->opcode_base) / u->line_range) * u->min_inst_length;
+                break;
+                
+            case DW_LNS_fixed_advance_pc:
+                address += lines_uint(c, 2);
+                break;
+                
+            default:
+                /* other standard opcodes only touch registers the table doesn't keep */
+                for (uint8_t i = 0; i < u->opcode_lengths[op - 1]; ++i) {
+                    lines_uleb(c);
+                }
+                break;
+        }
+    }
+    
+#undef lines_unit_fileidx
+#undef lines_emit
+
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* decode the unit at c->p and advance past it; malformed units are skipped */
+static int lines_unit(struct lines_cursor *c, struct lines_build *b, const struct lines_section *sectv) {
+    struct lines_unit u = {0};
+    
+    uint64_t length = lines_uint(c, 4);
+    if (length == 0xffffffff) {
+        u.dwarf64 = true;
+        length = lines_uint(c, 8);
+    } else if (length >= 0xfffffff0) {
+        c->err = true; // reserved
+    }
+    if (c->err || length > (uint64_t) (c->end - c->p)) {
+        c->err = true;
+        return 0;
+    }
+    struct lines_cursor unit = {c->p, c->p + length, false};
+    c->p += length;
+    
+    u.version = lines_uint(&unit, 2);
+    if (u.version < 2 || u.version > 5) {
+        return 0;
+    }
+    if (u.version >= 5) {
+        lines_uint(&unit, 1); // address_size; DW_LNE_set_address carries its own length
+        lines_uint(&unit, 1); // segment_selector_size
+    }
+    const uint64_t header_length = lines_uint(&unit, u.dwarf64 ? 8 : 4);
+    if (unit.err || header_length > (uint64_t) (unit.end - unit.p)) {
+        return 0;
+    }
+    struct lines_cursor program = {unit.p + header_length, unit.end, false};
+    
+    u.min_inst_length = lines_uint(&unit, 1);
+    if (u.version >= 4) {
+        lines_uint(&unit, 1); // maximum_operations_per_instruction; VLIW op_index is not tracked
+    }
+    lines_uint(&unit, 1); // default_is_stmt
+    u.line_base = (int8_t) lines_uint(&unit, 1);
+    u.line_range = lines_uint(&unit, 1);
+    u.opcode_base = lines_uint(&unit, 1);
+    if (u.line_range == 0 || u.opcode_base == 0 || !lines_need(&unit, u.opcode_base - 1)) {
+        return 0;
+    }
+    u.opcode_lengths = unit.p;
+    unit.p += u.opcode_base - 1;
+    
+    int res;
+    if (u.version >= 5) {
+        if ((res = lines_unit_table5(&unit, &u, b, sectv, false)) == 0) {
+            res = lines_unit_table5(&unit, &u, b, sectv, true);
+        }
+    } else {
+        res = lines_unit_tables(&unit, &u, b);
+    }
+    if (res == 0 && !unit.err) {
+        res = lines_unit_program(&program, &u, b);
+    }
+    
+    free(u.dirv);
+    free(u.filev);
+    return res;
+}
+
+/* read the named __DWARF sections of a dSYM, each followed by a NUL; missing ones stay empty */
+static int lines_sections(struct core *core, struct lines_section *sectv) {
+    struct load_command *cmd = NULL;
+    
+    rewind(core->f);
+    struct mach_header_64 hdr;
+    if (core->fmt == CORE_MACHO64) {
+        fread_one_chk(hdr, core->f);
+    } else {
+        fread_chk((struct mach_header *) &hdr, 1, core->f);
+    }
+    
+    for (size_t i = 0; i < hdr.ncmds; ++i) {
+        if ((cmd = macho_parse_lc(core->f)) == NULL) {
+            goto error;
+        }
+        
+        uint64_t offs[LINES_SECTIONS] = {0}, sizes[LINES_SECTIONS] = {0};
+        bool found = false;
+        if (cmd->cmd == LC_SEGMENT_64 && cmd->cmdsize >= sizeof(struct segment_command_64)) {
+            const struct segment_command_64 *seg = (struct segment_command_64 *) cmd;
+            const struct section_64 *sects = (struct section_64 *) (seg + 1);
+            const size_t sectc = min(seg->nsects, (seg->cmdsize - sizeof(*seg)) / sizeof(struct section_64));
+            for (size_t j = 0; j < sectc && strncmp(seg->segname, "__DWARF", sizeof(seg->segname)) == 0; ++j) {
+                for (size_t k = 0; k < LINES_SECTIONS; ++k) {
+                    if (strncmp(sects[j].sectname, sectv[k].name, sizeof(sects[j].sectname)) == 0) {
+                        offs[k] = sects[j].offset;
+                        sizes[k] = sects[j].size;
+                        found = true;
+                    }
+                }
+            }
+        } else if (cmd->cmd == LC_SEGMENT && cmd->cmdsize >= sizeof(struct segment_command)) {
+            const struct segment_command *seg = (struct segment_command *) cmd;
+            const struct section *sects = (struct section *) (seg + 1);
+            const size_t sectc = min(seg->nsects, (seg->cmdsize - sizeof(*seg)) / sizeof(struct section));
+            for (size_t j = 0; j < sectc && strncmp(seg->segname, "__DWARF", sizeof(seg->segname)) == 0; ++j) {
+                for (size_t k = 0; k < LINES_SECTIONS; ++k) {
+                    if (strncmp(sects[j].sectname, sectv[k].name, sizeof(sects[j].sectname)) == 0) {
+                        offs[k] = sects[j].offset;
+                        sizes[k] = sects[j].size;
+                        found = true;
+                    }
+                }
+            }
+        }
+        free(cmd);
+        cmd = NULL;
+        
+        if (!found) {
+            continue;
+        }
+        long pos;
+        ftell_chk(pos, core->f);
+        for (size_t k = 0; k < LINES_SECTIONS; ++k) {
+            if (sizes[k] == 0 || sectv[k].data != NULL) {
+                continue;
+            }
+            malloc_chk(sectv[k].data, sizes[k] + 1);
+            fseek_chk(core->f, offs[k], SEEK_SET);
+            fread_chk(sectv[k].data, sizes[k], core->f);
+            sectv[k].data[sizes[k]] = '\0';
+            sectv[k].size = sizes[k];
+        }
+        fseek_chk(core->f, pos, SEEK_SET);
+    }
+    
+    if (sectv[LINES_DEBUG_LINE].data == NULL) {
+        errno = ENOENT;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    return 0;
+    
+error:
+    free(cmd);
+    return -1;
+}
+
+static int lines_row_cmp(const struct lines_row *a, const struct lines_row *b) {
+    if (a->vmaddr != b->vmaddr) {
+        return a->vmaddr < b->vmaddr ? -1 : 1;
+    }
+    /* a sequence ending where another starts must not shadow it */
+    const bool aend = a->file == LINES_END_SEQUENCE, bend = b->file == LINES_END_SEQUENCE;
+    if (aend != bend) {
+        return aend ? -1 : 1;
+    }
+    return a->ord < b->ord ? -1 : a->ord > b->ord;
+}
+
+static void lines_set(struct lines *lines, void *base, size_t size, bool mapped) {
+    const struct lines_header *hdr = base;
+    memcpy(lines->uuid, hdr->uuid, sizeof(lines->uuid));
+    lines->linec = hdr->linec;
+    lines->linev = (const struct line *) (hdr + 1);
+    lines->filec = hdr->filec;
+    lines->filev = (const uint32_t *) (lines->linev + hdr->linec);
+    lines->names = (const char *) (lines->filev + hdr->filec);
+    lines->base = base;
+    lines->size = size;
+    lines->mapped = mapped;
+}
+
+/* sort the rows and lay the table out as lines_save writes it */
+static int lines_build_finish(struct lines_build *b, const uint8_t *uuid, struct lines *lines) {
+    qsort(b->rowv, b->rowc, sizeof(struct lines_row), (int (*)(const void *, const void *)) &lines_row_cmp);
+    
+    const size_t size = sizeof(struct lines_header) + sizeof(struct line) * b->rowc + sizeof(uint32_t) * b->filec + b->namesize;
+    struct lines_header *hdr;
+    malloc_chk(hdr, size);
+    hdr->magic = LINES_MAGIC;
+    hdr->version = LINES_VERSION;
+    memcpy(hdr->uuid, uuid, sizeof(hdr->uuid));
+    hdr->linec = b->rowc;
+    hdr->filec = b->filec;
+    hdr->namesize = b->namesize;
+    
+    struct line *linev = (struct line *) (hdr + 1);
+    for (size_t i = 0; i < b->rowc; ++i) {
+        linev[i] = (struct line) {b->rowv[i].vmaddr, b->rowv[i].file, b->rowv[i].line};
+    }
+    uint32_t *filev = (uint32_t *) (linev + b->rowc);
+    memcpy(filev, b->filev, sizeof(uint32_t) * b->filec);
+    memcpy(filev + b->filec, b->names, b->namesize);
+    
+    lines_set(lines, hdr, size, false);
+    return 0;
+    
+error:
+    return -1;
+}
+
+int lines_open(const char *path, const uint8_t *uuid, struct lines *lines) {
+    struct core core;
+    bool core_opened = false;
+    struct lines_build b = {0};
+    struct lines_section sectv[LINES_SECTIONS] = {
+        [LINES_DEBUG_LINE]     = {"__debug_line"},
+        [LINES_DEBUG_LINE_STR] = {"__debug_line_str"},
+        [LINES_DEBUG_STR]      = {"__debug_str"},
+    };
+    
+    if (core_fopen(path, &core) < 0) {
+        goto error;
+    }
+    core_opened = true;
+    if (uuid != NULL && (!core.has_uuid || memcmp(core.uuid, uuid, sizeof(core.uuid)) != 0)) {
+        errno = ENOENT;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    if (core.swap) {
+        errno = ENOTSUP; // DWARF would be big-endian too
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    if (lines_sections(&core, sectv) < 0) {
+        goto error;
+    }
+    
+    struct lines_cursor c = {sectv[LINES_DEBUG_LINE].data, sectv[LINES_DEBUG_LINE].data + sectv[LINES_DEBUG_LINE].size, false};
+    while (c.p < c.end && !c.err) {
+        if (lines_unit(&c, &b, sectv) < 0) {
+            goto error;
+        }
+    }
+    
+    if (lines_build_finish(&b, core.uuid, lines) < 0) {
+        goto error;
+    }
+    
+    lines_build_free(&b);
+    for (size_t k = 0; k < LINES_SECTIONS; ++k) {
+        free(sectv[k].data);
+    }
+    core_close(&core);
+    return 0;
+    
+error:
+    lines_build_free(&b);
+    for (size_t k = 0; k < LINES_SECTIONS; ++k) {
+        free(sectv[k].data);
+    }
+    if (core_opened) {
+        core_close(&core);
+    }
+    return -1;
+}
+
+void lines_close(struct lines *lines) {
+    if (lines->base != NULL) {
+        if (lines->mapped) {
+            munmap(lines->base, lines->size);
+        } else {
+            free(lines->base);
+        }
+    }
+    lines->base = NULL;
+    lines->linec = 0;
+    lines->filec = 0;
+}
+
+int lines_save(const struct lines *lines, FILE *f) {
+    fwrite_chk((const uint8_t *) lines->base, lines->size, f);
+    return 0;
+    
+error:
+    return -1;
+}
+
+int lines_load(const char *path, const uint8_t *uuid, struct lines *lines) {
+    int fd = -1;
+    void *base = MAP_FAILED;
+    size_t size = 0;
+    
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        errfn = "open";
+        goto error;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        errfn = "fstat";
+        goto error;
+    }
+    size = st.st_size;
+    if (size < sizeof(struct lines_header)) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    if ((base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        errfn = "mmap";
+        goto error;
+    }
+    
+    /* the tables must exactly fill the file, and the paths must be NUL-terminated */
+    const struct lines_header *hdr = base;
+    const size_t rest = size - sizeof(*hdr);
+    if (hdr->magic != LINES_MAGIC || hdr->version != LINES_VERSION ||
+        (uuid != NULL && memcmp(hdr->uuid, uuid, sizeof(hdr->uuid)) != 0) ||
+        hdr->linec > rest / sizeof(struct line) || hdr->filec > rest / sizeof(uint32_t) ||
+        sizeof(struct line) * hdr->linec + sizeof(uint32_t) * hdr->filec + hdr->namesize != rest ||
+        (hdr->namesize > 0 && ((const char *) base)[size - 1] != '\0')) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    const uint32_t *filev = (const uint32_t *) ((const struct line *) (hdr + 1) + hdr->linec);
+    for (uint64_t i = 0; i < hdr->filec; ++i) {
+        if (filev[i] >= hdr->namesize) {
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            goto error;
+        }
+    }
+    const struct line *linev = (const struct line *) (hdr + 1);
+    for (uint64_t i = 0; i < hdr->linec; ++i) {
+        if (linev[i].file >= hdr->filec && linev[i].file != LINES_END_SEQUENCE) {
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            goto error;
+        }
+    }
+    
+    close(fd);
+    lines_set(lines, base, size, true);
+    return 0;
+    
+error:
+    if (base != MAP_FAILED) {
+        munmap(base, size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+int lines_open_cached(const char *path, const char *cache, const uint8_t *uuid, struct lines *lines) {
+    char *tmp = NULL;
+    FILE *f = NULL;
+    
+    if (lines_load(cache, uuid, lines) == 0) {
+        return 0;
+    }
+    if (lines_open(path, uuid, lines) < 0) {
+        goto error;
+    }
+    
+    /* the table is usable even if it can't be cached; write aside and rename so readers never see half a file */
+    if (asprintf(&tmp, "%s.%d", cache, (int) getpid()) < 0) {
+        return 0;
+    }
+    if ((f = fopen(tmp, "w")) != NULL) {
+        const bool ok = lines_save(lines, f) == 0;
+        if (fclose(f) == 0 && ok && rename(tmp, cache) == 0) {
+            free(tmp);
+            return 0;
+        }
+        unlink(tmp);
+    }
+    free(tmp);
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* first row above vmaddr in [lo, hi), given that every row below lo is at or below it */
+static size_t lines_upper(const struct lines *lines, size_t lo, size_t hi, uint64_t vmaddr) {
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (lines->linev[mid].vmaddr <= vmaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static const struct line *lines_at(const struct lines *lines, size_t upper) {
+    if (upper == 0 || lines->linev[upper - 1].file == LINES_END_SEQUENCE) {
+        return NULL;
+    }
+    return &lines->linev[upper - 1];
+}
+
+const struct line *lines_find(const struct lines *lines, uint64_t vmaddr) {
+    return lines_at(lines, lines_upper(lines, 0, lines->linec, vmaddr));
+}
+
+void lines_find_batch(const struct lines *lines, const uint64_t *addrv, size_t addrc, const struct line **resv) {
+    size_t pos = 0;
+    for (size_t i = 0; i < addrc; ++i) {
+        const uint64_t vmaddr = addrv[i];
+        size_t lo = 0, hi = lines->linec;
+        if (i > 0 && vmaddr >= addrv[i - 1]) {
+            /* gallop forward from the previous answer to bracket this one */
+            lo = pos;
+            size_t probe = pos, step = 1;
+            while (probe < lines->linec && lines->linev[probe].vmaddr <= vmaddr) {
+                lo = probe + 1;
+                probe += step;
+                step *= 2;
+            }
+            hi = min(probe, lines->linec);
+        }
+        pos = lines_upper(lines, lo, hi, vmaddr);
+        resv[i] = lines_at(lines, pos);
+    }
+}
+
+const char *lines_file(const struct lines *lines, const struct line *line) {
+    return lines->names + lines->filev[line->file];
+}
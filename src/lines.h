@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* address to file:line table decoded from a dSYM's __DWARF,__debug_line */
+
+#define LINES_END_SEQUENCE UINT32_MAX // file of the row closing a sequence; never returned by lookups
+
+struct line {
+    uint64_t vmaddr; // unslid, as in the image's load commands
+    uint32_t file;   // index into filev
+    uint32_t line;   // 0 for code with no source line
+};
+
+struct lines {
+    uint8_t uuid[16];
+    size_t linec;
+    const struct line *linev; // sorted by vmaddr; each row covers up to the next
+    size_t filec;
+    const uint32_t *filev;    // offsets of file paths in names
+    const char *names;
+    
+    /* header and tables in the layout written by lines_save, either malloced or mapped from the cache */
+    void *base;
+    size_t size;
+    bool mapped;
+};
+
+/* decode the line tables of the dSYM companion file at path (e.g. Foo.dSYM/Contents/Resources/DWARF/Foo).
+ * if uuid is not NULL, the dSYM's LC_UUID must match it, or this fails with ENOENT. */
+int lines_open(const char *path, const uint8_t *uuid, struct lines *lines);
+
+/* map a table saved by lines_save; fails with EINVAL if it is malformed or belongs to another uuid */
+int lines_load(const char *path, const uint8_t *uuid, struct lines *lines);
+int lines_save(const struct lines *lines, FILE *f);
+
+/* lines_load from cache, falling back to lines_open and saving the result to cache for next time */
+int lines_open_cached(const char *path, const char *cache, const uint8_t *uuid, struct lines *lines);
+
+void lines_close(struct lines *lines);
+
+/* row covering vmaddr, or NULL if it lies outside every sequence */
+const struct line *lines_find(const struct lines *lines, uint64_t vmaddr);
+
+/* resv[i] = lines_find(lines, addrv[i]); ascending runs of addresses are resolved by searching forward
+ * from the previous hit, so sorted batches cost little more than a merge */
+void lines_find_batch(const struct lines *lines, const uint64_t *addrv, size_t addrc, const struct line **resv);
+
+const char *lines_file(const struct lines *lines, const struct line *line);
+
+#ifdef __cplusplus
+}
+#endif
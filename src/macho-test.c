@@ -8,6 +8,7 @@
 #include "symbols.h"
 #include "util.h"
 #include "bound.h"
+#include "images.h"
 
 int main(int argc, char *argv[]) {
     if (argc != 2) {
@@ -35,8 +36,41 @@ int main(int argc, char *argv[]) {
         printf("ptr=%p\n", symvec);
         for (size_t i = 0; i < nsyms; ++i) {
             printf("%s\n", symvec[i]);
+            free(symvec[i]);
         }
+        free(symvec);
         
+        /* symbols_find through the page index must agree with the binary search */
+        struct core_images imgs;
+        if (core_images_open(&core, &imgs) < 0) {
+            core_perror("core_images_open");
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < imgs.imgc; ++i) {
+            struct core_image *img = &imgs.imgv[i];
+            struct symbols plain, indexed;
+            if (symbols_open(&img->core, &plain) < 0 || symbols_open_flags(&img->core, &indexed, SYMBOLS_PAGE_INDEX) < 0) {
+                core_perror("symbols_open");
+                return EXIT_FAILURE;
+            }
+            for (size_t j = 0; j < plain.symc; ++j) {
+                const uint64_t vmaddr = plain.symv[j].vmaddr;
+                const uint64_t probes[] = {vmaddr, vmaddr - 1, vmaddr & ~(CORE_PAGE_SIZE - 1)};
+                for (size_t k = 0; k < sizeof(probes) / sizeof(*probes); ++k) {
+                    const struct symbol *a = symbols_find(&plain, probes[k]);
+                    const struct symbol *b = symbols_find(&indexed, probes[k]);
+                    if ((a == NULL) != (b == NULL) || (a != NULL && a->vmaddr != b->vmaddr)) {
+                        fprintf(stderr, "page index mismatch at %llx\n", probes[k]);
+                        return EXIT_FAILURE;
+                    }
+                }
+            }
+            symbols_close(&plain);
+            symbols_close(&indexed);
+        }
+        printf("page index agrees for %zu images\n", imgs.imgc);
+        core_images_close(&imgs);
+        core_close(&core);
         
         return EXIT_SUCCESS;
     }
@@ -65,7 +99,7 @@ int main(int argc, char *argv[]) {
         if (magic != MH_MAGIC) {
             continue;
         }
-
+        
         FILE *seg_f;
         if ((seg_f = lbound_open(core.vm, seg->vmbase)) == NULL) {
             goto error;
@@ -103,7 +137,7 @@ int main(int argc, char *argv[]) {
         for (size_t i = 0; i < incore.segc; ++i) {
             printf("segment name=%s vmaddr=%08llx vmsize=%08llx\n", incore.segv[i].name, incore.segv[i].vmbase, incore.segv[i].vmsize);
         }
-
+        
 #if 1
         struct symbols syms;
         if (symbols_open(&incore, &syms) < 0) {
@@ -2,23 +2,539 @@
 #include <errno.h>
 #include <string.h>
 #include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #include "macho.h"
 #include "util.h"
 
+#define macho_swap16(x) ((x) = __builtin_bswap16(x))
+#define macho_swap32(x) ((x) = __builtin_bswap32(x))
+#define macho_swap64(x) ((x) = __builtin_bswap64(x))
+
 struct load_command *macho_parse_lc(FILE *f) {
+    return macho_parse_lc_swap(f, false, 0);
+}
+
+/* swap the 32-bit words following the cmd/cmdsize header, for commands made only of such words */
+static void macho_swap_words(struct load_command *cmd, size_t size) {
+    uint32_t *words = (uint32_t *) (cmd + 1);
+    const size_t wordc = (min(size, cmd->cmdsize) - sizeof(*cmd)) / sizeof(uint32_t);
+    for (size_t i = 0; i < wordc; ++i) {
+        macho_swap32(words[i]);
+    }
+}
+
+static void macho_swap_segment(struct segment_command *seg, bool to_host) {
+    if (seg->cmdsize < sizeof(*seg)) {
+        return;
+    }
+    uint32_t nsects = seg->nsects;
+    macho_swap32(seg->vmaddr);
+    macho_swap32(seg->vmsize);
+    macho_swap32(seg->fileoff);
+    macho_swap32(seg->filesize);
+    macho_swap32(seg->maxprot);
+    macho_swap32(seg->initprot);
+    macho_swap32(seg->nsects);
+    macho_swap32(seg->flags);
+    if (to_host) {
+        nsects = seg->nsects;
+    }
+    
+    struct section *sectv = (struct section *) (seg + 1);
+    const size_t sectc = min(nsects, (seg->cmdsize - sizeof(*seg)) / sizeof(struct section));
+    for (size_t i = 0; i < sectc; ++i) {
+        struct section *sect = &sectv[i];
+        macho_swap32(sect->addr);
+        macho_swap32(sect->size);
+        macho_swap32(sect->offset);
+        macho_swap32(sect->align);
+        macho_swap32(sect->reloff);
+        macho_swap32(sect->nreloc);
+        macho_swap32(sect->flags);
+        macho_swap32(sect->reserved1);
+        macho_swap32(sect->reserved2);
+    }
+}
+
+static void macho_swap_segment_64(struct segment_command_64 *seg, bool to_host) {
+    if (seg->cmdsize < sizeof(*seg)) {
+        return;
+    }
+    uint32_t nsects = seg->nsects;
+    macho_swap64(seg->vmaddr);
+    macho_swap64(seg->vmsize);
+    macho_swap64(seg->fileoff);
+    macho_swap64(seg->filesize);
+    macho_swap32(seg->maxprot);
+    macho_swap32(seg->initprot);
+    macho_swap32(seg->nsects);
+    macho_swap32(seg->flags);
+    if (to_host) {
+        nsects = seg->nsects;
+    }
+    
+    struct section_64 *sectv = (struct section_64 *) (seg + 1);
+    const size_t sectc = min(nsects, (seg->cmdsize - sizeof(*seg)) / sizeof(struct section_64));
+    for (size_t i = 0; i < sectc; ++i) {
+        struct section_64 *sect = &sectv[i];
+        macho_swap64(sect->addr);
+        macho_swap64(sect->size);
+        macho_swap32(sect->offset);
+        macho_swap32(sect->align);
+        macho_swap32(sect->reloff);
+        macho_swap32(sect->nreloc);
+        macho_swap32(sect->flags);
+        macho_swap32(sect->reserved1);
+        macho_swap32(sect->reserved2);
+        macho_swap32(sect->reserved3);
+    }
+}
+
+/* thread state flavors, from <mach/i386/thread_status.h> and <mach/arm/thread_status.h>;
+ * the SDK only defines those of the host architecture */
+enum {
+    MACHO_X86_THREAD_STATE32 = 1,
+    MACHO_X86_FLOAT_STATE32 = 2,
+    MACHO_X86_EXCEPTION_STATE32 = 3,
+    MACHO_X86_THREAD_STATE64 = 4,
+    MACHO_X86_FLOAT_STATE64 = 5,
+    MACHO_X86_EXCEPTION_STATE64 = 6,
+    MACHO_X86_THREAD_STATE = 7,
+    MACHO_X86_FLOAT_STATE = 8,
+    MACHO_X86_EXCEPTION_STATE = 9,
+    MACHO_X86_DEBUG_STATE32 = 10,
+    MACHO_X86_DEBUG_STATE64 = 11,
+    MACHO_X86_DEBUG_STATE = 12,
+    MACHO_X86_AVX_STATE32 = 16,
+    MACHO_X86_AVX_STATE64 = 17,
+    MACHO_X86_AVX_STATE = 18,
+    MACHO_X86_AVX512_STATE32 = 19,
+    MACHO_X86_AVX512_STATE64 = 20,
+    MACHO_X86_AVX512_STATE = 21,
+    MACHO_X86_PAGEIN_STATE = 22,
+    MACHO_X86_THREAD_FULL_STATE64 = 23,
+};
+
+enum {
+    MACHO_ARM_THREAD_STATE = 1,
+    MACHO_ARM_VFP_STATE = 2,
+    MACHO_ARM_EXCEPTION_STATE = 3,
+    MACHO_ARM_DEBUG_STATE = 4,
+    MACHO_ARM_THREAD_STATE64 = 6,
+    MACHO_ARM_EXCEPTION_STATE64 = 7,
+    MACHO_ARM_THREAD_STATE32 = 9,
+    MACHO_ARM_DEBUG_STATE32 = 14,
+    MACHO_ARM_DEBUG_STATE64 = 15,
+    MACHO_ARM_NEON_STATE = 16,
+    MACHO_ARM_NEON_STATE64 = 17,
+    MACHO_ARM_PAGEIN_STATE = 27,
+};
+
+/* count consecutive fields of size bytes; size 1 marks byte arrays, which are left as is */
+struct macho_thread_run {
+    uint8_t size;
+    uint16_t count;
+};
+
+/* a state made of runs terminated by an empty one, or, without runs, an x86_state_hdr/arm_state_hdr
+ * flavor/count pair followed by the state it names */
+struct macho_thread_layout {
+    uint32_t flavor;
+    const struct macho_thread_run *runv;
+};
+
+#define MACHO_X86_FLOAT_RUNS \
+{4, 2},   /* fpu_reserved */ \
+{2, 2},   /* fpu_fcw, fpu_fsw */ \
+{1, 2},   /* fpu_ftw, fpu_rsrv1 */ \
+{2, 1},   /* fpu_fop */ \
+{4, 1},   /* fpu_ip */ \
+{2, 2},   /* fpu_cs, fpu_rsrv2 */ \
+{4, 1},   /* fpu_dp */ \
+{2, 2},   /* fpu_ds, fpu_rsrv3 */ \
+{4, 2},   /* fpu_mxcsr, fpu_mxcsrmask */ \
+{1, 480}, /* fpu_stmm*, fpu_xmm*, fpu_rsrv4 */ \
+{4, 1}    /* fpu_reserved1 */
+
+static const struct macho_thread_run macho_x86_thread32[] = {{4, 16}, {0}};
+static const struct macho_thread_run macho_x86_thread64[] = {{8, 21}, {0}};
+static const struct macho_thread_run macho_x86_thread_full64[] = {{8, 25}, {0}};
+static const struct macho_thread_run macho_x86_float[] = {MACHO_X86_FLOAT_RUNS, {0}};
+static const struct macho_thread_run macho_x86_exception32[] = {{2, 2}, {4, 2}, {0}};
+static const struct macho_thread_run macho_x86_exception64[] = {{2, 2}, {4, 1}, {8, 1}, {0}};
+static const struct macho_thread_run macho_x86_debug32[] = {{4, 8}, {0}};
+static const struct macho_thread_run macho_x86_debug64[] = {{8, 8}, {0}};
+static const struct macho_thread_run macho_x86_avx32[] = {MACHO_X86_FLOAT_RUNS, {1, 192}, {0}};
+static const struct macho_thread_run macho_x86_avx64[] = {MACHO_X86_FLOAT_RUNS, {1, 320}, {0}};
+static const struct macho_thread_run macho_x86_avx512_32[] = {MACHO_X86_FLOAT_RUNS, {1, 512}, {0}};
+static const struct macho_thread_run macho_x86_avx512_64[] = {MACHO_X86_FLOAT_RUNS, {1, 1920}, {0}};
+static const struct macho_thread_run macho_pagein[] = {{4, 1}, {0}};
+
+static const struct macho_thread_layout macho_x86_layouts[] = {
+    {MACHO_X86_THREAD_STATE32, macho_x86_thread32},
+    {MACHO_X86_FLOAT_STATE32, macho_x86_float},
+    {MACHO_X86_EXCEPTION_STATE32, macho_x86_exception32},
+    {MACHO_X86_THREAD_STATE64, macho_x86_thread64},
+    {MACHO_X86_FLOAT_STATE64, macho_x86_float},
+    {MACHO_X86_EXCEPTION_STATE64, macho_x86_exception64},
+    {MACHO_X86_THREAD_STATE, NULL},
+    {MACHO_X86_FLOAT_STATE, NULL},
+    {MACHO_X86_EXCEPTION_STATE, NULL},
+    {MACHO_X86_DEBUG_STATE32, macho_x86_debug32},
+    {MACHO_X86_DEBUG_STATE64, macho_x86_debug64},
+    {MACHO_X86_DEBUG_STATE, NULL},
+    {MACHO_X86_AVX_STATE32, macho_x86_avx32},
+    {MACHO_X86_AVX_STATE64, macho_x86_avx64},
+    {MACHO_X86_AVX_STATE, NULL},
+    {MACHO_X86_AVX512_STATE32, macho_x86_avx512_32},
+    {MACHO_X86_AVX512_STATE64, macho_x86_avx512_64},
+    {MACHO_X86_AVX512_STATE, NULL},
+    {MACHO_X86_PAGEIN_STATE, macho_pagein},
+    {MACHO_X86_THREAD_FULL_STATE64, macho_x86_thread_full64},
+};
+
+static const struct macho_thread_run macho_arm_thread32[] = {{4, 17}, {0}};
+static const struct macho_thread_run macho_arm_vfp[] = {{4, 65}, {0}};
+static const struct macho_thread_run macho_arm_exception32[] = {{4, 3}, {0}};
+static const struct macho_thread_run macho_arm_debug32[] = {{4, 64}, {0}};
+static const struct macho_thread_run macho_arm_debug_state32[] = {
+    {4, 64}, /* bvr[16], bcr[16], wvr[16], wcr[16] */
+    {8, 1},  /* mdscr_el1 */
+    {0},
+};
+static const struct macho_thread_run macho_arm_thread64[] = {
+    {8, 33}, /* x[29], fp, lr, sp, pc */
+    {4, 2},  /* cpsr, pad */
+    {0},
+};
+static const struct macho_thread_run macho_arm_exception64[] = {
+    {8, 1}, /* far */
+    {4, 2}, /* esr, exception */
+    {0},
+};
+static const struct macho_thread_run macho_arm_debug64[] = {{8, 65}, {0}};
+static const struct macho_thread_run macho_arm_neon32[] = {
+    {16, 16}, /* v[16] */
+    {4, 2},   /* fpsr, fpcr */
+    {0},
+};
+static const struct macho_thread_run macho_arm_neon64[] = {
+    {16, 32}, /* v[32] */
+    {4, 2},   /* fpsr, fpcr */
+    {0},
+};
+
+/* arm32 cores; flavor 1 is the plain 32-bit thread state */
+static const struct macho_thread_layout macho_arm_layouts[] = {
+    {MACHO_ARM_THREAD_STATE, macho_arm_thread32},
+    {MACHO_ARM_VFP_STATE, macho_arm_vfp},
+    {MACHO_ARM_EXCEPTION_STATE, macho_arm_exception32},
+    {MACHO_ARM_DEBUG_STATE, macho_arm_debug32},
+    {MACHO_ARM_THREAD_STATE32, macho_arm_thread32},
+    {MACHO_ARM_DEBUG_STATE32, macho_arm_debug_state32},
+    {MACHO_ARM_NEON_STATE, macho_arm_neon32},
+    {MACHO_ARM_PAGEIN_STATE, macho_pagein},
+};
+
+/* arm64 and arm64_32 cores; flavor 1 is the unified arm_thread_state_t */
+static const struct macho_thread_layout macho_arm64_layouts[] = {
+    {MACHO_ARM_THREAD_STATE, NULL},
+    {MACHO_ARM_VFP_STATE, macho_arm_vfp},
+    {MACHO_ARM_EXCEPTION_STATE, macho_arm_exception32},
+    {MACHO_ARM_DEBUG_STATE, macho_arm_debug32},
+    {MACHO_ARM_THREAD_STATE64, macho_arm_thread64},
+    {MACHO_ARM_EXCEPTION_STATE64, macho_arm_exception64},
+    {MACHO_ARM_THREAD_STATE32, macho_arm_thread32},
+    {MACHO_ARM_DEBUG_STATE32, macho_arm_debug_state32},
+    {MACHO_ARM_DEBUG_STATE64, macho_arm_debug64},
+    {MACHO_ARM_NEON_STATE, macho_arm_neon32},
+    {MACHO_ARM_NEON_STATE64, macho_arm_neon64},
+    {MACHO_ARM_PAGEIN_STATE, macho_pagein},
+};
+
+static const struct macho_thread_layout *macho_thread_layout(cpu_type_t cputype, uint32_t flavor) {
+    const struct macho_thread_layout *layoutv;
+    size_t layoutc;
+    switch (cputype) {
+        case CPU_TYPE_X86:
+        case CPU_TYPE_X86_64:
+            layoutv = macho_x86_layouts;
+            layoutc = sizeof(macho_x86_layouts) / sizeof(*macho_x86_layouts);
+            break;
+            
+        case CPU_TYPE_ARM:
+            layoutv = macho_arm_layouts;
+            layoutc = sizeof(macho_arm_layouts) / sizeof(*macho_arm_layouts);
+            break;
+            
+        case CPU_TYPE_ARM64:
+        case CPU_TYPE_ARM64_32:
+            layoutv = macho_arm64_layouts;
+            layoutc = sizeof(macho_arm64_layouts) / sizeof(*macho_arm64_layouts);
+            break;
+            
+        default:
+            return NULL;
+    }
+    for (size_t i = 0; i < layoutc; ++i) {
+        if (layoutv[i].flavor == flavor) {
+            return &layoutv[i];
+        }
+    }
+    return NULL;
+}
+
+static void macho_swap_bytes(uint8_t *p, size_t size) {
+    for (size_t i = 0; i < size / 2; ++i) {
+        const uint8_t byte = p[i];
+        p[i] = p[size - 1 - i];
+        p[size - 1 - i] = byte;
+    }
+}
+
+/* swap a flavor/count pair in place, to host byte order or back from it, returning them in host byte order */
+static void macho_swap_flavor(uint8_t *it, uint32_t *flavor, uint32_t *count, bool to_host) {
+    uint32_t pair[2];
+    memcpy(pair, it, sizeof(pair));
+    if (!to_host) {
+        *flavor = pair[0];
+        *count = pair[1];
+    }
+    macho_swap32(pair[0]);
+    macho_swap32(pair[1]);
+    if (to_host) {
+        *flavor = pair[0];
+        *count = pair[1];
+    }
+    memcpy(it, pair, sizeof(pair));
+}
+
+/* swap size bytes of state; a state header may name a nested state no larger than what follows it */
+static int macho_swap_state(uint8_t *state, size_t size, cpu_type_t cputype, uint32_t flavor, bool to_host, bool nested) {
+    const struct macho_thread_layout *layout;
+    if ((layout = macho_thread_layout(cputype, flavor)) == NULL) {
+        errno = ENOTSUP;
+        goto error;
+    }
+    
+    if (layout->runv == NULL) {
+        uint32_t inner, count;
+        if (nested || size < sizeof(inner) + sizeof(count)) {
+            errno = EINVAL;
+            goto error;
+        }
+        macho_swap_flavor(state, &inner, &count, to_host);
+        state += sizeof(inner) + sizeof(count);
+        size -= sizeof(inner) + sizeof(count);
+        if ((size_t) count * sizeof(uint32_t) > size) {
+            errno = EINVAL;
+            goto error;
+        }
+        return macho_swap_state(state, (size_t) count * sizeof(uint32_t), cputype, inner, to_host, true);
+    }
+    
+    size_t layout_size = 0;
+    for (const struct macho_thread_run *run = layout->runv; run->size != 0; ++run) {
+        layout_size += (size_t) run->size * run->count;
+    }
+    if (layout_size != size) {
+        errno = EINVAL;
+        goto error;
+    }
+    for (const struct macho_thread_run *run = layout->runv; run->size != 0; ++run) {
+        for (size_t i = 0; i < run->count; ++i, state += run->size) {
+            macho_swap_bytes(state, run->size);
+        }
+    }
+    return 0;
+    
+error:
+    errfn = __FUNCTION__;
+    return -1;
+}
+
+/* flavor/count pairs, each followed by count 32-bit words of state laid out by flavor */
+static int macho_swap_thread(struct load_command *cmd, cpu_type_t cputype, bool to_host) {
+    uint8_t *it = (uint8_t *) (cmd + 1);
+    const uint8_t *end = (uint8_t *) cmd + cmd->cmdsize;
+    while (end - it >= 2 * sizeof(uint32_t)) {
+        uint32_t flavor, count;
+        macho_swap_flavor(it, &flavor, &count, to_host);
+        it += sizeof(flavor) + sizeof(count);
+        
+        const size_t size = (size_t) count * sizeof(uint32_t);
+        if (size > (size_t) (end - it)) {
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            return -1;
+        }
+        if (macho_swap_state(it, size, cputype, flavor, to_host, false) < 0) {
+            return -1;
+        }
+        it += size;
+    }
+    return 0;
+}
+
+/* swap the body of cmd, whose cmd and cmdsize are in host byte order; to_host tells which order the body is in */
+static int macho_swap_lc(struct load_command *cmd, cpu_type_t cputype, bool to_host) {
+    switch (cmd->cmd) {
+        case LC_SEGMENT:
+            macho_swap_segment((struct segment_command *) cmd, to_host);
+            break;
+            
+        case LC_SEGMENT_64:
+            macho_swap_segment_64((struct segment_command_64 *) cmd, to_host);
+            break;
+            
+        case LC_SYMTAB:
+            macho_swap_words(cmd, sizeof(struct symtab_command));
+            break;
+            
+        case LC_DYSYMTAB:
+            macho_swap_words(cmd, sizeof(struct dysymtab_command));
+            break;
+            
+        case LC_DYLD_INFO:
+        case LC_DYLD_INFO_ONLY:
+            macho_swap_words(cmd, sizeof(struct dyld_info_command));
+            break;
+            
+        case LC_CODE_SIGNATURE:
+        case LC_SEGMENT_SPLIT_INFO:
+        case LC_FUNCTION_STARTS:
+        case LC_DATA_IN_CODE:
+        case LC_DYLIB_CODE_SIGN_DRS:
+        case LC_LINKER_OPTIMIZATION_HINT:
+        case LC_DYLD_EXPORTS_TRIE:
+        case LC_DYLD_CHAINED_FIXUPS:
+            macho_swap_words(cmd, sizeof(struct linkedit_data_command));
+            break;
+            
+        case LC_THREAD:
+        case LC_UNIXTHREAD:
+            return macho_swap_thread(cmd, cputype, to_host);
+            
+        default:
+            break; // left as is; LC_UUID and the like are byte arrays
+    }
+    return 0;
+}
+
+struct load_command *macho_parse_lc_swap(FILE *f, bool swap, cpu_type_t cputype) {
     struct load_command cmd;
     struct load_command *cmdp = NULL;
     fread_one_chk(cmd, f);
+    if (swap) {
+        macho_swap32(cmd.cmd);
+        macho_swap32(cmd.cmdsize);
+    }
+    if (cmd.cmdsize < sizeof(cmd)) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
     if ((cmdp = malloc(cmd.cmdsize)) == NULL) {
         errfn = "malloc";
         goto error;
     }
     memcpy(cmdp, &cmd, sizeof(cmd));
     fread_chk((char *) (cmdp + 1), cmd.cmdsize - sizeof(cmd), f);
+    if (swap && macho_swap_lc(cmdp, cputype, true) < 0) {
+        goto error;
+    }
     return cmdp;
     
 error:
     free(cmdp);
     return NULL;
 }
+
+int macho_unswap_lc(struct load_command *cmd, cpu_type_t cputype) {
+    if (macho_swap_lc(cmd, cputype, false) < 0) {
+        return -1;
+    }
+    macho_swap32(cmd->cmd);
+    macho_swap32(cmd->cmdsize);
+    return 0;
+}
+
+void macho_swap_header(struct mach_header *hdr) {
+    macho_swap32(hdr->magic);
+    macho_swap32(hdr->cputype);
+    macho_swap32(hdr->cpusubtype);
+    macho_swap32(hdr->filetype);
+    macho_swap32(hdr->ncmds);
+    macho_swap32(hdr->sizeofcmds);
+    macho_swap32(hdr->flags);
+}
+
+_Static_assert(sizeof(struct nlist) == 12 && sizeof(struct nlist_64) == 16, "unexpected nlist layout");
+
+/* byte permutations for 16-byte vectors of symbol table entries */
+static const uint8_t macho_nlist_64_shuffle[1][16] = {
+    {3, 2, 1, 0, 4, 5, 7, 6, 15, 14, 13, 12, 11, 10, 9, 8},
+};
+
+/* 12-byte entries repeat every 48 bytes, and no field crosses a 16-byte boundary */
+static const uint8_t macho_nlist_shuffle[3][16] = {
+    {3, 2, 1, 0, 4, 5, 7, 6, 11, 10, 9, 8, 15, 14, 13, 12},
+    {0, 1, 3, 2, 7, 6, 5, 4, 11, 10, 9, 8, 12, 13, 15, 14},
+    {3, 2, 1, 0, 7, 6, 5, 4, 8, 9, 11, 10, 15, 14, 13, 12},
+};
+
+/* apply maskc consecutive 16-byte permutations to each of groupc groups at p */
+static void macho_shuffle(uint8_t *p, size_t groupc, const uint8_t (*maskv)[16], size_t maskc) {
+#if defined(__SSSE3__)
+    __m128i masks[3];
+    for (size_t m = 0; m < maskc; ++m) {
+        masks[m] = _mm_loadu_si128((const __m128i *) maskv[m]);
+    }
+    for (size_t g = 0; g < groupc; ++g) {
+        for (size_t m = 0; m < maskc; ++m, p += 16) {
+            _mm_storeu_si128((__m128i *) p, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) p), masks[m]));
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t masks[3];
+    for (size_t m = 0; m < maskc; ++m) {
+        masks[m] = vld1q_u8(maskv[m]);
+    }
+    for (size_t g = 0; g < groupc; ++g) {
+        for (size_t m = 0; m < maskc; ++m, p += 16) {
+            vst1q_u8(p, vqtbl1q_u8(vld1q_u8(p), masks[m]));
+        }
+    }
+#else
+    for (size_t g = 0; g < groupc; ++g) {
+        for (size_t m = 0; m < maskc; ++m, p += 16) {
+            uint8_t tmp[16];
+            memcpy(tmp, p, sizeof(tmp));
+            for (size_t k = 0; k < 16; ++k) {
+                p[k] = tmp[maskv[m][k]];
+            }
+        }
+    }
+#endif
+}
+
+void macho_swap_nlist(struct nlist *nlv, size_t nlc) {
+    const size_t groupc = nlc / 4;
+    macho_shuffle((uint8_t *) nlv, groupc, macho_nlist_shuffle, 3);
+    for (size_t i = groupc * 4; i < nlc; ++i) {
+        macho_swap32(nlv[i].n_un.n_strx);
+        macho_swap16(nlv[i].n_desc);
+        macho_swap32(nlv[i].n_value);
+    }
+}
+
+void macho_swap_nlist_64(struct nlist_64 *nlv, size_t nlc) {
+    macho_shuffle((uint8_t *) nlv, nlc, macho_nlist_64_shuffle, 1);
+}
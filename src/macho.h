@@ -1,13 +1,34 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <mach/machine.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct mach_header;
+struct load_command;
+struct nlist;
+struct nlist_64;
+
 struct load_command *macho_parse_lc(FILE *f);
 
+/* parse a load command of an opposite-endian (MH_CIGAM*) file if swap is set, returning it in host byte order.
+ * cputype selects thread state layouts; thread states of flavors unknown for it fail with ENOTSUP. */
+struct load_command *macho_parse_lc_swap(FILE *f, bool swap, cpu_type_t cputype);
+
+/* the inverse: swap a load command in host byte order, e.g. as parsed from an MH_CIGAM* file, back to the opposite order */
+int macho_unswap_lc(struct load_command *cmd, cpu_type_t cputype);
+
+/* swap the fields shared by mach_header and mach_header_64 */
+void macho_swap_header(struct mach_header *hdr);
+
+/* swap symbol tables in place */
+void macho_swap_nlist(struct nlist *nlv, size_t nlc);
+void macho_swap_nlist_64(struct nlist_64 *nlv, size_t nlc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,512 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <mach-o/loader.h>
+
+#include "minimize.h"
+#include "core.h"
+#include "images.h"
+#include "macho.h"
+#include "util.h"
+
+/* thread state flavors, independent of the host architecture */
+enum {
+    CORE_X86_THREAD_STATE32 = 1,
+    CORE_X86_THREAD_STATE64 = 4,
+    CORE_ARM_THREAD_STATE32 = 1,
+    CORE_ARM_THREAD_STATE64 = 6,
+};
+
+#define CORE_PAGE_MASK (CORE_PAGE_SIZE - 1)
+
+/* set of page addresses; sorted and unique after pages_normalize() */
+struct pages {
+    size_t pagec;
+    size_t cap;
+    uint64_t *pagev;
+};
+
+static void pages_init(struct pages *pages) {
+    pages->pagec = 0;
+    pages->cap = 0;
+    pages->pagev = NULL;
+}
+
+static void pages_free(struct pages *pages) {
+    free(pages->pagev);
+    pages_init(pages);
+}
+
+static int pages_add(struct pages *pages, uint64_t page) {
+    if (pages->pagec == pages->cap) {
+        pages->cap = max(pages->cap * 2, 64);
+        if ((pages->pagev = reallocf(pages->pagev, sizeof(uint64_t) * pages->cap)) == NULL) {
+            errfn = "reallocf";
+            goto error;
+        }
+    }
+    pages->pagev[pages->pagec++] = page;
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int pages_cmp(const uint64_t *a, const uint64_t *b) {
+    return (*a > *b) - (*a < *b);
+}
+
+static void pages_normalize(struct pages *pages) {
+    qsort(pages->pagev, pages->pagec, sizeof(uint64_t), (int (*)(const void *, const void *)) &pages_cmp);
+    size_t j = 0;
+    for (size_t i = 0; i < pages->pagec; ++i) {
+        if (j == 0 || pages->pagev[j - 1] != pages->pagev[i]) {
+            pages->pagev[j++] = pages->pagev[i];
+        }
+    }
+    pages->pagec = j;
+}
+
+static bool pages_contains(const struct pages *pages, uint64_t page) {
+    return bsearch(&page, pages->pagev, pages->pagec, sizeof(uint64_t), (int (*)(const void *, const void *)) &pages_cmp) != NULL;
+}
+
+/* number of bytes of page backed by file data, or 0 */
+static uint64_t core_minimize_backed(const struct core *core, uint64_t page, const struct core_segment **segp) {
+    const struct core_segment *seg;
+    if ((seg = core_segment_find(core, page)) == NULL) {
+        return 0;
+    }
+    const uint64_t offset = page - seg->vmbase;
+    if (offset >= seg->filesize) {
+        return 0;
+    }
+    if (segp != NULL) {
+        *segp = seg;
+    }
+    return min(seg->filesize - offset, CORE_PAGE_SIZE);
+}
+
+static int core_minimize_add_range(const struct core *core, struct pages *pages, uint64_t vmbase, uint64_t vmsize) {
+    for (uint64_t page = vmbase & ~CORE_PAGE_MASK; page < vmbase + vmsize; page += CORE_PAGE_SIZE) {
+        if (core_minimize_backed(core, page, NULL) > 0) {
+            if (pages_add(pages, page) < 0) {
+                goto error;
+            }
+        }
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* treat value as a pointer; add its page if backed */
+static int core_minimize_add_pointer(const struct core *core, struct pages *pages, uint64_t value) {
+    const uint64_t page = value & ~CORE_PAGE_MASK;
+    if (core_minimize_backed(core, page, NULL) > 0) {
+        return pages_add(pages, page);
+    }
+    return 0;
+}
+
+static size_t core_minimize_word_size(const struct core *core) {
+    return core->fmt == CORE_MACHO64 ? sizeof(uint64_t) : sizeof(uint32_t);
+}
+
+/* word at p; swap is set for memory of an opposite-endian core, as opposed to its already swapped thread states */
+static uint64_t core_minimize_word(const struct core *core, const char *p, bool swap) {
+    if (core->fmt == CORE_MACHO64) {
+        uint64_t w;
+        memcpy(&w, p, sizeof(w));
+        return swap ? __builtin_bswap64(w) : w;
+    } else {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        return swap ? __builtin_bswap32(w) : w;
+    }
+}
+
+/* index of the stack pointer within a thread state, or -1 */
+static int core_minimize_sp_index(const struct core *core, uint32_t flavor) {
+    switch (core->cputype) {
+        case CPU_TYPE_X86_64:
+            return flavor == CORE_X86_THREAD_STATE64 ? 7 : -1;
+        case CPU_TYPE_I386:
+            return flavor == CORE_X86_THREAD_STATE32 ? 7 : -1;
+        case CPU_TYPE_ARM64:
+            return flavor == CORE_ARM_THREAD_STATE64 ? 31 : -1;
+        case CPU_TYPE_ARM:
+            return flavor == CORE_ARM_THREAD_STATE32 ? 13 : -1;
+        default:
+            return -1;
+    }
+}
+
+/* collect thread stacks into retain and register values into regs */
+static int core_minimize_threads(const struct core *core, int flags, struct pages *retain, struct pages *regs) {
+    const size_t wordsize = core_minimize_word_size(core);
+    
+    for (size_t i = 0; i < core->thrc; ++i) {
+        const struct thread_command *thr = core->thrv[i];
+        const char *it = (const char *) (thr + 1);
+        const char *end = (const char *) thr + thr->cmdsize;
+        
+        while (it + 2 * sizeof(uint32_t) <= end) {
+            uint32_t flavor, count;
+            memcpy(&flavor, it, sizeof(flavor));
+            memcpy(&count, it + sizeof(uint32_t), sizeof(count));
+            const char *state = it + 2 * sizeof(uint32_t);
+            const char *state_end = min(state + count * sizeof(uint32_t), end);
+            
+            const int sp_index = core_minimize_sp_index(core, flavor);
+            size_t index = 0;
+            for (const char *p = state; p + wordsize <= state_end; p += wordsize, ++index) {
+                const uint64_t value = core_minimize_word(core, p, false);
+                if (regs != NULL && core_minimize_add_pointer(core, regs, value) < 0) {
+                    goto error;
+                }
+                if ((flags & CORE_MINIMIZE_STACKS) && (int) index == sp_index) {
+                    const struct core_segment *seg;
+                    if ((seg = core_segment_find(core, value)) != NULL) {
+                        if (core_minimize_add_range(core, retain, value, seg->vmbase + seg->vmsize - value) < 0) {
+                            goto error;
+                        }
+                    }
+                }
+            }
+            
+            it = state_end;
+        }
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int core_minimize_images(const struct core *core, struct pages *retain) {
+    struct core_images imgs;
+    if (core_images_open(core, &imgs) < 0) {
+        goto error;
+    }
+    
+    for (size_t i = 0; i < imgs.imgc; ++i) {
+        const struct core_image *img = &imgs.imgv[i];
+        
+        /* header and load commands */
+        struct mach_header hdr;
+        fseek_chk(core->vm, img->seg->vmbase, SEEK_SET);
+        fread_one_chk(hdr, core->vm);
+        if (hdr.magic == MH_CIGAM || hdr.magic == MH_CIGAM_64) {
+            macho_swap_header(&hdr);
+        }
+        const uint64_t hdrsize = (hdr.magic == MH_MAGIC_64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header)) + hdr.sizeofcmds;
+        if (core_minimize_add_range(core, retain, img->seg->vmbase, hdrsize) < 0) {
+            goto error;
+        }
+        
+        /* symbol and string tables */
+        const struct core_segment *linkedit;
+        if ((linkedit = core_image_segment(img, SEG_LINKEDIT)) != NULL) {
+            if (core_minimize_add_range(core, retain, linkedit->vmbase + img->slide, linkedit->vmsize) < 0) {
+                goto error;
+            }
+        }
+    }
+    
+    core_images_close(&imgs);
+    return 0;
+    
+error:
+    core_images_close(&imgs);
+    return -1;
+}
+
+/* follow pointers out of frontier for the requested number of hops; register targets are reached by the first hop */
+static int core_minimize_hops(const struct core *core, unsigned hops, struct pages *retain, struct pages *frontier, const struct pages *regs) {
+    const size_t wordsize = core_minimize_word_size(core);
+    char *buf = NULL;
+    struct pages next;
+    pages_init(&next);
+    
+    malloc_chk(buf, CORE_PAGE_SIZE);
+    
+    for (size_t i = 0; hops > 0 && i < regs->pagec; ++i) {
+        if (pages_add(&next, regs->pagev[i]) < 0) {
+            goto error;
+        }
+    }
+    
+    for (unsigned hop = 0; hop < hops && (frontier->pagec > 0 || next.pagec > 0); ++hop) {
+        for (size_t i = 0; i < frontier->pagec; ++i) {
+            const uint64_t page = frontier->pagev[i];
+            const size_t size = core_minimize_backed(core, page, NULL);
+            fseek_chk(core->vm, page, SEEK_SET);
+            fread_chk(buf, size, core->vm);
+            for (size_t off = 0; off + wordsize <= size; off += wordsize) {
+                if (core_minimize_add_pointer(core, &next, core_minimize_word(core, buf + off, core->swap)) < 0) {
+                    goto error;
+                }
+            }
+        }
+        
+        /* keep only newly reached pages as the next frontier */
+        pages_normalize(&next);
+        frontier->pagec = 0;
+        for (size_t i = 0; i < next.pagec; ++i) {
+            if (!pages_contains(retain, next.pagev[i])) {
+                if (pages_add(frontier, next.pagev[i]) < 0) {
+                    goto error;
+                }
+            }
+        }
+        next.pagec = 0;
+        
+        for (size_t i = 0; i < frontier->pagec; ++i) {
+            if (pages_add(retain, frontier->pagev[i]) < 0) {
+                goto error;
+            }
+        }
+        pages_normalize(retain);
+    }
+    
+    free(buf);
+    pages_free(&next);
+    return 0;
+    
+error:
+    free(buf);
+    pages_free(&next);
+    return -1;
+}
+
+/* contiguous run of retained pages within one segment */
+struct core_minimize_piece {
+    const struct core_segment *seg;
+    uint64_t vmbase;
+    uint64_t size;
+    uint64_t fileoff;
+};
+
+static int core_minimize_write_segment(const struct core *core, const struct core_minimize_piece *piece, FILE *out) {
+    if (core->fmt == CORE_MACHO64) {
+        struct segment_command_64 seg = {0};
+        seg.cmd      = LC_SEGMENT_64;
+        seg.cmdsize  = sizeof(seg);
+        strncpy(seg.segname, piece->seg->name, sizeof(seg.segname));
+        seg.vmaddr   = piece->vmbase;
+        seg.vmsize   = piece->size;
+        seg.fileoff  = piece->fileoff;
+        seg.filesize = piece->size;
+        seg.maxprot  = piece->seg->prot;
+        seg.initprot = piece->seg->prot;
+        if (core->swap && macho_unswap_lc((struct load_command *) &seg, core->cputype) < 0) {
+            goto error;
+        }
+        fwrite_one_chk(seg, out);
+    } else {
+        struct segment_command seg = {0};
+        seg.cmd      = LC_SEGMENT;
+        seg.cmdsize  = sizeof(seg);
+        strncpy(seg.segname, piece->seg->name, sizeof(seg.segname));
+        seg.vmaddr   = piece->vmbase;
+        seg.vmsize   = piece->size;
+        seg.fileoff  = piece->fileoff;
+        seg.filesize = piece->size;
+        seg.maxprot  = piece->seg->prot;
+        seg.initprot = piece->seg->prot;
+        if (core->swap && macho_unswap_lc((struct load_command *) &seg, core->cputype) < 0) {
+            goto error;
+        }
+        fwrite_one_chk(seg, out);
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* thread commands go back out in the core's byte order */
+static int core_minimize_write_thread(const struct core *core, const struct thread_command *thr, FILE *out) {
+    struct load_command *cmd = NULL;
+    if (!core->swap) {
+        fwrite_chk((const char *) thr, thr->cmdsize, out);
+        return 0;
+    }
+    malloc_chk(cmd, thr->cmdsize);
+    memcpy(cmd, thr, thr->cmdsize);
+    if (macho_unswap_lc(cmd, core->cputype) < 0) {
+        goto error;
+    }
+    fwrite_chk((const char *) cmd, thr->cmdsize, out);
+    free(cmd);
+    return 0;
+    
+error:
+    free(cmd);
+    return -1;
+}
+
+static int core_minimize_pad(FILE *out, uint64_t from, uint64_t to) {
+    static const char zeros[256];
+    while (from < to) {
+        const size_t n = min(to - from, sizeof(zeros));
+        fwrite_chk(zeros, n, out);
+        from += n;
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int core_minimize_write(const struct core *core, const struct pages *retain, FILE *out) {
+    struct core_minimize_piece *piecev = NULL;
+    size_t piecec = 0;
+    char *buf = NULL;
+    
+    malloc_chk(piecev, sizeof(struct core_minimize_piece) * (retain->pagec + 1));
+    malloc_chk(buf, CORE_PAGE_SIZE);
+    
+    /* coalesce pages into pieces */
+    for (size_t i = 0; i < retain->pagec; ++i) {
+        const uint64_t page = retain->pagev[i];
+        const struct core_segment *seg;
+        const uint64_t size = core_minimize_backed(core, page, &seg);
+        struct core_minimize_piece *last = piecec > 0 ? &piecev[piecec - 1] : NULL;
+        if (last != NULL && last->seg == seg && last->vmbase + last->size == page) {
+            last->size += size;
+        } else {
+            struct core_minimize_piece *piece = &piecev[piecec++];
+            piece->seg = seg;
+            piece->vmbase = page;
+            piece->size = size;
+        }
+    }
+    
+    /* layout */
+    const size_t hdrsize = core->fmt == CORE_MACHO64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    const size_t segsize = core->fmt == CORE_MACHO64 ? sizeof(struct segment_command_64) : sizeof(struct segment_command);
+    uint64_t sizeofcmds = piecec * segsize;
+    for (size_t i = 0; i < core->thrc; ++i) {
+        sizeofcmds += core->thrv[i]->cmdsize;
+    }
+    const uint64_t dataoff = (hdrsize + sizeofcmds + CORE_PAGE_MASK) & ~CORE_PAGE_MASK;
+    uint64_t fileoff = dataoff;
+    for (size_t i = 0; i < piecec; ++i) {
+        piecev[i].fileoff = fileoff;
+        fileoff = (fileoff + piecev[i].size + CORE_PAGE_MASK) & ~CORE_PAGE_MASK;
+    }
+    
+    /* header */
+    struct mach_header_64 hdr = {0};
+    hdr.magic      = core->fmt == CORE_MACHO64 ? MH_MAGIC_64 : MH_MAGIC;
+    hdr.cputype    = core->cputype;
+    hdr.cpusubtype = core->cpusubtype;
+    hdr.filetype   = MH_CORE;
+    hdr.ncmds      = piecec + core->thrc;
+    hdr.sizeofcmds = sizeofcmds;
+    if (core->swap) {
+        macho_swap_header((struct mach_header *) &hdr);
+    }
+    fwrite_chk((const char *) &hdr, hdrsize, out);
+    
+    /* load commands */
+    for (size_t i = 0; i < piecec; ++i) {
+        if (core_minimize_write_segment(core, &piecev[i], out) < 0) {
+            goto error;
+        }
+    }
+    for (size_t i = 0; i < core->thrc; ++i) {
+        if (core_minimize_write_thread(core, core->thrv[i], out) < 0) {
+            goto error;
+        }
+    }
+    
+    /* data */
+    uint64_t pos = hdrsize + sizeofcmds;
+    for (size_t i = 0; i < piecec; ++i) {
+        const struct core_minimize_piece *piece = &piecev[i];
+        if (core_minimize_pad(out, pos, piece->fileoff) < 0) {
+            goto error;
+        }
+        pos = piece->fileoff;
+        fseek_chk(core->vm, piece->vmbase, SEEK_SET);
+        for (uint64_t rem = piece->size; rem > 0; ) {
+            const size_t n = min(rem, CORE_PAGE_SIZE);
+            fread_chk(buf, n, core->vm);
+            fwrite_chk(buf, n, out);
+            rem -= n;
+            pos += n;
+        }
+    }
+    
+    free(piecev);
+    free(buf);
+    return 0;
+    
+error:
+    free(piecev);
+    free(buf);
+    return -1;
+}
+
+int core_minimize(const struct core *core, const struct core_minimize_opts *opts, FILE *out) {
+    struct pages retain, frontier, regs;
+    pages_init(&retain);
+    pages_init(&frontier);
+    pages_init(&regs);
+    
+    if (core->fmt != CORE_MACHO32 && core->fmt != CORE_MACHO64) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    for (size_t i = 0; i < opts->rangec; ++i) {
+        if (core_minimize_add_range(core, &retain, opts->rangev[i].vmbase, opts->rangev[i].vmsize) < 0) {
+            goto error;
+        }
+    }
+    
+    if ((opts->flags & CORE_MINIMIZE_IMAGES)) {
+        if (core_minimize_images(core, &retain) < 0) {
+            goto error;
+        }
+    }
+    
+    /* stacks are retained outright and seed the pointer walk */
+    if (core_minimize_threads(core, opts->flags, &frontier, opts->hops > 0 ? &regs : NULL) < 0) {
+        goto error;
+    }
+    pages_normalize(&frontier);
+    for (size_t i = 0; i < frontier.pagec; ++i) {
+        if (pages_add(&retain, frontier.pagev[i]) < 0) {
+            goto error;
+        }
+    }
+    pages_normalize(&retain);
+    
+    if (core_minimize_hops(core, opts->hops, &retain, &frontier, &regs) < 0) {
+        goto error;
+    }
+    
+    if (core_minimize_write(core, &retain, out) < 0) {
+        goto error;
+    }
+    
+    pages_free(&retain);
+    pages_free(&frontier);
+    pages_free(&regs);
+    return 0;
+    
+error:
+    pages_free(&retain);
+    pages_free(&frontier);
+    pages_free(&regs);
+    return -1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct core;
+
+struct core_range {
+    uint64_t vmbase;
+    uint64_t vmsize;
+};
+
+enum core_minimize_flags {
+    CORE_MINIMIZE_STACKS = 1 << 0, // thread stacks, from each stack pointer to the end of its segment
+    CORE_MINIMIZE_IMAGES = 1 << 1, // image headers and __LINKEDIT, enough to symbolicate
+};
+
+struct core_minimize_opts {
+    int flags;
+    unsigned hops; // follow pointers from registers and retained stacks this many times
+    size_t rangec;
+    const struct core_range *rangev; // explicit VM ranges to retain
+};
+
+/* write a core containing only the selected pages of core to out (written sequentially), in core's byte order */
+int core_minimize(const struct core *core, const struct core_minimize_opts *opts, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "overlay.h"
+#include "test.h"
+
+/* a copy-on-write overlay reads through clean pages, keeps writes to itself, and round-trips its patches */
+
+#define TEST_PAGES 4
+#define TEST_FAR 0x7fff0000ULL // page far past the underlying stream, which reads as zeros
+
+static uint8_t test_byte(uint64_t vmaddr) {
+    return (vmaddr * 7 + (vmaddr >> CORE_PAGE_SHIFT)) & 0xff;
+}
+
+/* underlying stream of TEST_PAGES pages of a position-dependent pattern */
+static FILE *test_vm(void) {
+    FILE *vm;
+    test_check((vm = tmpfile()) != NULL);
+    for (uint64_t vmaddr = 0; vmaddr < TEST_PAGES * CORE_PAGE_SIZE; ++vmaddr) {
+        test_check(fputc(test_byte(vmaddr), vm) != EOF);
+    }
+    test_check(fflush(vm) == 0);
+    return vm;
+}
+
+static void test_pread(FILE *f, void *buf, size_t len, uint64_t vmaddr) {
+    test_check(fseek(f, vmaddr, SEEK_SET) == 0);
+    test_check(fread(buf, 1, len, f) == len);
+}
+
+static void test_pwrite(FILE *f, const void *buf, size_t len, uint64_t vmaddr) {
+    test_check(fseek(f, vmaddr, SEEK_SET) == 0);
+    test_check(fwrite(buf, 1, len, f) == len);
+    test_check(fflush(f) == 0);
+}
+
+/* the overlay's view of [vmaddr, vmaddr + len) is the pattern, except for patch at patchaddr */
+static void test_expect(FILE *f, uint64_t vmaddr, size_t len, const char *patch, uint64_t patchaddr) {
+    uint8_t buf[3 * CORE_PAGE_SIZE];
+    test_check(len <= sizeof(buf));
+    test_pread(f, buf, len, vmaddr);
+    for (size_t i = 0; i < len; ++i) {
+        const uint64_t addr = vmaddr + i;
+        uint8_t want = addr < TEST_PAGES * CORE_PAGE_SIZE ? test_byte(addr) : 0;
+        if (patch != NULL && addr >= patchaddr && addr < patchaddr + strlen(patch)) {
+            want = patch[addr - patchaddr];
+        }
+        test_check(buf[i] == want);
+    }
+}
+
+static void test_overlay(FILE *side) {
+    FILE *vm = test_vm();
+    struct overlay ov;
+    test_check(overlay_open(vm, side, &ov) == 0);
+    
+    /* clean pages read through, including a read across a page boundary */
+    test_expect(ov.f, 0, 2 * CORE_PAGE_SIZE, NULL, 0);
+    test_expect(ov.f, CORE_PAGE_SIZE - 5, 10, NULL, 0);
+    test_check(ov.pagec == 0);
+    
+    /* a write dirties its page only; the underlying stream is left alone */
+    const char *patch = "patched";
+    const uint64_t addr = 2 * CORE_PAGE_SIZE + 100;
+    test_pwrite(ov.f, patch, strlen(patch), addr);
+    test_check(ov.pagec == 1 && ov.pagev[0].vmaddr == 2 * CORE_PAGE_SIZE);
+    test_expect(ov.f, CORE_PAGE_SIZE, 3 * CORE_PAGE_SIZE, patch, addr);
+    test_expect(vm, addr, strlen(patch), NULL, 0);
+    
+    /* a write straddling a page boundary dirties both pages */
+    const char *straddle = "straddle";
+    const uint64_t saddr = CORE_PAGE_SIZE - 3;
+    test_pwrite(ov.f, straddle, strlen(straddle), saddr);
+    test_check(ov.pagec == 3 && ov.pagev[0].vmaddr == 0 && ov.pagev[1].vmaddr == CORE_PAGE_SIZE);
+    test_expect(ov.f, 0, 2 * CORE_PAGE_SIZE, straddle, saddr);
+    test_expect(ov.f, 2 * CORE_PAGE_SIZE, CORE_PAGE_SIZE, patch, addr);
+    
+    /* a page far past the underlying stream starts out as zeros */
+    test_pwrite(ov.f, patch, strlen(patch), TEST_FAR + 8);
+    test_check(ov.pagec == 4);
+    test_expect(ov.f, TEST_FAR, CORE_PAGE_SIZE, patch, TEST_FAR + 8);
+    
+    /* the side file holds just the dirty pages, back to back */
+    if (side != NULL) {
+        struct stat st;
+        test_check(fflush(side) == 0 && fstat(fileno(side), &st) == 0);
+        test_check((uint64_t) st.st_size == ov.pagec * CORE_PAGE_SIZE);
+        for (size_t i = 0; i < ov.pagec; ++i) {
+            test_check(ov.pagev[i].data == NULL && ov.pagev[i].slot < ov.pagec * CORE_PAGE_SIZE);
+        }
+    }
+    
+    /* export, drop everything, and bring the patches back */
+    FILE *saved;
+    test_check((saved = tmpfile()) != NULL);
+    test_check(overlay_export(&ov, saved) == 0);
+    test_check(overlay_discard(&ov) == 0);
+    test_check(ov.pagec == 0);
+    test_expect(ov.f, 0, 3 * CORE_PAGE_SIZE, NULL, 0);
+    char c;
+    test_check(fseek(ov.f, TEST_FAR, SEEK_SET) == 0 && fread(&c, 1, 1, ov.f) == 0); // past the underlying stream again
+    clearerr(ov.f);
+    
+    rewind(saved);
+    test_check(overlay_import(&ov, saved) == 0);
+    test_check(ov.pagec == 4);
+    test_expect(ov.f, 0, 2 * CORE_PAGE_SIZE, straddle, saddr);
+    test_expect(ov.f, 2 * CORE_PAGE_SIZE, CORE_PAGE_SIZE, patch, addr);
+    test_expect(ov.f, TEST_FAR, CORE_PAGE_SIZE, patch, TEST_FAR + 8);
+    
+    /* a file that isn't an export is rejected */
+    rewind(saved);
+    test_check(fputc('x', saved) != EOF && fflush(saved) == 0);
+    rewind(saved);
+    errno = 0;
+    test_check(overlay_import(&ov, saved) == -1 && errno == EINVAL);
+    fclose(saved);
+    
+    overlay_close(&ov);
+    test_expect(vm, 0, 3 * CORE_PAGE_SIZE, NULL, 0);
+    fclose(vm);
+}
+
+int main(void) {
+    test_overlay(NULL);
+    
+    FILE *side;
+    test_check((side = tmpfile()) != NULL);
+    test_overlay(side);
+    fclose(side);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,376 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "overlay.h"
+#include "core.h"
+#include "util.h"
+
+#define OVERLAY_MAGIC 0x796c766f // 'ovly'
+
+struct overlay_header {
+    uint32_t magic;
+    uint32_t pagesize;
+    uint64_t pagec;
+};
+
+/* index of the first dirty page at or after vmaddr */
+static size_t overlay_search(const struct overlay *ov, uint64_t vmaddr) {
+    size_t lo = 0, hi = ov->pagec;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (ov->pagev[mid].vmaddr < vmaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static struct overlay_page *overlay_find(const struct overlay *ov, uint64_t pagebase) {
+    const size_t i = overlay_search(ov, pagebase);
+    if (i < ov->pagec && ov->pagev[i].vmaddr == pagebase) {
+        return &ov->pagev[i];
+    }
+    return NULL;
+}
+
+static int overlay_page_read(const struct overlay *ov, const struct overlay_page *page, void *buf, size_t off, size_t len) {
+    if (page->data != NULL) {
+        memcpy(buf, page->data + off, len);
+        return 0;
+    }
+    fseek_chk(ov->side, page->slot + off, SEEK_SET);
+    fread_chk((uint8_t *) buf, len, ov->side);
+    return 0;
+    
+error:
+    return -1;
+}
+
+static int overlay_page_write(struct overlay *ov, struct overlay_page *page, const void *buf, size_t off, size_t len) {
+    if (page->data != NULL) {
+        memcpy(page->data + off, buf, len);
+        return 0;
+    }
+    fseek_chk(ov->side, page->slot + off, SEEK_SET);
+    fwrite_chk((const uint8_t *) buf, len, ov->side);
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* read a page of the underlying stream; bytes it can't supply read as zero */
+static int overlay_original(struct overlay *ov, uint64_t pagebase, uint8_t *buf) {
+    memset(buf, 0, CORE_PAGE_SIZE);
+    fseek_chk(ov->vm, pagebase, SEEK_SET);
+    if (fread(buf, 1, CORE_PAGE_SIZE, ov->vm) < CORE_PAGE_SIZE) {
+        if (ferror(ov->vm)) {
+            clearerr(ov->vm);
+            errfn = "fread";
+            goto error;
+        }
+        clearerr(ov->vm);
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* dirty page at pagebase, created on first write; fill copies in the original contents */
+static struct overlay_page *overlay_dirty(struct overlay *ov, uint64_t pagebase, bool fill) {
+    uint8_t *data = NULL;
+    
+    const size_t i = overlay_search(ov, pagebase);
+    if (i < ov->pagec && ov->pagev[i].vmaddr == pagebase) {
+        return &ov->pagev[i];
+    }
+    
+    if (ov->pagec == ov->pagecap) {
+        ov->pagecap = max(ov->pagecap * 2, 16);
+        struct overlay_page *pagev;
+        if ((pagev = realloc(ov->pagev, sizeof(struct overlay_page) * ov->pagecap)) == NULL) {
+            errfn = "realloc";
+            goto error;
+        }
+        ov->pagev = pagev;
+    }
+    
+    malloc_chk(data, CORE_PAGE_SIZE);
+    if (fill) {
+        if (overlay_original(ov, pagebase, data) < 0) {
+            goto error;
+        }
+    } else {
+        memset(data, 0, CORE_PAGE_SIZE);
+    }
+    /* pages are only dropped all at once, so the side file fills up densely in creation order */
+    const uint64_t slot = ov->pagec * CORE_PAGE_SIZE;
+    if (ov->side != NULL) {
+        fseek_chk(ov->side, slot, SEEK_SET);
+        fwrite_chk(data, CORE_PAGE_SIZE, ov->side);
+        free(data);
+        data = NULL;
+    }
+    
+    memmove(&ov->pagev[i + 1], &ov->pagev[i], sizeof(struct overlay_page) * (ov->pagec - i));
+    ov->pagev[i].vmaddr = pagebase;
+    ov->pagev[i].slot = slot;
+    ov->pagev[i].data = data;
+    ++ov->pagec;
+    return &ov->pagev[i];
+    
+error:
+    free(data);
+    return NULL;
+}
+
+static int overlay_read(struct overlay *ov, char *buf, int size) {
+    int total = 0;
+    while (total < size) {
+        const uint64_t pagebase = ov->pos & ~(CORE_PAGE_SIZE - 1);
+        const size_t off = ov->pos - pagebase;
+        const size_t len = min(CORE_PAGE_SIZE - off, (size_t) (size - total));
+        
+        const struct overlay_page *page;
+        if ((page = overlay_find(ov, pagebase)) != NULL) {
+            if (overlay_page_read(ov, page, buf + total, off, len) < 0) {
+                goto error;
+            }
+        } else {
+            fseek_chk(ov->vm, ov->pos, SEEK_SET);
+            const size_t bytes_read = fread(buf + total, 1, len, ov->vm);
+            if (bytes_read < len) {
+                if (ferror(ov->vm)) {
+                    clearerr(ov->vm);
+                    errfn = "fread";
+                    goto error;
+                }
+                clearerr(ov->vm);
+                ov->pos += bytes_read;
+                total += bytes_read;
+                break; // end of mapped memory
+            }
+        }
+        
+        ov->pos += len;
+        total += len;
+    }
+    
+    return total;
+    
+error:
+    return -1;
+}
+
+static int overlay_write(struct overlay *ov, const char *buf, int size) {
+    int total = 0;
+    while (total < size) {
+        const uint64_t pagebase = ov->pos & ~(CORE_PAGE_SIZE - 1);
+        const size_t off = ov->pos - pagebase;
+        const size_t len = min(CORE_PAGE_SIZE - off, (size_t) (size - total));
+        
+        struct overlay_page *page;
+        if ((page = overlay_dirty(ov, pagebase, true)) == NULL ||
+            overlay_page_write(ov, page, buf + total, off, len) < 0) {
+            goto error;
+        }
+        
+        ov->pos += len;
+        total += len;
+    }
+    
+    return total;
+    
+error:
+    return -1;
+}
+
+static fpos_t overlay_seek(struct overlay *ov, fpos_t pos, int whence) {
+    switch (whence) {
+        case SEEK_SET:
+            ov->pos = pos;
+            break;
+            
+        case SEEK_CUR:
+            ov->pos += pos;
+            break;
+            
+        case SEEK_END:
+        default:
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            goto error;
+    }
+    
+    return ov->pos;
+    
+error:
+    return -1;
+}
+
+static int overlay_fclose(struct overlay *ov) {
+    return 0; // ov is owned by the caller
+}
+
+static void overlay_free_pages(struct overlay *ov) {
+    for (size_t i = 0; i < ov->pagec; ++i) {
+        free(ov->pagev[i].data);
+    }
+    ov->pagec = 0;
+}
+
+int overlay_open(FILE *vm, FILE *side, struct overlay *ov) {
+    ov->vm = vm;
+    ov->side = side;
+    ov->pos = 0;
+    ov->pagec = 0;
+    ov->pagecap = 0;
+    ov->pagev = NULL;
+    
+    if ((ov->f = funopen(ov, (int (*)(void *, char *, int)) &overlay_read, (int (*)(void *, const char *, int)) &overlay_write,
+                         (fpos_t (*)(void *, fpos_t, int)) &overlay_seek, (int (*)(void *)) &overlay_fclose)) == NULL) {
+        errfn = "funopen";
+        goto error;
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+void overlay_close(struct overlay *ov) {
+    if (ov->f != NULL) {
+        fclose(ov->f);
+        ov->f = NULL;
+    }
+    overlay_free_pages(ov);
+    free(ov->pagev);
+    ov->pagev = NULL;
+    ov->pagecap = 0;
+}
+
+/* push buffered writes into the dirty pages and remember the stream position */
+static int overlay_sync(struct overlay *ov, long *posp) {
+    ftell_chk(*posp, ov->f);
+    if (fflush(ov->f) < 0) {
+        errfn = "fflush";
+        goto error;
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* reposition the stream so that nothing stale stays in its read buffer */
+static int overlay_resync(struct overlay *ov, long pos) {
+    fseek_chk(ov->f, pos, SEEK_SET);
+    return 0;
+    
+error:
+    return -1;
+}
+
+int overlay_discard(struct overlay *ov) {
+    long pos;
+    if (overlay_sync(ov, &pos) < 0) {
+        goto error;
+    }
+    overlay_free_pages(ov);
+    if (ov->side != NULL) {
+        if (fflush(ov->side) < 0) {
+            errfn = "fflush";
+            goto error;
+        }
+        if (ftruncate(fileno(ov->side), 0) < 0) {
+            errfn = "ftruncate";
+            goto error;
+        }
+    }
+    return overlay_resync(ov, pos);
+    
+error:
+    return -1;
+}
+
+int overlay_export(struct overlay *ov, FILE *f) {
+    uint8_t *buf = NULL;
+    
+    long pos;
+    if (overlay_sync(ov, &pos) < 0) {
+        goto error;
+    }
+    
+    struct overlay_header hdr;
+    hdr.magic = OVERLAY_MAGIC;
+    hdr.pagesize = CORE_PAGE_SIZE;
+    hdr.pagec = ov->pagec;
+    fwrite_one_chk(hdr, f);
+    
+    malloc_chk(buf, CORE_PAGE_SIZE);
+    for (size_t i = 0; i < ov->pagec; ++i) {
+        const struct overlay_page *page = &ov->pagev[i];
+        if (overlay_page_read(ov, page, buf, 0, CORE_PAGE_SIZE) < 0) {
+            goto error;
+        }
+        fwrite_one_chk(page->vmaddr, f);
+        fwrite_chk(buf, CORE_PAGE_SIZE, f);
+    }
+    
+    free(buf);
+    return overlay_resync(ov, pos);
+    
+error:
+    free(buf);
+    return -1;
+}
+
+int overlay_import(struct overlay *ov, FILE *f) {
+    uint8_t *buf = NULL;
+    
+    long pos;
+    if (overlay_sync(ov, &pos) < 0) {
+        goto error;
+    }
+    
+    struct overlay_header hdr;
+    fread_one_chk(hdr, f);
+    if (hdr.magic != OVERLAY_MAGIC || hdr.pagesize != CORE_PAGE_SIZE) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    malloc_chk(buf, CORE_PAGE_SIZE);
+    for (uint64_t i = 0; i < hdr.pagec; ++i) {
+        uint64_t vmaddr;
+        fread_one_chk(vmaddr, f);
+        fread_chk(buf, CORE_PAGE_SIZE, f);
+        if ((vmaddr & (CORE_PAGE_SIZE - 1)) != 0) {
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            goto error;
+        }
+        
+        /* the saved page replaces the whole page, so its original contents aren't needed */
+        struct overlay_page *page;
+        if ((page = overlay_dirty(ov, vmaddr, false)) == NULL ||
+            overlay_page_write(ov, page, buf, 0, CORE_PAGE_SIZE) < 0) {
+            goto error;
+        }
+    }
+    
+    free(buf);
+    return overlay_resync(ov, pos);
+    
+error:
+    free(buf);
+    return -1;
+}
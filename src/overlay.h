@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* copy-on-write view of a VM stream: writes go to page-granular dirty pages and never reach the
+ * underlying stream; reads see the patched view */
+
+struct overlay_page {
+    uint64_t vmaddr;
+    uint64_t slot; // offset in the side file, which holds dirty pages back to back in the order they were made
+    uint8_t *data; // NULL when the page lives in the side file
+};
+
+struct overlay {
+    FILE *vm;   // underlying stream; only read
+    FILE *side; // side file holding dirty pages, or NULL to keep them in memory
+    uint64_t pos;
+    size_t pagec;
+    size_t pagecap;
+    struct overlay_page *pagev; // sorted by vmaddr
+    FILE *f;    // patched view
+};
+
+/* ov must not move while open, since ov->f refers to it */
+int overlay_open(FILE *vm, FILE *side, struct overlay *ov);
+void overlay_close(struct overlay *ov); // closes f; vm and side stay open
+
+/* drop every patch */
+int overlay_discard(struct overlay *ov);
+
+/* save dirty pages to f, or apply pages saved by overlay_export on top of the current ones */
+int overlay_export(struct overlay *ov, FILE *f);
+int overlay_import(struct overlay *ov, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
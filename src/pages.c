@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pages.h"
+#include "util.h"
+
+struct pages_pool {
+    uint64_t unitc;
+    size_t bufsize;
+    pages_fn *fn;
+    void *ctx;
+    atomic_uint_fast64_t next;
+    atomic_bool stop;
+    atomic_int failed; // slot of the first worker to fail, or -1
+};
+
+/* errfn is thread-local, so a worker's failure is handed back to the joining thread through its slot */
+struct pages_slot {
+    struct pages_pool *pool;
+    int index;
+    int err;
+    const char *errfn;
+};
+
+/* four independent multiply-xorshift lanes, folded at the end */
+uint64_t pages_hash(const uint64_t *words, size_t wordc) {
+    uint64_t h[4] = {0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0x2545f4914f6cdd1dULL};
+    for (size_t i = 0; i < wordc; i += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            h[k] = (h[k] ^ words[i + k]) * 0xff51afd7ed558ccdULL;
+            h[k] ^= h[k] >> 29;
+        }
+    }
+    uint64_t res = h[0] ^ (h[1] * 3) ^ (h[2] * 5) ^ (h[3] * 7);
+    return res != 0 ? res : 1;
+}
+
+static void pages_fail(struct pages_slot *slot, int err) {
+    slot->err = err != 0 ? err : EIO;
+    slot->errfn = errfn != NULL ? errfn : "pages_worker";
+    int none = -1;
+    atomic_compare_exchange_strong(&slot->pool->failed, &none, slot->index);
+    atomic_store(&slot->pool->stop, true);
+}
+
+static void *pages_worker(struct pages_slot *slot) {
+    struct pages_pool *pool = slot->pool;
+    void *buf;
+    if ((buf = calloc(1, pool->bufsize)) == NULL) {
+        errfn = "calloc";
+        pages_fail(slot, ENOMEM);
+        return NULL;
+    }
+    
+    uint64_t unit;
+    while (!atomic_load(&pool->stop) && (unit = atomic_fetch_add(&pool->next, 1)) < pool->unitc) {
+        const int res = pool->fn(pool->ctx, unit, buf);
+        if (res < 0) {
+            pages_fail(slot, errno);
+        } else if (res != 0) {
+            atomic_store(&pool->stop, true);
+        }
+    }
+    
+    free(buf);
+    return NULL;
+}
+
+int pages_parallel(uint64_t unitc, unsigned nthreads, size_t bufsize, pages_fn *fn, void *ctx) {
+    struct pages_pool pool;
+    pthread_t *threadv = NULL;
+    struct pages_slot *slotv = NULL;
+    unsigned threadc = 0;
+    int err = 0;
+    
+    pool.unitc = unitc;
+    pool.bufsize = max(bufsize, 1);
+    pool.fn = fn;
+    pool.ctx = ctx;
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.stop, false);
+    atomic_init(&pool.failed, -1);
+    
+    if (nthreads == 0) {
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = ncpu > 0 ? ncpu : 1;
+    }
+    nthreads = min(nthreads, max(unitc, 1));
+    if ((threadv = calloc(nthreads, sizeof(pthread_t))) == NULL ||
+        (slotv = calloc(nthreads, sizeof(struct pages_slot))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    for (; threadc < nthreads; ++threadc) {
+        slotv[threadc].pool = &pool;
+        slotv[threadc].index = threadc;
+        if ((err = pthread_create(&threadv[threadc], NULL, (void *(*)(void *)) &pages_worker, &slotv[threadc])) != 0) {
+            errfn = "pthread_create";
+            atomic_store(&pool.stop, true);
+            break;
+        }
+    }
+    for (unsigned i = 0; i < threadc; ++i) {
+        pthread_join(threadv[i], NULL);
+    }
+    
+    const int failed = atomic_load(&pool.failed);
+    if (failed >= 0) {
+        err = slotv[failed].err;
+        errfn = slotv[failed].errfn;
+    }
+    if (err != 0) {
+        errno = err;
+        goto error;
+    }
+    
+    free(slotv);
+    free(threadv);
+    return 0;
+    
+error:
+    free(slotv);
+    free(threadv);
+    return -1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* page hashing and the worker pool shared by the whole-core scans (summary, diff, strings) */
+
+/* hash of a page's words, wordc a multiple of 4; never 0, so callers may use 0 as a marker */
+uint64_t pages_hash(const uint64_t *words, size_t wordc);
+
+/* handle one unit of work with this thread's scratch buffer; return 0 to go on, nonzero to stop the pool,
+ * negative with errno set on failure */
+typedef int pages_fn(void *ctx, uint64_t unit, void *buf);
+
+/* hand out units [0, unitc) to nthreads threads (0 means one per online CPU), each with a zeroed scratch buffer
+ * of bufsize bytes; returns -1 with errno and errfn from the first failing unit, 0 otherwise */
+int pages_parallel(uint64_t unitc, unsigned nthreads, size_t bufsize, pages_fn *fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
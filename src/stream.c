@@ -0,0 +1,231 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include <mach-o/loader.h>
+
+#include "stream.h"
+#include "util.h"
+
+#define CORE_STREAM_CHUNK (1 << 20)
+
+static void core_stream_init(struct core_stream *cs, FILE *in, FILE *spool) {
+    cs->in      = in;
+    cs->spool   = spool;
+    cs->pos     = 0;
+    cs->segi    = 0;
+    cs->order   = NULL;
+    cs->spooled = NULL;
+    cs->buf     = NULL;
+    cs->want    = NULL;
+    cs->ready   = NULL;
+    cs->ctx     = NULL;
+    cs->core.f  = NULL;
+}
+
+static int core_stream_order_cmp(const struct core_segment **a, const struct core_segment **b) {
+    return ((*a)->filebase > (*b)->filebase) - ((*a)->filebase < (*b)->filebase);
+}
+
+int core_stream_open(FILE *in, FILE *spool, struct core_stream *cs, core_stream_want_fn *want, core_stream_ready_fn *ready, void *ctx) {
+    char *cmds = NULL;
+    
+    core_stream_init(cs, in, spool);
+    if (spool == NULL && (cs->spool = spool = tmpfile()) == NULL) {
+        errfn = "tmpfile";
+        goto error;
+    }
+    cs->want  = want;
+    cs->ready = ready;
+    cs->ctx   = ctx;
+    
+    /* header, read strictly forward */
+    struct mach_header_64 hdr;
+    fread_one_chk(hdr.magic, in);
+    size_t hdrsize;
+    if (hdr.magic == MH_MAGIC_64 || hdr.magic == MH_CIGAM_64) {
+        hdrsize = sizeof(struct mach_header_64);
+    } else if (hdr.magic == MH_MAGIC || hdr.magic == MH_CIGAM) {
+        hdrsize = sizeof(struct mach_header);
+    } else {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    char *rest = (char *) &hdr + sizeof(hdr.magic);
+    fread_chk(rest, hdrsize - sizeof(hdr.magic), in);
+    
+    /* the spool keeps the original byte order; core_open swaps */
+    const uint32_t sizeofcmds = hdr.magic == MH_CIGAM || hdr.magic == MH_CIGAM_64 ? __builtin_bswap32(hdr.sizeofcmds) : hdr.sizeofcmds;
+    malloc_chk(cmds, sizeofcmds);
+    fread_chk(cmds, sizeofcmds, in);
+    cs->pos = hdrsize + sizeofcmds;
+    
+    fwrite_chk((char *) &hdr, hdrsize, spool);
+    fwrite_chk(cmds, sizeofcmds, spool);
+    if (fflush(spool) < 0) {
+        errfn = "fflush";
+        goto error;
+    }
+    free(cmds);
+    cmds = NULL;
+    
+    if (core_open(spool, &cs->core, NULL) < 0) {
+        goto error;
+    }
+    
+    /* data arrives in file order */
+    const size_t segc = cs->core.segc;
+    if ((cs->order = calloc(segc, sizeof(struct core_segment *))) == NULL ||
+        (cs->spooled = calloc(segc, sizeof(bool))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    for (size_t i = 0; i < segc; ++i) {
+        cs->order[i] = &cs->core.segv[i];
+        cs->spooled[i] = want == NULL || want(&cs->core.segv[i], ctx);
+    }
+    qsort(cs->order, segc, sizeof(struct core_segment *), (int (*)(const void *, const void *)) &core_stream_order_cmp);
+    
+    malloc_chk(cs->buf, CORE_STREAM_CHUNK);
+    
+    return 0;
+    
+error:
+    free(cmds);
+    core_stream_close(cs);
+    return -1;
+}
+
+void core_stream_close(struct core_stream *cs) {
+    if (cs->core.f != NULL) {
+        core_close(&cs->core); // closes spool
+    } else if (cs->spool != NULL) {
+        fclose(cs->spool);
+    }
+    free(cs->order);
+    free(cs->spooled);
+    free(cs->buf);
+    core_stream_init(cs, NULL, NULL);
+}
+
+/* consume and discard input up to offset */
+static int core_stream_skip(struct core_stream *cs, uint64_t offset) {
+    while (cs->pos < offset) {
+        const size_t n = min(offset - cs->pos, CORE_STREAM_CHUNK);
+        const size_t bytes_read = fread(cs->buf, 1, n, cs->in);
+        cs->pos += bytes_read;
+        if (bytes_read < n) {
+            if (ferror(cs->in)) {
+                errfn = "fread";
+                return -1;
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int core_stream_step(struct core_stream *cs) {
+    /* skip segments already behind us (overlapping or empty) */
+    while (cs->segi < cs->core.segc &&
+           cs->order[cs->segi]->filebase + cs->order[cs->segi]->filesize <= cs->pos) {
+        ++cs->segi;
+    }
+    if (cs->segi == cs->core.segc) {
+        return 0;
+    }
+    
+    const struct core_segment *seg = cs->order[cs->segi];
+    int res;
+    if ((res = core_stream_skip(cs, seg->filebase)) <= 0) {
+        return res;
+    }
+    
+    const uint64_t end = seg->filebase + seg->filesize;
+    const size_t n = min(end - cs->pos, CORE_STREAM_CHUNK);
+    const size_t bytes_read = fread(cs->buf, 1, n, cs->in);
+    if (bytes_read < n && ferror(cs->in)) {
+        errfn = "fread";
+        goto error;
+    }
+    
+    if (cs->spooled[seg - cs->core.segv] && bytes_read > 0) {
+        fseek_chk(cs->spool, cs->pos, SEEK_SET);
+        fwrite_chk(cs->buf, bytes_read, cs->spool);
+    }
+    cs->pos += bytes_read;
+    if (bytes_read < n) {
+        return 0; // truncated input
+    }
+    
+    if (cs->pos == end) {
+        ++cs->segi;
+        if (cs->spooled[seg - cs->core.segv] && cs->ready != NULL) {
+            if (fflush(cs->spool) < 0) {
+                errfn = "fflush";
+                goto error;
+            }
+            if (cs->ready(cs, seg, cs->ctx) < 0) {
+                goto error;
+            }
+        }
+    }
+    
+    return 1;
+    
+error:
+    return -1;
+}
+
+/* grow the spool to cover every segment, so that segments not spooled past its end read as zeros too */
+static int core_stream_extend(struct core_stream *cs) {
+    uint64_t size = 0;
+    for (size_t i = 0; i < cs->core.segc; ++i) {
+        size = max(size, cs->core.segv[i].filebase + cs->core.segv[i].filesize);
+    }
+    
+    fseek_chk(cs->spool, 0, SEEK_END);
+    off_t end;
+    if ((end = ftello(cs->spool)) < 0) {
+        errfn = "ftello";
+        goto error;
+    }
+    if ((uint64_t) end < size) {
+        /* writing the last byte leaves a hole before it */
+        fseek_chk(cs->spool, size - 1, SEEK_SET);
+        if (fputc(0, cs->spool) == EOF || fflush(cs->spool) < 0) {
+            errfn = "fputc";
+            goto error;
+        }
+    }
+    return 0;
+    
+error:
+    return -1;
+}
+
+int core_stream_finish(struct core_stream *cs) {
+    int res;
+    while ((res = core_stream_step(cs)) > 0) {}
+    if (res == 0 && fflush(cs->spool) < 0) {
+        errfn = "fflush";
+        return -1;
+    }
+    if (res == 0 && core_stream_extend(cs) < 0) {
+        return -1;
+    }
+    return res;
+}
+
+bool core_stream_received(const struct core_stream *cs, uint64_t vmaddr, size_t len) {
+    const struct core_segment *seg;
+    if ((seg = core_segment_find(&cs->core, vmaddr)) == NULL || !cs->spooled[seg - cs->core.segv]) {
+        return false;
+    }
+    const uint64_t offset = vmaddr - seg->vmbase;
+    if (offset + len > seg->filesize) {
+        return false;
+    }
+    return seg->filebase + offset + len <= cs->pos;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* forward-only ingestion of a core from a pipe or socket. Segment data is
+ * spooled into a sparse file with the core's own layout, so core opens over it
+ * as soon as the load commands arrive; once core_stream_finish returns, segments
+ * that aren't wanted read as zeros. */
+
+struct core_stream;
+
+typedef bool core_stream_want_fn(const struct core_segment *seg, void *ctx);                    // spool this segment?
+typedef int core_stream_ready_fn(struct core_stream *cs, const struct core_segment *seg, void *ctx); // segment fully received
+
+struct core_stream {
+    FILE *in;
+    FILE *spool;
+    uint64_t pos;      // bytes consumed from in
+    struct core core;  // opened over spool; refers back to this struct, so don't move it
+    size_t segi;       // next segment in file order
+    const struct core_segment **order; // segments sorted by filebase
+    bool *spooled;     // indexed like core.segv
+    char *buf;
+    core_stream_want_fn *want;   // NULL spools everything
+    core_stream_ready_fn *ready; // may be NULL
+    void *ctx;
+};
+
+/* reads header and load commands from in; spool may be NULL for a tmpfile(3) */
+int core_stream_open(FILE *in, FILE *spool, struct core_stream *cs, core_stream_want_fn *want, core_stream_ready_fn *ready, void *ctx);
+
+/* receive the next chunk; returns 1 on progress, 0 once input is exhausted */
+int core_stream_step(struct core_stream *cs);
+
+/* receive everything that remains, then size the spool to the whole core */
+int core_stream_finish(struct core_stream *cs);
+
+/* whether [vmaddr, vmaddr + len) has been received and spooled */
+bool core_stream_received(const struct core_stream *cs, uint64_t vmaddr, size_t len);
+
+void core_stream_close(struct core_stream *cs); // closes core and spool, not in
+
+#ifdef __cplusplus
+}
+#endif
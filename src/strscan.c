@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "strscan.h"
+#include "pages.h"
+#include "util.h"
+
+#define STRSCAN_BLOCK 64              // bytes classified per bitmask
+#define STRSCAN_CHUNK (1 << 20)       // bytes read per pass over a segment
+#define STRSCAN_MAXLEN 4096           // longer runs are reported in pieces
+
+/* a run of printable characters, possibly continuing across blocks and chunks */
+struct strscan_run {
+    uint64_t vmaddr; // of the first buffered character
+    size_t len;
+    bool cont;       // an earlier piece of this run was already reported
+    char buf[STRSCAN_MAXLEN + 1];
+};
+
+struct strscan_job {
+    const struct core *core;
+    int encodings;
+    size_t minlen;
+    core_strings_fn *fn;
+    void *ctx;
+    pthread_mutex_t lock;
+    atomic_bool stop;
+};
+
+/* per-thread state: the runs in progress for ASCII and both UTF-16 phases, and a chunk with read-ahead */
+struct strscan_scratch {
+    struct strscan_run runv[3];
+    uint8_t buf[STRSCAN_CHUNK + 2 * STRSCAN_BLOCK];
+};
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+static inline uint64_t strscan_movemask(uint8x16_t v) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bits = vandq_u8(v, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(bits)) | (uint64_t) vaddv_u8(vget_high_u8(bits)) << 8;
+}
+#endif
+
+/* bit i of *printable is set if p[i] is printable ASCII or a tab; bit i of *zero if p[i] is NUL */
+static inline void strscan_classify(const uint8_t *p, uint64_t *printable, uint64_t *zero) {
+    uint64_t pr = 0, z = 0;
+#if defined(__SSE2__)
+    const __m128i lo = _mm_set1_epi8(0x1f), hi = _mm_set1_epi8(0x7f), tab = _mm_set1_epi8('\t'), nul = _mm_setzero_si128();
+    for (unsigned i = 0; i < STRSCAN_BLOCK; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        /* signed compares: bytes >= 0x80 are negative and fail the lower bound */
+        const __m128i print = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)), _mm_cmpeq_epi8(v, tab));
+        pr |= (uint64_t) (uint16_t) _mm_movemask_epi8(print) << i;
+        z  |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nul)) << i;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t lo = vdupq_n_u8(0x20), hi = vdupq_n_u8(0x7e), tab = vdupq_n_u8('\t');
+    for (unsigned i = 0; i < STRSCAN_BLOCK; i += 16) {
+        const uint8x16_t v = vld1q_u8(p + i);
+        const uint8x16_t print = vorrq_u8(vandq_u8(vcgeq_u8(v, lo), vcleq_u8(v, hi)), vceqq_u8(v, tab));
+        pr |= strscan_movemask(print) << i;
+        z  |= strscan_movemask(vceqzq_u8(v)) << i;
+    }
+#else
+    for (unsigned i = 0; i < STRSCAN_BLOCK; ++i) {
+        pr |= (uint64_t) ((p[i] >= 0x20 && p[i] <= 0x7e) || p[i] == '\t') << i;
+        z  |= (uint64_t) (p[i] == 0) << i;
+    }
+#endif
+    *printable = pr;
+    *zero = z;
+}
+
+/* gather the even bits of x into the low 32 bits */
+static inline uint64_t strscan_even_bits(uint64_t x) {
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1))  & 0x3333333333333333ULL;
+    x = (x | (x >> 2))  & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x >> 4))  & 0x00ff00ff00ff00ffULL;
+    x = (x | (x >> 8))  & 0x0000ffff0000ffffULL;
+    x = (x | (x >> 16)) & 0x00000000ffffffffULL;
+    return x;
+}
+
+static void strscan_emit(struct strscan_job *job, struct strscan_run *run, int encoding) {
+    run->buf[run->len] = '\0';
+    const struct core_string s = {run->vmaddr, run->buf, run->len, encoding};
+    pthread_mutex_lock(&job->lock);
+    if (!atomic_load(&job->stop) && job->fn(&s, job->ctx) != 0) {
+        atomic_store(&job->stop, true);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void strscan_end(struct strscan_job *job, struct strscan_run *run, int encoding) {
+    if (run->len >= job->minlen || (run->cont && run->len > 0)) {
+        strscan_emit(job, run, encoding);
+    }
+    run->len = 0;
+    run->cont = false;
+}
+
+/* append n characters found stride bytes apart, starting at p / vmaddr */
+static void strscan_append(struct strscan_job *job, struct strscan_run *run, const uint8_t *p, size_t n, unsigned stride, uint64_t vmaddr, int encoding) {
+    while (n > 0) {
+        if (run->len == 0) {
+            run->vmaddr = vmaddr;
+        }
+        const size_t k = min(n, STRSCAN_MAXLEN - run->len);
+        if (stride == 1) {
+            memcpy(run->buf + run->len, p, k);
+        } else {
+            for (size_t i = 0; i < k; ++i) {
+                run->buf[run->len + i] = p[i * stride];
+            }
+        }
+        run->len += k;
+        p += k * stride;
+        vmaddr += k * stride;
+        n -= k;
+        if (run->len == STRSCAN_MAXLEN) {
+            strscan_emit(job, run, encoding);
+            run->len = 0;
+            run->cont = true;
+        }
+    }
+}
+
+/* walk the runs of set bits among the low width bits of mask; bit i stands for the character at p + i * stride */
+static void strscan_runs(struct strscan_job *job, struct strscan_run *run, uint64_t mask, unsigned width, const uint8_t *p, unsigned stride, uint64_t vmaddr, int encoding) {
+    for (unsigned i = 0; i < width; ) {
+        if (run->len == 0 && !run->cont) {
+            const uint64_t starts = mask >> i;
+            if (starts == 0) {
+                return;
+            }
+            i += __builtin_ctzll(starts);
+            if (i >= width) {
+                return;
+            }
+        }
+        const uint64_t stops = ~mask >> i;
+        const unsigned n = min(stops != 0 ? (unsigned) __builtin_ctzll(stops) : width - i, width - i);
+        strscan_append(job, run, p + i * stride, n, stride, vmaddr + i * stride, encoding);
+        i += n;
+        if (i < width) {
+            strscan_end(job, run, encoding);
+        }
+    }
+}
+
+/* scan one segment's file-backed bytes chunk by chunk; runs carry over chunk boundaries */
+static int strscan_segment(struct strscan_job *job, const struct core_segment *seg, uint8_t *buf, struct strscan_run *runv) {
+    for (uint64_t off = 0; off < seg->filesize && !atomic_load(&job->stop); off += STRSCAN_CHUNK) {
+        const size_t len = min(STRSCAN_CHUNK, seg->filesize - off);
+        const size_t blocks = (len + STRSCAN_BLOCK - 1) / STRSCAN_BLOCK;
+        
+        /* read one byte ahead so that UTF-16 units straddling the chunk end can be tested */
+        memset(buf, 0, (blocks + 1) * STRSCAN_BLOCK);
+        const size_t want = min(len + 1, seg->filesize - off);
+        ssize_t n;
+        if ((n = core_vm_pread(job->core, buf, want, seg->vmbase + off)) < 0) {
+            return -1;
+        }
+        if ((size_t) n <= len) {
+            buf[len] = 0xff; // neither NUL nor printable
+        }
+        
+        for (size_t b = 0; b < blocks; ++b) {
+            const uint8_t *p = buf + b * STRSCAN_BLOCK;
+            const uint64_t vmaddr = seg->vmbase + off + b * STRSCAN_BLOCK;
+            uint64_t printable, zero;
+            strscan_classify(p, &printable, &zero);
+            
+            if ((job->encodings & CORE_STRINGS_ASCII)) {
+                strscan_runs(job, &runv[0], printable, STRSCAN_BLOCK, p, 1, vmaddr, CORE_STRINGS_ASCII);
+            }
+            if ((job->encodings & CORE_STRINGS_UTF16LE)) {
+                /* a unit starts at i if p[i] is printable and p[i + 1] is NUL */
+                const uint64_t units = printable & ((zero >> 1) | (uint64_t) (p[STRSCAN_BLOCK] == 0) << 63);
+                for (unsigned phase = 0; phase < 2; ++phase) {
+                    struct strscan_run *run = &runv[1 + ((vmaddr + phase) & 1)];
+                    strscan_runs(job, run, strscan_even_bits(units >> phase), STRSCAN_BLOCK / 2, p + phase, 2, vmaddr + phase, CORE_STRINGS_UTF16LE);
+                }
+            }
+        }
+    }
+    
+    strscan_end(job, &runv[0], CORE_STRINGS_ASCII);
+    strscan_end(job, &runv[1], CORE_STRINGS_UTF16LE);
+    strscan_end(job, &runv[2], CORE_STRINGS_UTF16LE);
+    return 0;
+}
+
+static int strscan_unit(struct strscan_job *job, uint64_t i, struct strscan_scratch *scratch) {
+    const struct core_segment *seg = job->core->segidx[i];
+    if ((seg->prot & VM_PROT_READ) && seg->filesize != 0 && strscan_segment(job, seg, scratch->buf, scratch->runv) < 0) {
+        return -1;
+    }
+    return atomic_load(&job->stop);
+}
+
+int core_strings(const struct core *core, const struct core_strings_opts *opts, core_strings_fn *fn, void *ctx) {
+    struct strscan_job job;
+    job.core = core;
+    job.encodings = opts->encodings != 0 ? opts->encodings : CORE_STRINGS_ASCII;
+    job.minlen = opts->minlen != 0 ? opts->minlen : 4;
+    job.fn = fn;
+    job.ctx = ctx;
+    atomic_init(&job.stop, false);
+    if ((errno = pthread_mutex_init(&job.lock, NULL)) != 0) {
+        errfn = "pthread_mutex_init";
+        return -1;
+    }
+    
+    const int res = pages_parallel(core->segidxc, opts->nthreads, sizeof(struct strscan_scratch), (pages_fn *) &strscan_unit, &job);
+    pthread_mutex_destroy(&job.lock);
+    return res;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* printable string extraction over a core's readable segments */
+
+enum core_strings_encoding {
+    CORE_STRINGS_ASCII   = 1 << 0,
+    CORE_STRINGS_UTF16LE = 1 << 1,
+};
+
+struct core_string {
+    uint64_t vmaddr;
+    const char *str; // NUL-terminated; UTF-16LE hits are narrowed to ASCII
+    size_t len;      // characters
+    int encoding;
+};
+
+/* hits arrive in no particular order across segments, but calls are serialized by a lock;
+ * return nonzero to stop the scan */
+typedef int core_strings_fn(const struct core_string *s, void *ctx);
+
+struct core_strings_opts {
+    int encodings;     // CORE_STRINGS_* mask; 0 means ASCII
+    size_t minlen;     // characters; 0 means 4
+    unsigned nthreads; // 0 means one per online CPU
+};
+
+/* scan readable segments in parallel, one segment per thread at a time */
+int core_strings(const struct core *core, const struct core_strings_opts *opts, core_strings_fn *fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
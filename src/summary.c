@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <math.h>
+
+#include "summary.h"
+#include "pages.h"
+#include "util.h"
+
+#define SUMMARY_CHUNK_PAGES 256                  // pages per unit of work
+#define SUMMARY_ENTROPY_STRIDE 4                 // sample every fourth byte
+#define SUMMARY_ENTROPY_SAMPLES (CORE_PAGE_SIZE / SUMMARY_ENTROPY_STRIDE)
+#define SUMMARY_COMPRESSIBLE_BITS 6.0            // bits per byte below which a page counts as compressible
+
+/* per-segment page counts, added to by every worker */
+struct summary_counts {
+    atomic_uint_fast64_t zero;
+    atomic_uint_fast64_t compressible;
+};
+
+struct summary_job {
+    const struct core *core;
+    struct core_summary *sum;
+    struct summary_counts *countv; // per segment; copied into sum once the workers are done
+    uint64_t *firstv;      // global index of each segment's first page, plus total
+    uint64_t chunkc;
+    uint64_t *hashv;       // per global page; 0 for zero pages
+    double nlogn[SUMMARY_ENTROPY_SAMPLES + 1]; // n * log2(n)
+};
+
+/* OR-reduce eight words at a time; the loop vectorizes and exits at the first nonzero block */
+static bool summary_page_is_zero(const uint64_t *words, size_t wordc) {
+    for (size_t i = 0; i < wordc; i += 8) {
+        const uint64_t acc = words[i] | words[i + 1] | words[i + 2] | words[i + 3] |
+        words[i + 4] | words[i + 5] | words[i + 6] | words[i + 7];
+        if (acc != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Shannon entropy of a strided byte sample, in bits per byte */
+static double summary_page_entropy(const struct summary_job *job, const uint8_t *page) {
+    uint32_t hist[256] = {0};
+    for (size_t i = 0; i < CORE_PAGE_SIZE; i += SUMMARY_ENTROPY_STRIDE) {
+        ++hist[page[i]];
+    }
+    double sum = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        sum += job->nlogn[hist[i]];
+    }
+    return log2(SUMMARY_ENTROPY_SAMPLES) - sum / SUMMARY_ENTROPY_SAMPLES;
+}
+
+static size_t summary_segment_of(const struct summary_job *job, uint64_t page) {
+    size_t lo = 0, hi = job->sum->segc;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (job->firstv[mid] <= page) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+static int summary_chunk(struct summary_job *job, uint64_t chunk, uint64_t *buf) {
+    /* a chunk may straddle segments; read each piece separately */
+    const uint64_t pagec = job->firstv[job->sum->segc];
+    const uint64_t first = chunk * SUMMARY_CHUNK_PAGES;
+    const uint64_t last = min(first + SUMMARY_CHUNK_PAGES, pagec);
+    for (uint64_t base = first; base < last; ) {
+        const size_t si = summary_segment_of(job, base);
+        const uint64_t end = min(last, job->firstv[si + 1]);
+        const struct core_segment *seg = job->sum->segv[si].seg;
+        const uint64_t vmaddr = seg->vmbase + (base - job->firstv[si]) * CORE_PAGE_SIZE;
+        const size_t len = min((end - base) * CORE_PAGE_SIZE, seg->filesize - (vmaddr - seg->vmbase));
+        
+        memset(buf, 0, (end - base) * CORE_PAGE_SIZE); // partial last page reads as zero-padded
+        if (core_vm_pread(job->core, buf, len, vmaddr) < 0) {
+            return -1;
+        }
+        
+        uint64_t zero = 0, compressible = 0;
+        for (uint64_t p = base; p < end; ++p) {
+            const uint64_t *words = buf + (p - base) * (CORE_PAGE_SIZE / sizeof(uint64_t));
+            if (summary_page_is_zero(words, CORE_PAGE_SIZE / sizeof(uint64_t))) {
+                ++zero;
+                job->hashv[p] = 0;
+                continue;
+            }
+            if (summary_page_entropy(job, (const uint8_t *) words) < SUMMARY_COMPRESSIBLE_BITS) {
+                ++compressible;
+            }
+            job->hashv[p] = pages_hash(words, CORE_PAGE_SIZE / sizeof(uint64_t));
+        }
+        atomic_fetch_add(&job->countv[si].zero, zero);
+        atomic_fetch_add(&job->countv[si].compressible, compressible);
+        
+        base = end;
+    }
+    return 0;
+}
+
+struct summary_dup {
+    uint64_t hash;
+    uint64_t page;
+};
+
+static int summary_dup_cmp(const struct summary_dup *a, const struct summary_dup *b) {
+    if (a->hash != b->hash) {
+        return (a->hash > b->hash) - (a->hash < b->hash);
+    }
+    return (a->page > b->page) - (a->page < b->page);
+}
+
+/* global page p, zero-padded past the end of its segment's file data */
+static int summary_page_read(const struct summary_job *job, uint64_t p, void *buf) {
+    const size_t si = summary_segment_of(job, p);
+    const struct core_segment *seg = job->sum->segv[si].seg;
+    const uint64_t off = (p - job->firstv[si]) * CORE_PAGE_SIZE;
+    memset(buf, 0, CORE_PAGE_SIZE);
+    if (core_vm_pread(job->core, buf, min(CORE_PAGE_SIZE, seg->filesize - off), seg->vmbase + off) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* count pages identical to an earlier page; pages with equal hashes are compared byte for byte,
+ * against one copy of each distinct content seen so far under that hash */
+static int summary_duplicates(struct summary_job *job) {
+    const uint64_t pagec = job->firstv[job->sum->segc];
+    struct summary_dup *dupv = NULL;
+    uint8_t *distinctv = NULL;
+    size_t dupc = 0, distinctcap = 0;
+    malloc_chk(dupv, sizeof(struct summary_dup) * max(pagec, 1));
+    for (uint64_t p = 0; p < pagec; ++p) {
+        if (job->hashv[p] != 0) {
+            dupv[dupc].hash = job->hashv[p];
+            dupv[dupc].page = p;
+            ++dupc;
+        }
+    }
+    qsort(dupv, dupc, sizeof(struct summary_dup), (int (*)(const void *, const void *)) &summary_dup_cmp);
+    
+    for (size_t i = 0, j; i < dupc; i = j) {
+        for (j = i + 1; j < dupc && dupv[j].hash == dupv[i].hash; ++j) {}
+        if (j - i == 1) {
+            continue;
+        }
+        
+        size_t distinctc = 0;
+        for (size_t k = i; k < j; ++k) {
+            if (distinctc == distinctcap) {
+                distinctcap = max(distinctcap * 2, 4);
+                if ((distinctv = reallocf(distinctv, distinctcap * CORE_PAGE_SIZE)) == NULL) {
+                    errfn = "reallocf";
+                    goto error;
+                }
+            }
+            uint8_t *page = distinctv + distinctc * CORE_PAGE_SIZE;
+            if (summary_page_read(job, dupv[k].page, page) < 0) {
+                goto error;
+            }
+            bool dup = false;
+            for (size_t d = 0; d < distinctc && !dup; ++d) {
+                dup = memcmp(distinctv + d * CORE_PAGE_SIZE, page, CORE_PAGE_SIZE) == 0;
+            }
+            if (dup) {
+                ++job->sum->segv[summary_segment_of(job, dupv[k].page)].duplicate;
+            } else {
+                ++distinctc;
+            }
+        }
+    }
+    
+    free(distinctv);
+    free(dupv);
+    return 0;
+    
+error:
+    free(distinctv);
+    free(dupv);
+    return -1;
+}
+
+void core_summary_free(struct core_summary *sum) {
+    free(sum->segv);
+    memset(sum, 0, sizeof(*sum));
+}
+
+int core_summarize(const struct core *core, struct core_summary *sum, unsigned nthreads) {
+    struct summary_job *job = NULL;
+    
+    memset(sum, 0, sizeof(*sum));
+    if ((sum->segv = calloc(core->segidxc, sizeof(struct core_segment_summary))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    sum->segc = core->segidxc;
+    
+    if ((job = calloc(1, sizeof(*job))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    job->core = core;
+    job->sum = sum;
+    malloc_chk(job->firstv, sizeof(uint64_t) * (core->segidxc + 1));
+    malloc_chk(job->countv, sizeof(struct summary_counts) * max(core->segidxc, 1));
+    
+    /* page numbering over all segments, in vm order */
+    uint64_t pagec = 0;
+    for (size_t i = 0; i < core->segidxc; ++i) {
+        struct core_segment_summary *ssum = &sum->segv[i];
+        ssum->seg = core->segidx[i];
+        ssum->pages = (ssum->seg->filesize + CORE_PAGE_SIZE - 1) / CORE_PAGE_SIZE;
+        job->firstv[i] = pagec;
+        atomic_init(&job->countv[i].zero, 0);
+        atomic_init(&job->countv[i].compressible, 0);
+        pagec += ssum->pages;
+        sum->prot_bytes[ssum->seg->prot & (VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXECUTE)] += ssum->seg->vmsize;
+    }
+    job->firstv[core->segidxc] = pagec;
+    job->chunkc = (pagec + SUMMARY_CHUNK_PAGES - 1) / SUMMARY_CHUNK_PAGES;
+    malloc_chk(job->hashv, sizeof(uint64_t) * max(pagec, 1));
+    for (size_t n = 0; n <= SUMMARY_ENTROPY_SAMPLES; ++n) {
+        job->nlogn[n] = n > 0 ? n * log2(n) : 0;
+    }
+    
+    if (pages_parallel(job->chunkc, nthreads, SUMMARY_CHUNK_PAGES * CORE_PAGE_SIZE, (pages_fn *) &summary_chunk, job) < 0) {
+        goto error;
+    }
+    
+    if (summary_duplicates(job) < 0) {
+        goto error;
+    }
+    
+    for (size_t i = 0; i < sum->segc; ++i) {
+        sum->segv[i].zero         = atomic_load(&job->countv[i].zero);
+        sum->segv[i].compressible = atomic_load(&job->countv[i].compressible);
+        sum->pages        += sum->segv[i].pages;
+        sum->zero         += sum->segv[i].zero;
+        sum->compressible += sum->segv[i].compressible;
+        sum->duplicate    += sum->segv[i].duplicate;
+    }
+    
+    free(job->firstv);
+    free(job->countv);
+    free(job->hashv);
+    free(job);
+    return 0;
+    
+error:
+    if (job != NULL) {
+        free(job->firstv);
+        free(job->countv);
+        free(job->hashv);
+        free(job);
+    }
+    core_summary_free(sum);
+    return -1;
+}
+
+static const char *summary_prot_str(vm_prot_t prot, char buf[4]) {
+    buf[0] = (prot & VM_PROT_READ) ? 'r' : '-';
+    buf[1] = (prot & VM_PROT_WRITE) ? 'w' : '-';
+    buf[2] = (prot & VM_PROT_EXECUTE) ? 'x' : '-';
+    buf[3] = '\0';
+    return buf;
+}
+
+void core_summary_print(const struct core_summary *sum, FILE *f) {
+    char prot[4];
+    fprintf(f, "%-18s %-18s %-4s %10s %10s %10s %10s  %s\n", "START", "END", "PROT", "PAGES", "ZERO", "COMPRESS", "DUP", "NAME");
+    for (size_t i = 0; i < sum->segc; ++i) {
+        const struct core_segment_summary *ssum = &sum->segv[i];
+        const struct core_segment *seg = ssum->seg;
+        fprintf(f, "%018llx %018llx %-4s %10llu %10llu %10llu %10llu  %s\n",
+                (unsigned long long) seg->vmbase, (unsigned long long) (seg->vmbase + seg->vmsize),
+                summary_prot_str(seg->prot, prot),
+                (unsigned long long) ssum->pages, (unsigned long long) ssum->zero,
+                (unsigned long long) ssum->compressible, (unsigned long long) ssum->duplicate, seg->name);
+    }
+    fprintf(f, "%-18s %-18s %-4s %10llu %10llu %10llu %10llu\n", "TOTAL", "", "",
+            (unsigned long long) sum->pages, (unsigned long long) sum->zero,
+            (unsigned long long) sum->compressible, (unsigned long long) sum->duplicate);
+    for (size_t p = 0; p < sizeof(sum->prot_bytes) / sizeof(sum->prot_bytes[0]); ++p) {
+        if (sum->prot_bytes[p] != 0) {
+            fprintf(f, "%s %llu bytes\n", summary_prot_str(p, prot), (unsigned long long) sum->prot_bytes[p]);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* vmmap-style footprint of a core, classified page by page */
+
+struct core_segment_summary {
+    const struct core_segment *seg;
+    uint64_t pages;        // file-backed pages
+    uint64_t zero;         // all-zero pages
+    uint64_t compressible; // nonzero pages with low estimated entropy
+    uint64_t duplicate;    // nonzero pages identical to an earlier page in the core
+};
+
+struct core_summary {
+    size_t segc;
+    struct core_segment_summary *segv; // non-empty segments in VM order
+    uint64_t prot_bytes[(VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXECUTE) + 1]; // vmsize per initial protection
+    uint64_t pages;
+    uint64_t zero;
+    uint64_t compressible;
+    uint64_t duplicate;
+};
+
+/* nthreads == 0 picks the number of online CPUs */
+int core_summarize(const struct core *core, struct core_summary *sum, unsigned nthreads);
+void core_summary_print(const struct core_summary *sum, FILE *f);
+void core_summary_free(struct core_summary *sum);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,615 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "core.h"
+#include "exports.h"
+#include "macho.h"
+#include "symbols.h"
+#include "test.h"
+
+#define TEST_BASE 0x100000000ULL
+#define TEST_TEXT_SIZE (64 * CORE_PAGE_SIZE)
+
+/* xorshift, so that runs are reproducible */
+static uint64_t test_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/* image whose symbols are spread over __TEXT in no particular order */
+static void test_open_image(struct test_image *img, const struct test_symbol *symv, size_t symc, struct core *core) {
+    test_image_symtab(img, symv, symc);
+    test_image_segments(img, TEST_BASE, TEST_TEXT_SIZE);
+    test_check(core_open(test_image_file(img), core, NULL) == 0);
+}
+
+static struct test_symbol *test_random_symbols(size_t symc, uint64_t span, uint64_t seed) {
+    struct test_symbol *symv;
+    test_check((symv = calloc(symc, sizeof(struct test_symbol))) != NULL);
+    for (size_t i = 0; i < symc; ++i) {
+        char *name;
+        test_check(asprintf(&name, "_sym%zu", i) > 0);
+        symv[i].name = name;
+        symv[i].type = N_SECT;
+        symv[i].sect = 1;
+        symv[i].vmaddr = TEST_BASE + test_random(&seed) % span;
+    }
+    return symv;
+}
+
+static void test_free_symbols(struct test_symbol *symv, size_t symc) {
+    for (size_t i = 0; i < symc; ++i) {
+        free((char *) symv[i].name);
+    }
+    free(symv);
+}
+
+static bool test_same_symbol(const struct symbol *a, const struct symbol *b) {
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    return a->vmaddr == b->vmaddr && strcmp(a->name, b->name) == 0;
+}
+
+/* symbols_find through the page index agrees with the binary search, in and around __TEXT */
+static void test_page_index(void) {
+    const size_t symc = 500;
+    struct test_symbol *symv = test_random_symbols(symc, TEST_TEXT_SIZE, 1);
+    
+    struct test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    struct core core;
+    test_open_image(&img, symv, symc, &core);
+    
+    struct symbols plain, indexed;
+    test_check(symbols_open(&core, &plain) == 0);
+    test_check(symbols_open_flags(&core, &indexed, SYMBOLS_PAGE_INDEX) == 0);
+    test_check(plain.symc == symc && indexed.symc == symc);
+    test_check(indexed.pagev != NULL && indexed.pagebase == TEST_BASE && indexed.pagec == TEST_TEXT_SIZE / CORE_PAGE_SIZE);
+    
+    for (uint64_t vmaddr = TEST_BASE - 64; vmaddr < TEST_BASE + TEST_TEXT_SIZE + 64; vmaddr += 7) {
+        test_check(test_same_symbol(symbols_find(&plain, vmaddr), symbols_find(&indexed, vmaddr)));
+    }
+    for (size_t i = 0; i < symc; ++i) {
+        const struct symbol *sym = symbols_find(&indexed, symv[i].vmaddr);
+        test_check(sym != NULL && sym->vmaddr == symv[i].vmaddr);
+    }
+    test_check(symbols_find(&indexed, TEST_BASE - 1) == NULL);
+    
+    symbols_close(&plain);
+    symbols_close(&indexed);
+    core_close(&core);
+    test_image_free(&img);
+    test_free_symbols(symv, symc);
+}
+
+struct test_sort_key {
+    uint64_t vmaddr;
+    size_t index;
+};
+
+static int test_sort_cmp(const struct test_sort_key *a, const struct test_sort_key *b) {
+    if (a->vmaddr != b->vmaddr) {
+        return (a->vmaddr > b->vmaddr) - (a->vmaddr < b->vmaddr);
+    }
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+/* symbols come out in the order of a stable comparison sort: by address, then symbol table order.
+ * Addresses repeat often; every sixteenth one has random high bits, so that every radix pass has work. */
+static void test_sort(size_t symc, uint64_t seed) {
+    struct test_symbol *symv = test_random_symbols(symc, symc / 4 + 1, seed);
+    for (size_t i = 0; i < symc; i += 16) {
+        symv[i].vmaddr ^= test_random(&seed) & ~0xffffULL;
+    }
+    
+    struct test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    struct core core;
+    test_open_image(&img, symv, symc, &core);
+    struct symbols syms;
+    test_check(symbols_open(&core, &syms) == 0 && syms.symc == symc);
+    
+    struct test_sort_key *keyv;
+    test_check((keyv = malloc(symc * sizeof(*keyv))) != NULL);
+    for (size_t i = 0; i < symc; ++i) {
+        keyv[i].vmaddr = symv[i].vmaddr;
+        keyv[i].index = i;
+    }
+    qsort(keyv, symc, sizeof(*keyv), (int (*)(const void *, const void *)) &test_sort_cmp);
+    for (size_t i = 0; i < symc; ++i) {
+        test_check(syms.symv[i].vmaddr == keyv[i].vmaddr && strcmp(syms.symv[i].name, symv[keyv[i].index].name) == 0);
+    }
+    
+    free(keyv);
+    symbols_close(&syms);
+    core_close(&core);
+    test_image_free(&img);
+    test_free_symbols(symv, symc);
+}
+
+/* file holding syms' name hash as written by symbols_hash_save, patched by the caller */
+static FILE *test_hash_file(struct symbols *syms, uint8_t **buf, size_t *size) {
+    FILE *f;
+    test_check((f = tmpfile()) != NULL);
+    test_check(symbols_hash_save(syms, f) == 0);
+    test_check((*size = ftell(f)) > 0);
+    test_check((*buf = malloc(*size)) != NULL);
+    rewind(f);
+    test_check(fread(*buf, 1, *size, f) == *size);
+    return f;
+}
+
+static int test_hash_load(struct symbols *syms, const uint8_t *buf, size_t size) {
+    FILE *f;
+    test_check((f = tmpfile()) != NULL);
+    test_check(fwrite(buf, 1, size, f) == size);
+    rewind(f);
+    const int res = symbols_hash_load(syms, f);
+    fclose(f);
+    return res;
+}
+
+/* a saved name hash loads back to the same lookups as a freshly built one; corrupt tables are refused */
+static void test_hash_cache(void) {
+    const size_t symc = 300;
+    struct test_symbol *symv = test_random_symbols(symc, TEST_TEXT_SIZE, 2);
+    
+    struct test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    struct core core;
+    test_open_image(&img, symv, symc, &core);
+    
+    struct symbols built, loaded;
+    test_check(symbols_open(&core, &built) == 0);
+    test_check(symbols_open(&core, &loaded) == 0);
+    
+    uint8_t *buf;
+    size_t size;
+    FILE *f = test_hash_file(&built, &buf, &size);
+    rewind(f);
+    test_check(symbols_hash_load(&loaded, f) == 0);
+    fclose(f);
+    test_check(loaded.hashc == built.hashc && memcmp(loaded.hashv, built.hashv, built.hashc * sizeof(uint32_t)) == 0);
+    for (size_t i = 0; i < symc; ++i) {
+        test_check(test_same_symbol(symbols_lookup_name(&loaded, symv[i].name), symbols_lookup_name(&built, symv[i].name)));
+        test_check(symbols_lookup_name(&loaded, symv[i].name) != NULL);
+    }
+    test_check(symbols_lookup_name(&loaded, "_missing") == NULL);
+    
+    /* header: magic, reserved, symc, hashc; then the hdrsize */
+    const size_t hdrsize = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    const size_t hashc = built.hashc;
+    test_check(size == hdrsize + hashc * sizeof(uint32_t));
+    
+    struct symbols fresh;
+    test_check(symbols_open(&core, &fresh) == 0);
+    uint8_t *bad;
+    test_check((bad = malloc(size)) != NULL);
+    
+    /* slot naming a symbol past the end */
+    memcpy(bad, buf, size);
+    const uint32_t past = symc + 1;
+    memcpy(bad + hdrsize + (hashc - 1) * sizeof(uint32_t), &past, sizeof(past));
+    errno = 0;
+    test_check(test_hash_load(&fresh, bad, size) < 0 && errno == EINVAL);
+    test_check(fresh.hashv == NULL);
+    
+    /* no empty slot, so that a lookup miss would probe forever */
+    memcpy(bad, buf, size);
+    for (size_t j = 0; j < hashc; ++j) {
+        const uint32_t one = 1;
+        memcpy(bad + hdrsize + j * sizeof(uint32_t), &one, sizeof(one));
+    }
+    errno = 0;
+    test_check(test_hash_load(&fresh, bad, size) < 0 && errno == EINVAL);
+    
+    /* saved for a different symbol table */
+    memcpy(bad, buf, size);
+    const uint64_t othersymc = symc - 1;
+    memcpy(bad + 2 * sizeof(uint32_t), &othersymc, sizeof(othersymc));
+    errno = 0;
+    test_check(test_hash_load(&fresh, bad, size) < 0 && errno == EINVAL);
+    
+    /* wrong magic, table size that is not the one built for symc, truncation */
+    memcpy(bad, buf, size);
+    bad[0] ^= 0xff;
+    test_check(test_hash_load(&fresh, bad, size) < 0);
+    memcpy(bad, buf, size);
+    const uint64_t otherhashc = hashc * 2;
+    memcpy(bad + 2 * sizeof(uint32_t) + sizeof(uint64_t), &otherhashc, sizeof(otherhashc));
+    test_check(test_hash_load(&fresh, bad, size) < 0);
+    test_check(test_hash_load(&fresh, buf, size - 1) < 0);
+    test_check(test_hash_load(&fresh, buf, hdrsize / 2) < 0);
+    
+    /* failed loads leave the table to be built on first use */
+    test_check(fresh.hashv == NULL);
+    test_check(test_same_symbol(symbols_lookup_name(&fresh, symv[0].name), symbols_lookup_name(&built, symv[0].name)));
+    
+    free(bad);
+    free(buf);
+    symbols_close(&fresh);
+    symbols_close(&built);
+    symbols_close(&loaded);
+    core_close(&core);
+    test_image_free(&img);
+    test_free_symbols(symv, symc);
+}
+
+/* names kept by symbols_open_flags, in address order, joined by spaces */
+static void test_kept_names(struct core *core, int flags, char *buf, size_t size) {
+    struct symbols syms;
+    test_check(symbols_open_flags(core, &syms, flags) == 0);
+    buf[0] = '\0';
+    for (size_t i = 0; i < syms.symc; ++i) {
+        test_check(strlen(buf) + strlen(syms.symv[i].name) + 2 <= size);
+        if (i > 0) {
+            strcat(buf, " ");
+        }
+        strcat(buf, syms.symv[i].name);
+    }
+    symbols_close(&syms);
+}
+
+/* SYMBOLS_EXTDEF adds externals to the locals, SYMBOLS_NO_LOCAL drops the locals; with LC_DYSYMTAB,
+ * only the local and external definition partitions are read, so the stray local after them is never seen */
+static void test_symbol_classes(void) {
+    const struct test_symbol symv[] = {
+        {"_local1", N_SECT, 1, TEST_BASE + 0x10},
+        {"_local2", N_SECT, 1, TEST_BASE + 0x40},
+        {"_ext1", N_SECT | N_EXT, 1, TEST_BASE + 0x20},
+        {"_ext2", N_SECT | N_EXT, 1, TEST_BASE + 0x50},
+        {"_undef", N_UNDF | N_EXT, 0, 0},
+        {"_stray", N_SECT, 1, TEST_BASE + 0x30},
+    };
+    const struct {
+        int flags;
+        const char *partitioned;
+        const char *whole;
+    } cases[] = {
+        {0, "_local1 _local2", "_local1 _stray _local2"},
+        {SYMBOLS_EXTDEF, "_local1 _ext1 _local2 _ext2", "_local1 _ext1 _stray _local2 _ext2"},
+        {SYMBOLS_EXTDEF | SYMBOLS_NO_LOCAL, "_ext1 _ext2", "_ext1 _ext2"},
+        {SYMBOLS_NO_LOCAL, "", ""},
+    };
+    
+    for (int dysymtab = 0; dysymtab < 2; ++dysymtab) {
+        struct test_image img;
+        test_image_init(&img, true, false, MH_EXECUTE);
+        if (dysymtab) {
+            test_image_dysymtab(&img, 2, 2, 2);
+        }
+        struct core core;
+        test_open_image(&img, symv, sizeof(symv) / sizeof(*symv), &core);
+        
+        for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+            char names[256];
+            test_kept_names(&core, cases[i].flags, names, sizeof(names));
+            test_check(strcmp(names, dysymtab ? cases[i].partitioned : cases[i].whole) == 0);
+        }
+        
+        core_close(&core);
+        test_image_free(&img);
+    }
+}
+
+/* export trie for _a (0x10), its extension _ab (0x20) and a re-export _b:
+ * "" -_-> "_" -a-> "_a" -b-> "_ab"
+ *             -b-> "_b" */
+#define TEST_TRIE_A   13 // offset of the "_a" node
+#define TEST_TRIE_AB  20
+static const uint8_t test_trie[] = {
+    /* "" */   0x00, 0x01, '_', 0x00, 5,
+    /* "_" */  0x00, 0x02, 'a', 0x00, TEST_TRIE_A, 'b', 0x00, 24,
+    /* "_a" */ 0x02, EXPORT_SYMBOL_FLAGS_KIND_REGULAR, 0x10, 0x01, 'b', 0x00, TEST_TRIE_AB,
+    /* "_ab" */ 0x02, EXPORT_SYMBOL_FLAGS_KIND_REGULAR, 0x20, 0x00,
+    /* "_b" */ 0x03, EXPORT_SYMBOL_FLAGS_REEXPORT, 0x01, 0x00, 0x00,
+};
+
+struct test_exports_ctx {
+    size_t expc;
+    struct export expv[4];
+    char names[4][8];
+};
+
+static int test_collect_export(const struct export *exp, struct test_exports_ctx *ctx) {
+    /* a cyclic trie calls back until the depth limit; keep the first few */
+    if (ctx->expc < 4 && strlen(exp->name) < 8) {
+        ctx->expv[ctx->expc] = *exp;
+        strcpy(ctx->names[ctx->expc], exp->name);
+    }
+    ++ctx->expc;
+    return 0;
+}
+
+static void test_open_exports(struct test_image *img, const uint8_t *trie, size_t size, struct core *core) {
+    const struct test_symbol symv[] = {
+        {"_a", N_SECT, 1, TEST_BASE + 0x10},
+        {"_local", N_SECT, 1, TEST_BASE + 0x30},
+    };
+    test_image_init(img, true, false, MH_DYLIB);
+    test_image_linkedit(img, LC_DYLD_EXPORTS_TRIE, trie, size);
+    test_open_image(img, symv, sizeof(symv) / sizeof(*symv), core);
+}
+
+/* the trie walk and lookup agree with the hand-built trie, and symbols merge exports into the symtab */
+static void test_exports(void) {
+    struct test_image img;
+    struct core core;
+    test_open_exports(&img, test_trie, sizeof(test_trie), &core);
+    
+    struct exports exps;
+    test_check(exports_open(&core, &exps) == 0);
+    test_check(exps.size == sizeof(test_trie) && exps.imagebase == TEST_BASE);
+    
+    struct test_exports_ctx ctx = {0};
+    test_check(exports_foreach(&exps, (exports_fn *) &test_collect_export, &ctx) == 0);
+    test_check(ctx.expc == 3);
+    test_check(strcmp(ctx.names[0], "_a") == 0 && ctx.expv[0].vmaddr == TEST_BASE + 0x10);
+    test_check(strcmp(ctx.names[1], "_ab") == 0 && ctx.expv[1].vmaddr == TEST_BASE + 0x20);
+    test_check(strcmp(ctx.names[2], "_b") == 0 && (ctx.expv[2].flags & EXPORT_SYMBOL_FLAGS_REEXPORT));
+    
+    /* each walked export is found by lookup, and nothing else is */
+    for (size_t i = 0; i < ctx.expc; ++i) {
+        struct export exp;
+        test_check(exports_lookup(&exps, ctx.names[i], &exp) == 1);
+        test_check(exp.vmaddr == ctx.expv[i].vmaddr && exp.flags == ctx.expv[i].flags);
+    }
+    const char *missing[] = {"", "_", "a", "_abc", "_c", "_ba"};
+    for (size_t i = 0; i < sizeof(missing) / sizeof(*missing); ++i) {
+        struct export exp;
+        test_check(exports_lookup(&exps, missing[i], &exp) == 0);
+    }
+    
+    /* _a is in both the symtab and the trie; the re-export has no address here */
+    struct symbols syms;
+    test_check(symbols_open_flags(&core, &syms, SYMBOLS_EXPORTS) == 0);
+    test_check(syms.symc == 3);
+    test_check(strcmp(syms.symv[0].name, "_a") == 0 && syms.symv[0].vmaddr == TEST_BASE + 0x10);
+    test_check(strcmp(syms.symv[1].name, "_ab") == 0 && syms.symv[1].vmaddr == TEST_BASE + 0x20);
+    test_check(strcmp(syms.symv[2].name, "_local") == 0);
+    symbols_close(&syms);
+    
+    core_close(&core);
+    test_image_free(&img);
+}
+
+/* corrupt tries fail cleanly, and symbols_open_flags frees what it gathered */
+static void test_exports_corrupt(void) {
+    uint8_t trie[sizeof(test_trie)];
+    struct {
+        size_t off;
+        uint8_t byte;
+        int err;
+    } const cases[] = {
+        {4, 0x7f, EINVAL},                      // child past the end
+        {TEST_TRIE_AB - 1, TEST_TRIE_A, ELOOP}, // "_a" -b-> "_a"
+        {TEST_TRIE_AB, 0x7f, EINVAL},           // terminal past the end
+        {sizeof(test_trie) - 1, 0x05, EINVAL},  // edges past the end
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+        memcpy(trie, test_trie, sizeof(trie));
+        trie[cases[i].off] = cases[i].byte;
+        
+        struct test_image img;
+        struct core core;
+        test_open_exports(&img, trie, sizeof(trie), &core);
+        
+        struct exports exps;
+        test_check(exports_open(&core, &exps) == 0);
+        struct test_exports_ctx ctx = {0};
+        errno = 0;
+        test_check(exports_foreach(&exps, (exports_fn *) &test_collect_export, &ctx) < 0 && errno == cases[i].err);
+        
+        struct symbols syms;
+        test_check(symbols_open_flags(&core, &syms, SYMBOLS_EXPORTS) < 0);
+        test_check(syms.symc == 0 && syms.symv == NULL);
+        
+        core_close(&core);
+        test_image_free(&img);
+    }
+}
+
+/* symbols of an opposite-endian image, with locals, external definitions and exports,
+ * match those of the same image written in host order */
+static void test_swapped_symbols(bool wide) {
+    const size_t symc = 200, nlocal = 120;
+    const uint64_t base = wide ? TEST_BASE : 0x10000;
+    struct test_symbol *symv = test_random_symbols(symc, TEST_TEXT_SIZE, 6);
+    for (size_t i = 0; i < symc; ++i) {
+        symv[i].vmaddr = symv[i].vmaddr - TEST_BASE + base;
+        symv[i].type |= i < nlocal ? 0 : N_EXT;
+    }
+    
+    struct test_image imgv[2];
+    struct core corev[2];
+    struct symbols symsv[2];
+    for (int swap = 0; swap < 2; ++swap) {
+        test_image_init(&imgv[swap], wide, swap, MH_DYLIB);
+        test_image_linkedit(&imgv[swap], LC_DYLD_EXPORTS_TRIE, test_trie, sizeof(test_trie));
+        test_image_symtab(&imgv[swap], symv, symc);
+        test_image_dysymtab(&imgv[swap], nlocal, symc - nlocal, 0);
+        test_image_segments(&imgv[swap], base, TEST_TEXT_SIZE);
+        test_check(core_open(test_image_file(&imgv[swap]), &corev[swap], NULL) == 0);
+        test_check(corev[swap].swap == swap);
+        test_check(symbols_open_flags(&corev[swap], &symsv[swap], SYMBOLS_EXTDEF | SYMBOLS_EXPORTS) == 0);
+    }
+    
+    /* the symbol table plus _a and _ab from the trie */
+    test_check(symsv[0].symc == symc + 2 && symsv[1].symc == symsv[0].symc);
+    for (size_t i = 0; i < symsv[0].symc; ++i) {
+        test_check(test_same_symbol(&symsv[0].symv[i], &symsv[1].symv[i]));
+    }
+    
+    for (int swap = 0; swap < 2; ++swap) {
+        symbols_close(&symsv[swap]);
+        core_close(&corev[swap]);
+        test_image_free(&imgv[swap]);
+    }
+    test_free_symbols(symv, symc);
+}
+
+/* the vector swaps agree with swapping each field on its own, for counts around every group size */
+static void test_swap_nlist(void) {
+    uint64_t seed = 7;
+    for (size_t nlc = 0; nlc < 14; ++nlc) {
+        struct nlist nlv[14], ref[14];
+        struct nlist_64 nlv64[14], ref64[14];
+        for (size_t i = 0; i < sizeof(nlv); ++i) {
+            ((uint8_t *) nlv)[i] = test_random(&seed);
+        }
+        for (size_t i = 0; i < sizeof(nlv64); ++i) {
+            ((uint8_t *) nlv64)[i] = test_random(&seed);
+        }
+        memcpy(ref, nlv, sizeof(nlv));
+        memcpy(ref64, nlv64, sizeof(nlv64));
+        for (size_t i = 0; i < nlc; ++i) {
+            ref[i].n_un.n_strx = __builtin_bswap32(ref[i].n_un.n_strx);
+            ref[i].n_desc = __builtin_bswap16(ref[i].n_desc);
+            ref[i].n_value = __builtin_bswap32(ref[i].n_value);
+            ref64[i].n_un.n_strx = __builtin_bswap32(ref64[i].n_un.n_strx);
+            ref64[i].n_desc = __builtin_bswap16(ref64[i].n_desc);
+            ref64[i].n_value = __builtin_bswap64(ref64[i].n_value);
+        }
+        macho_swap_nlist(nlv, nlc);
+        macho_swap_nlist_64(nlv64, nlc);
+        test_check(memcmp(nlv, ref, sizeof(nlv)) == 0);
+        test_check(memcmp(nlv64, ref64, sizeof(nlv64)) == 0);
+    }
+}
+
+struct test_starts {
+    uint8_t data[64];
+    size_t len;
+    uint64_t addr;
+    uint64_t funcv[32];
+    size_t funcc;
+};
+
+/* append a ULEB128 delta and the function start it encodes */
+static void test_starts_delta(struct test_starts *fs, uint64_t delta) {
+    do {
+        test_check(fs->len < sizeof(fs->data));
+        fs->data[fs->len++] = (delta & 0x7f) | (delta >= 0x80 ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta != 0);
+}
+
+static void test_starts_add(struct test_starts *fs, uint64_t delta) {
+    test_starts_delta(fs, delta);
+    fs->addr += delta;
+    fs->funcv[fs->funcc++] = fs->addr;
+}
+
+static void test_open_starts(const struct test_starts *fs, const struct test_symbol *symv, size_t symc,
+                             struct core *core, struct symbols *syms) {
+    struct test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    test_image_symtab(&img, symv, symc);
+    test_image_linkedit(&img, LC_FUNCTION_STARTS, fs->data, fs->len);
+    test_image_segments(&img, TEST_BASE, TEST_TEXT_SIZE);
+    test_check(core_open(test_image_file(&img), core, NULL) == 0);
+    test_check(symbols_open_flags(core, syms, SYMBOLS_FUNCTION_STARTS) == 0);
+    test_image_free(&img);
+}
+
+static void test_check_starts(const struct test_starts *fs, const struct symbols *syms) {
+    test_check(syms->funcc == fs->funcc);
+    for (size_t i = 0; i < fs->funcc; ++i) {
+        test_check(syms->funcv[i].vmbase == fs->funcv[i]);
+        const uint64_t end = i + 1 < fs->funcc ? fs->funcv[i + 1] : TEST_BASE + TEST_TEXT_SIZE;
+        test_check(syms->funcv[i].vmsize == end - fs->funcv[i]);
+    }
+}
+
+/* LC_FUNCTION_STARTS decodes the same whether deltas are summed a word at a time or one ULEB128 at a time */
+static void test_function_starts(void) {
+    struct test_starts fs = {.addr = TEST_BASE};
+    test_starts_add(&fs, 0x4000); // three bytes
+    for (size_t i = 0; i < 8; ++i) {
+        test_starts_add(&fs, 4);  // one word of one-byte deltas
+    }
+    for (size_t i = 0; i < 7; ++i) {
+        test_starts_add(&fs, 8);
+    }
+    test_check(fs.len == 18);
+    test_starts_add(&fs, 0x90);   // straddles the end of the word starting at 11
+    test_check(fs.len == 20);
+    for (size_t i = 0; i < 9; ++i) {
+        test_starts_add(&fs, 0x7f);
+    }
+    test_starts_delta(&fs, 0);    // terminator in the middle of a word, followed by padding that isn't decoded
+    for (size_t i = 0; i < 7; ++i) {
+        fs.data[fs.len++] = 0x10;
+    }
+    
+    const struct test_symbol symv[] = {
+        {"_start", N_SECT, 1, fs.funcv[0]},
+        {"_f", N_SECT, 1, fs.funcv[9]},
+        {"_data", N_SECT, 2, TEST_BASE + TEST_TEXT_SIZE + 0x10},
+    };
+    struct core core;
+    struct symbols syms;
+    test_open_starts(&fs, symv, 3, &core, &syms);
+    test_check_starts(&fs, &syms);
+    
+    /* bounds apply within the functions' range; data past __TEXT still resolves */
+    test_check(symbols_find_function(&syms, fs.funcv[9] + 2) == &syms.funcv[9]);
+    test_check(symbols_find(&syms, fs.funcv[9] + 2) != NULL && strcmp(symbols_find(&syms, fs.funcv[9] + 2)->name, "_f") == 0);
+    test_check(symbols_find(&syms, fs.funcv[10]) == NULL);
+    test_check(symbols_find(&syms, TEST_BASE + TEST_TEXT_SIZE + 0x20) != NULL &&
+               strcmp(symbols_find(&syms, TEST_BASE + TEST_TEXT_SIZE + 0x20)->name, "_data") == 0);
+    symbols_close(&syms);
+    core_close(&core);
+    
+    /* a trailing delta cut off mid-ULEB128 is dropped */
+    struct test_starts cut = {.addr = TEST_BASE};
+    for (size_t i = 0; i < 8; ++i) {
+        test_starts_add(&cut, 4);
+    }
+    cut.data[cut.len++] = 0x85;
+    test_open_starts(&cut, symv, 1, &core, &syms);
+    test_check_starts(&cut, &syms);
+    symbols_close(&syms);
+    core_close(&core);
+}
+
+/* a symbol count far past the end of the image fails the read instead of sizing an allocation */
+static void test_nsyms_bound(void) {
+    const struct test_symbol symv[] = {
+        {"_a", N_SECT, 1, TEST_BASE + 0x100},
+    };
+    struct test_image img;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    const size_t symtab = test_image_symtab(&img, symv, 1);
+    test_image_field(&img, symtab, struct symtab_command, nsyms, 0xfffffff0);
+    test_image_segments(&img, TEST_BASE, TEST_TEXT_SIZE);
+    struct core core;
+    test_check(core_open(test_image_file(&img), &core, NULL) == 0);
+    struct symbols syms;
+    errno = 0;
+    test_check(symbols_open(&core, &syms) == -1 && errno == EINVAL);
+    core_close(&core);
+    test_image_free(&img);
+}
+
+int main(void) {
+    test_page_index();
+    test_sort(1000, 4);
+    test_sort(140000, 5); // enough for the parallel passes
+    test_hash_cache();
+    test_symbol_classes();
+    test_exports();
+    test_exports_corrupt();
+    test_swapped_symbols(true);
+    test_swapped_symbols(false);
+    test_swap_nlist();
+    test_function_starts();
+    test_nsyms_bound();
+    return EXIT_SUCCESS;
+}
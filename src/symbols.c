@@ -2,7 +2,11 @@
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <mach-o/loader.h>
 #include <mach-o/nlist.h>
@@ -12,9 +16,12 @@
 #include "macho.h"
 #include "util.h"
 #include "core.h"
+#include "exports.h"
 
-static int symbols_open_macho32(struct core *core, struct symbols *syms);
-
+typedef void symbols_swap_fn(void *nlv, size_t nlc);
+static int symbols_open_macho(struct core *core, struct symbols *syms, int flags, size_t nlsize, symbols_swap_fn *swap,
+                              symbols_fn *fn, void *ctx);
+                              
 extern _Thread_local const char *errfn;
 
 static int fread_peek(void *restrict ptr, size_t size, size_t nitems, FILE *restrict stream) {
@@ -30,7 +37,7 @@ static int fread_peek(void *restrict ptr, size_t size, size_t nitems, FILE *rest
     }
     
     fseek_chk(stream, -size * nitems, SEEK_CUR);
-
+    
     return 0;
     
 error:
@@ -51,180 +58,843 @@ static void symbol_init(struct symbol *sym) {
 static void symbols_init(struct symbols *syms) {
     syms->symc = 0;
     syms->symv = NULL;
+    syms->pagebase = 0;
+    syms->pagec = 0;
+    syms->pagev = NULL;
+    syms->hashc = 0;
+    syms->hashv = NULL;
+    syms->funcc = 0;
+    syms->funcv = NULL;
 }
 
-static int symbols_reserve(struct symbols *syms, size_t count) {
-    if ((syms->symv = calloc(count, sizeof(struct symbol))) == NULL) {
-        return -1;
+void symbols_close(struct symbols *syms) {
+    for (size_t i = 0; i < syms->symc; ++i) {
+        free(syms->symv[i].name);
+    }
+    free(syms->symv);
+    free(syms->pagev);
+    free(syms->hashv);
+    free(syms->funcv);
+    symbols_init(syms);
+}
+
+#define SYMBOLS_RADIX_BITS 8
+#define SYMBOLS_RADIX_SIZE (1 << SYMBOLS_RADIX_BITS)
+#define SYMBOLS_RADIX_PARALLEL_MIN (1 << 16) // symbols per thread before sorting goes parallel
+#define SYMBOLS_RADIX_MAX_THREADS 16
+
+struct symbols_radix {
+    const struct symbol *src;
+    struct symbol *dst;
+    unsigned shift;
+};
+
+/* contiguous slice of the table; count holds its digit histogram, then its scatter offsets */
+struct symbols_radix_part {
+    struct symbols_radix *radix;
+    size_t begin;
+    size_t end;
+    size_t count[SYMBOLS_RADIX_SIZE];
+};
+
+static void *symbols_radix_count(struct symbols_radix_part *part) {
+    const struct symbols_radix *radix = part->radix;
+    memset(part->count, 0, sizeof(part->count));
+    for (size_t i = part->begin; i < part->end; ++i) {
+        ++part->count[(radix->src[i].vmaddr >> radix->shift) & (SYMBOLS_RADIX_SIZE - 1)];
+    }
+    return NULL;
+}
+
+static void *symbols_radix_scatter(struct symbols_radix_part *part) {
+    const struct symbols_radix *radix = part->radix;
+    for (size_t i = part->begin; i < part->end; ++i) {
+        const struct symbol *sym = &radix->src[i];
+        radix->dst[part->count[(sym->vmaddr >> radix->shift) & (SYMBOLS_RADIX_SIZE - 1)]++] = *sym;
+    }
+    return NULL;
+}
+
+/* run fn over every part, on threads if there are several; parts whose thread can't be started run here */
+static void symbols_radix_run(struct symbols_radix_part *partv, unsigned partc, void *(*fn)(struct symbols_radix_part *)) {
+    pthread_t threadv[SYMBOLS_RADIX_MAX_THREADS];
+    bool startedv[SYMBOLS_RADIX_MAX_THREADS];
+    for (unsigned t = 1; t < partc; ++t) {
+        startedv[t] = pthread_create(&threadv[t], NULL, (void *(*)(void *)) fn, &partv[t]) == 0;
+    }
+    fn(&partv[0]);
+    for (unsigned t = 1; t < partc; ++t) {
+        if (startedv[t]) {
+            pthread_join(threadv[t], NULL);
+        } else {
+            fn(&partv[t]);
+        }
+    }
+}
+
+/* stable LSD radix sort on vmaddr; digits that are equal across the whole table are skipped */
+static int symbols_sort(struct symbols *syms) {
+    struct symbol *tmp = NULL;
+    
+    if (syms->symc < 2) {
+        return 0;
+    }
+    
+    uint64_t varying = 0;
+    for (size_t i = 1; i < syms->symc; ++i) {
+        varying |= syms->symv[i].vmaddr ^ syms->symv[0].vmaddr;
+    }
+    if (varying == 0) {
+        return 0;
+    }
+    
+    malloc_chk(tmp, sizeof(struct symbol) * syms->symc);
+    
+    unsigned partc = 1;
+    if (syms->symc >= 2 * SYMBOLS_RADIX_PARALLEL_MIN) {
+        const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        partc = min(min((size_t) (ncpu > 0 ? ncpu : 1), syms->symc / SYMBOLS_RADIX_PARALLEL_MIN), SYMBOLS_RADIX_MAX_THREADS);
+    }
+    struct symbols_radix radix;
+    struct symbols_radix_part partv[SYMBOLS_RADIX_MAX_THREADS];
+    for (unsigned t = 0; t < partc; ++t) {
+        partv[t].radix = &radix;
+        partv[t].begin = syms->symc * t / partc;
+        partv[t].end = syms->symc * (t + 1) / partc;
+    }
+    
+    struct symbol *src = syms->symv, *dst = tmp;
+    for (unsigned shift = 0; shift < 64; shift += SYMBOLS_RADIX_BITS) {
+        if (((varying >> shift) & (SYMBOLS_RADIX_SIZE - 1)) == 0) {
+            continue;
+        }
+        radix.src = src;
+        radix.dst = dst;
+        radix.shift = shift;
+        
+        symbols_radix_run(partv, partc, &symbols_radix_count);
+        
+        /* digit-major, part-minor prefix sums keep equal keys in table order */
+        size_t offset = 0;
+        for (size_t d = 0; d < SYMBOLS_RADIX_SIZE; ++d) {
+            for (unsigned t = 0; t < partc; ++t) {
+                const size_t count = partv[t].count[d];
+                partv[t].count[d] = offset;
+                offset += count;
+            }
+        }
+        
+        symbols_radix_run(partv, partc, &symbols_radix_scatter);
+        
+        struct symbol *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    
+    if (src != syms->symv) {
+        memcpy(syms->symv, src, sizeof(struct symbol) * syms->symc);
     }
+    free(tmp);
     return 0;
+    
+error:
+    return -1;
 }
 
-static void symbols_add(struct symbols *syms, const struct symbol *sym) {
-    syms->symv[syms->symc++] = *sym;
+static const struct core_segment *symbols_text_segment(const struct core *core) {
+    for (size_t i = 0; i < core->segc; ++i) {
+        if (strcmp(core->segv[i].name, SEG_TEXT) == 0) {
+            return &core->segv[i];
+        }
+    }
+    return NULL;
 }
 
-static int symbols_sort_cmp(const struct symbol *a, const struct symbol *b) {
-    return a->vmaddr - b->vmaddr;
+/* build page index over the image's __TEXT segment; symbols must already be sorted */
+static int symbols_index_pages(const struct core *core, struct symbols *syms) {
+    const struct core_segment *text = symbols_text_segment(core);
+    if (text == NULL || text->vmsize == 0 || syms->symc > UINT32_MAX) {
+        return 0; // nothing to index; symbols_find falls back to binary search
+    }
+    
+    const size_t pagec = (text->vmsize + CORE_PAGE_SIZE - 1) >> CORE_PAGE_SHIFT;
+    if ((syms->pagev = calloc(pagec, sizeof(uint32_t))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    syms->pagebase = text->vmbase;
+    syms->pagec = pagec;
+    
+    size_t j = 0;
+    for (size_t i = 0; i < pagec; ++i) {
+        const uint64_t pagestart = text->vmbase + (i << CORE_PAGE_SHIFT);
+        while (j < syms->symc && syms->symv[j].vmaddr <= pagestart) {
+            ++j;
+        }
+        syms->pagev[i] = j;
+    }
+    
+    return 0;
+    
+error:
+    return -1;
 }
 
-static void symbols_sort(struct symbols *syms) {
-    qsort(syms->symv, syms->symc, sizeof(struct symbol), (int (*)(const void *, const void *)) &symbols_sort_cmp);
+static uint64_t symbols_uleb128(const uint8_t **pp, const uint8_t *end) {
+    const uint8_t *p = *pp;
+    uint64_t value = 0;
+    unsigned shift = 0;
+    while (p < end) {
+        const uint8_t byte = *p++;
+        if (shift < 64) {
+            value |= (uint64_t) (byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    *pp = p;
+    return value;
 }
 
-// returns containing function
+#define SYMBOLS_HIGH_BITS 0x8080808080808080ULL
+#define SYMBOLS_LOW_BITS  0x0101010101010101ULL
 
-static int symbols_find_cmp(const uint64_t *vmaddr, const struct symbol *sym) {
-    return *vmaddr - sym->vmaddr;
+/* decode the ULEB128 delta stream of LC_FUNCTION_STARTS into function starts.
+ * Runs of eight one-byte deltas (the common case) are detected and summed a word at a time. */
+static size_t symbols_decode_function_starts(const uint8_t *p, const uint8_t *end, uint64_t addr, struct function *funcv) {
+    size_t funcc = 0;
+    
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            const bool has_zero = ((word - SYMBOLS_LOW_BITS) & ~word & SYMBOLS_HIGH_BITS) != 0;
+            if (!(word & SYMBOLS_HIGH_BITS) && !has_zero) {
+                /* eight complete, non-terminating deltas (little-endian byte order) */
+                for (unsigned k = 0; k < 8; ++k) {
+                    addr += (word >> (8 * k)) & 0xff;
+                    funcv[funcc++].vmbase = addr;
+                }
+                p += 8;
+                continue;
+            }
+        }
+        
+        const uint64_t delta = symbols_uleb128(&p, end);
+        if (delta == 0 || (p[-1] & 0x80)) {
+            break; // terminator, or a delta cut off by the end of the data
+        }
+        addr += delta;
+        funcv[funcc++].vmbase = addr;
+    }
+    
+    return funcc;
 }
 
+static int symbols_handle_function_starts(struct core *core, struct symbols *syms, const struct linkedit_data_command *fstarts) {
+    uint8_t *data = NULL;
+    
+    const struct core_segment *text;
+    if ((text = symbols_text_segment(core)) == NULL || fstarts->datasize == 0) {
+        return 0;
+    }
+    
+    off_t vm_dataoff;
+    if ((vm_dataoff = core_ftovm(core, fstarts->dataoff)) < 0) {
+        goto error;
+    }
+    fseek_chk(core->vm, vm_dataoff, SEEK_SET);
+    malloc_chk(data, fstarts->datasize);
+    fread_chk(data, fstarts->datasize, core->vm);
+    
+    /* every delta takes at least one byte */
+    free(syms->funcv);
+    malloc_chk(syms->funcv, sizeof(struct function) * fstarts->datasize);
+    syms->funcc = symbols_decode_function_starts(data, data + fstarts->datasize, text->vmbase, syms->funcv);
+    
+    const uint64_t text_end = text->vmbase + text->vmsize;
+    for (size_t i = 0; i < syms->funcc; ++i) {
+        struct function *func = &syms->funcv[i];
+        const uint64_t func_end = i + 1 < syms->funcc ? syms->funcv[i + 1].vmbase : text_end;
+        func->vmsize = func_end > func->vmbase ? func_end - func->vmbase : 0;
+    }
+    
+    free(data);
+    return 0;
+    
+error:
+    free(data);
+    return -1;
+}
+
+const struct function *symbols_find_function(const struct symbols *syms, uint64_t vmaddr) {
+    size_t lo = 0, hi = syms->funcc;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (syms->funcv[mid].vmbase <= vmaddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    const struct function *func = &syms->funcv[lo - 1];
+    if (vmaddr - func->vmbase >= func->vmsize) {
+        return NULL;
+    }
+    return func;
+}
+
+// returns containing function
+
 const struct symbol *symbols_find(const struct symbols *syms, uint64_t vmaddr) {
-    const struct symbol *prev = NULL;
     size_t i;
-    for (i = 0; i < syms->symc && syms->symv[i].vmaddr <= vmaddr; ++i) {}
-
+    const uint64_t page = (vmaddr - syms->pagebase) >> CORE_PAGE_SHIFT;
+    if (vmaddr >= syms->pagebase && page < syms->pagec) {
+        /* short scan from the symbol covering the start of the page */
+        for (i = syms->pagev[page]; i < syms->symc && syms->symv[i].vmaddr <= vmaddr; ++i) {}
+    } else {
+        /* find first symbol past vmaddr */
+        size_t lo = 0, hi = syms->symc;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (syms->symv[mid].vmaddr <= vmaddr) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        i = lo;
+    }
+    
     if (i == 0) {
         return NULL;
-    } else {
-        return &syms->symv[i - 1];
     }
+    
+    const struct symbol *sym = &syms->symv[i - 1];
+    if (syms->funcc > 0) {
+        /* don't blame a preceding function for stripped or padding bytes; data outside the functions' range resolves as usual */
+        const struct function *last = &syms->funcv[syms->funcc - 1];
+        const struct function *func;
+        if (syms->funcv[0].vmbase <= vmaddr && vmaddr < last->vmbase + last->vmsize &&
+            ((func = symbols_find_function(syms, vmaddr)) == NULL || sym->vmaddr < func->vmbase)) {
+            return NULL;
+        }
+    }
+    return sym;
 }
 
-int symbols_open(struct core *core, struct symbols *syms) {
-    symbols_init(syms);
-
-    rewind(core->f);
+/* FNV-1a */
+static uint64_t symbols_hash_name(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char *) name; *p != '\0'; ++p) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h;
+}
 
-    uint32_t magic;
+/* power of two with load factor <= 1/2 */
+static size_t symbols_hash_size(size_t symc) {
+    size_t hashc = 16;
+    while (hashc < symc * 2) {
+        hashc <<= 1;
+    }
+    return hashc;
+}
 
-    if (fread_peek(&magic, sizeof(magic), 1, core->f) < 0) {
+static int symbols_hash_build(struct symbols *syms) {
+    if (syms->symc >= UINT32_MAX) {
+        errno = EOVERFLOW;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    const size_t hashc = symbols_hash_size(syms->symc);
+    uint32_t *hashv;
+    if ((hashv = calloc(hashc, sizeof(uint32_t))) == NULL) {
+        errfn = "calloc";
         goto error;
     }
+    
+    const size_t mask = hashc - 1;
+    for (size_t i = 0; i < syms->symc; ++i) {
+        const char *name = syms->symv[i].name;
+        for (size_t j = symbols_hash_name(name) & mask; ; j = (j + 1) & mask) {
+            if (hashv[j] == 0) {
+                hashv[j] = i + 1;
+                break;
+            }
+            if (strcmp(syms->symv[hashv[j] - 1].name, name) == 0) {
+                break; // keep lowest-addressed alias
+            }
+        }
+    }
+    
+    syms->hashc = hashc;
+    syms->hashv = hashv;
+    return 0;
+    
+error:
+    return -1;
+}
 
-    if (magic == MH_MAGIC) {
-        if (symbols_open_macho32(core, syms) < 0) {
+const struct symbol *symbols_lookup_name(struct symbols *syms, const char *name) {
+    if (syms->hashv == NULL) {
+        if (symbols_hash_build(syms) < 0) {
+            return NULL;
+        }
+    }
+    
+    const size_t mask = syms->hashc - 1;
+    for (size_t j = symbols_hash_name(name) & mask; syms->hashv[j] != 0; j = (j + 1) & mask) {
+        const size_t i = syms->hashv[j] - 1;
+        if (i < syms->symc && strcmp(syms->symv[i].name, name) == 0) {
+            return &syms->symv[i];
+        }
+    }
+    
+    return NULL;
+}
+
+#define SYMBOLS_HASH_MAGIC 0x68736d79 // 'ymsh'
+
+struct symbols_hash_header {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t symc;
+    uint64_t hashc;
+};
+
+int symbols_hash_save(struct symbols *syms, FILE *f) {
+    if (syms->hashv == NULL) {
+        if (symbols_hash_build(syms) < 0) {
             goto error;
         }
-    } else {
+    }
+    
+    struct symbols_hash_header hdr;
+    hdr.magic = SYMBOLS_HASH_MAGIC;
+    hdr.reserved = 0;
+    hdr.symc = syms->symc;
+    hdr.hashc = syms->hashc;
+    fwrite_one_chk(hdr, f);
+    fwrite_chk(syms->hashv, syms->hashc, f);
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+int symbols_hash_load(struct symbols *syms, FILE *f) {
+    uint32_t *hashv = NULL;
+    
+    struct symbols_hash_header hdr;
+    fread_one_chk(hdr, f);
+    
+    /* table must belong to this symbol table */
+    if (hdr.magic != SYMBOLS_HASH_MAGIC || hdr.symc != syms->symc || hdr.hashc != symbols_hash_size(syms->symc)) {
         errno = EINVAL;
         errfn = __FUNCTION__;
         goto error;
     }
     
-    symbols_sort(syms);
+    malloc_chk(hashv, sizeof(uint32_t) * hdr.hashc);
+    fread_chk(hashv, hdr.hashc, f);
     
+    /* every slot must be empty or name a symbol, and probing must hit an empty slot to terminate */
+    size_t empty = 0;
+    for (size_t j = 0; j < hdr.hashc; ++j) {
+        if (hashv[j] == 0) {
+            ++empty;
+        } else if (hashv[j] > syms->symc) {
+            errno = EINVAL;
+            errfn = __FUNCTION__;
+            goto error;
+        }
+    }
+    if (empty == 0) {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    
+    free(syms->hashv);
+    syms->hashc = hdr.hashc;
+    syms->hashv = hashv;
     return 0;
     
 error:
+    free(hashv);
     return -1;
 }
 
-static int symbols_macho32_handle_symtab(struct core *core, struct symbols *syms, struct symtab_command *symtab);
-static int symbols_open_macho32(struct core *core, struct symbols *syms) {
-    struct mach_header hdr;
-    fread_one_chk(hdr, core->f);
-    assert(hdr.magic == MH_MAGIC);
-    
-    for (size_t i = 0; i < hdr.ncmds; ++i) {
-        struct load_command *cmd;
-        if ((cmd = macho_parse_lc(core->f)) == NULL) {
+/* symbols gathered from the symbol table and the export trie into syms->symv */
+struct symbols_collect_ctx {
+    struct symbols *syms;
+    size_t cap;
+    int err;
+};
+
+static int symbols_collect(const char *name, uint64_t vmaddr, struct symbols_collect_ctx *ctx) {
+    struct symbols *syms = ctx->syms;
+    if (syms->symc == ctx->cap) {
+        /* on failure symv is kept, so that symbols_close frees the names gathered so far */
+        const size_t cap = max(ctx->cap * 2, 256);
+        struct symbol *symv;
+        if ((symv = realloc(syms->symv, sizeof(struct symbol) * cap)) == NULL) {
+            errfn = "realloc";
             goto error;
         }
-        
-        switch (cmd->cmd) {
-            case LC_SYMTAB: {
-                struct symtab_command *symtab = (struct symtab_command *) cmd;
-                fpos_t pos;
-                if (fgetpos(core->f, &pos) < 0) {
-                    errfn = "fgetpos";
-                    goto error;
-                }
-                if (symbols_macho32_handle_symtab(core, syms, symtab) < 0) {
-                    goto error;
-                }
-                if (fsetpos(core->f, &pos) < 0) {
-                    errfn = "fsetpos";
-                    goto error;
-                }
+        syms->symv = symv;
+        ctx->cap = cap;
+    }
+    struct symbol *sym = &syms->symv[syms->symc];
+    if ((sym->name = strdup(name)) == NULL) {
+        errfn = "strdup";
+        goto error;
+    }
+    sym->vmaddr = vmaddr;
+    ++syms->symc;
+    return 0;
+    
+error:
+    ctx->err = -1;
+    return -1;
+}
+
+static int symbols_add_export(const struct export *exp, struct symbols_collect_ctx *ctx) {
+    if ((exp->flags & EXPORT_SYMBOL_FLAGS_REEXPORT)) {
+        return 0; // defined in another image
+    }
+    return symbols_collect(exp->name, exp->vmaddr, ctx);
+}
+
+static int symbols_handle_exports(struct core *core, struct symbols_collect_ctx *ctx) {
+    struct exports exps;
+    if (exports_open(core, &exps) < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        goto error;
+    }
+    
+    if (exports_foreach(&exps, (exports_fn *) &symbols_add_export, ctx) < 0 || ctx->err < 0) {
+        goto error;
+    }
+    
+    return 0;
+    
+error:
+    return -1;
+}
+
+/* drop duplicates at the same address, e.g. an export also present in the symtab; symbols must be sorted */
+static void symbols_unique(struct symbols *syms) {
+    size_t j = 0;
+    for (size_t i = 0; i < syms->symc; ++i) {
+        struct symbol *sym = &syms->symv[i];
+        bool dup = false;
+        for (size_t k = j; k > 0 && syms->symv[k - 1].vmaddr == sym->vmaddr; --k) {
+            if (strcmp(syms->symv[k - 1].name, sym->name) == 0) {
+                dup = true;
                 break;
             }
         }
-        
-        free(cmd);
+        if (dup) {
+            free(sym->name);
+        } else {
+            syms->symv[j++] = *sym;
+        }
+    }
+    syms->symc = j;
+}
+
+int symbols_open(struct core *core, struct symbols *syms) {
+    return symbols_open_flags(core, syms, 0);
+}
+
+/* walk the symbol table of an image of either width; syms receives function starts if asked for */
+static int symbols_walk(struct core *core, struct symbols *syms, int flags, symbols_fn *fn, void *ctx) {
+    rewind(core->f);
+    
+    uint32_t magic;
+    
+    if (fread_peek(&magic, sizeof(magic), 1, core->f) < 0) {
+        return -1;
+    }
+    
+    if (magic == MH_MAGIC || magic == MH_CIGAM) {
+        return symbols_open_macho(core, syms, flags, sizeof(struct nlist), (symbols_swap_fn *) &macho_swap_nlist, fn, ctx);
+    } else if (magic == MH_MAGIC_64 || magic == MH_CIGAM_64) {
+        return symbols_open_macho(core, syms, flags, sizeof(struct nlist_64), (symbols_swap_fn *) &macho_swap_nlist_64, fn, ctx);
+    } else {
+        errno = EINVAL;
+        errfn = __FUNCTION__;
+        return -1;
+    }
+}
+
+int symbols_foreach(struct core *core, int flags, symbols_fn *fn, void *ctx) {
+    return symbols_walk(core, NULL, flags & (SYMBOLS_EXTDEF | SYMBOLS_NO_LOCAL), fn, ctx);
+}
+
+int symbols_open_flags(struct core *core, struct symbols *syms, int flags) {
+    symbols_init(syms);
+    
+    struct symbols_collect_ctx ctx = {syms, 0, 0};
+    if (symbols_walk(core, syms, flags, (symbols_fn *) &symbols_collect, &ctx) != 0) {
+        goto error;
+    }
+    
+    if ((flags & SYMBOLS_EXPORTS)) {
+        if (symbols_handle_exports(core, &ctx) < 0) {
+            goto error;
+        }
+    }
+    
+    /* give back the slack of the doubling */
+    if (syms->symc != 0 && syms->symc < ctx.cap) {
+        struct symbol *symv;
+        if ((symv = realloc(syms->symv, sizeof(struct symbol) * syms->symc)) != NULL) {
+            syms->symv = symv;
+        }
+    }
+    
+    if (symbols_sort(syms) < 0) {
+        goto error;
+    }
+    
+    if ((flags & SYMBOLS_EXPORTS)) {
+        symbols_unique(syms);
+    }
+    
+    if ((flags & SYMBOLS_PAGE_INDEX)) {
+        if (symbols_index_pages(core, syms) < 0) {
+            goto error;
+        }
     }
     
     return 0;
     
 error:
+    symbols_close(syms);
     return -1;
 }
 
-static int symbols_macho32_handle_symtab(struct core *core, struct symbols *syms, struct symtab_command *symtab) {
-    /* read string table */
-    off_t vm_stroff, vm_symoff;
-    if ((vm_stroff = core_ftovm(core, symtab->stroff)) < 0 ||
-        (vm_symoff = core_ftovm(core, symtab->symoff)) < 0) {
-        goto error;
+/* returns symbol's name if it should be kept, otherwise NULL */
+static const char *symbols_filter(const struct symtab_command *symtab, const char *strtab, uint8_t n_type, uint32_t strx, int flags) {
+    // check symbol class
+    if ((n_type & N_EXT) ? !(flags & SYMBOLS_EXTDEF) : (flags & SYMBOLS_NO_LOCAL)) {
+        return NULL;
+    }
+    switch (n_type & N_TYPE) {
+        case N_SECT:
+            break;
+        default:
+            return NULL;
     }
     
-    fprintf(stderr, "vm_stroff=%08llx, vm_symoff=%08llx\n", vm_stroff, vm_symoff);
+    /* check if stroff is in bounds */
+    if (strx >= symtab->strsize) {
+        return NULL;
+    }
+    
+    const char *s = strtab + strx;
+    if (strx == 0 || *s == '\0') {
+        return NULL;
+    }
     
+    if ((n_type & N_STAB)) {
+        return NULL;
+    }
+    
+    return s;
+}
+
+struct symbols_range {
+    uint32_t first;
+    uint32_t count;
+};
+
+/* partitions of the symbol table holding the requested classes; the whole table without a usable LC_DYSYMTAB */
+static size_t symbols_ranges(const struct symtab_command *symtab, const struct dysymtab_command *dysymtab, int flags, struct symbols_range rangev[2]) {
+    if (dysymtab == NULL ||
+        dysymtab->ilocalsym > symtab->nsyms || dysymtab->nlocalsym > symtab->nsyms - dysymtab->ilocalsym ||
+        dysymtab->iextdefsym > symtab->nsyms || dysymtab->nextdefsym > symtab->nsyms - dysymtab->iextdefsym) {
+        rangev[0].first = 0;
+        rangev[0].count = symtab->nsyms;
+        return 1;
+    }
+    
+    size_t rangec = 0;
+    if (!(flags & SYMBOLS_NO_LOCAL)) {
+        rangev[rangec].first = dysymtab->ilocalsym;
+        rangev[rangec].count = dysymtab->nlocalsym;
+        ++rangec;
+    }
+    if ((flags & SYMBOLS_EXTDEF)) {
+        rangev[rangec].first = dysymtab->iextdefsym;
+        rangev[rangec].count = dysymtab->nextdefsym;
+        ++rangec;
+    }
+    return rangec;
+}
+
+/* read string table; strings are NUL-terminated even if the table isn't */
+static char *symbols_read_strtab(struct core *core, const struct symtab_command *symtab) {
+    char *strtab = NULL;
+    off_t vm_stroff;
+    if ((vm_stroff = core_ftovm(core, symtab->stroff)) < 0) {
+        goto error;
+    }
     fseek_chk(core->vm, vm_stroff, SEEK_SET);
-    char *strtab;
-    malloc_chk(strtab, symtab->strsize);
+    malloc_chk(strtab, symtab->strsize + 1);
     fread_chk(strtab, symtab->strsize, core->vm);
+    strtab[symtab->strsize] = '\0';
+    return strtab;
     
+error:
+    free(strtab);
+    return NULL;
+}
 
-    fseek_chk(core->vm, vm_symoff, SEEK_SET);
-    if (symbols_reserve(syms, symtab->nsyms) < 0) {
+/* nlist entries are read this many at a time, so a bogus nsyms can't make us allocate more */
+#define SYMBOLS_NLIST_CHUNK 4096
+
+_Static_assert(offsetof(struct nlist, n_un.n_strx) == offsetof(struct nlist_64, n_un.n_strx) &&
+               offsetof(struct nlist, n_type) == offsetof(struct nlist_64, n_type), "nlist prefix differs by width");
+               
+/* calls fn for each kept symbol of an nlist or nlist_64 table; returns 0, -1 on error, or fn's nonzero result */
+static int symbols_handle_symtab(struct core *core, const struct symtab_command *symtab, const struct dysymtab_command *dysymtab,
+                                 size_t nlsize, symbols_swap_fn *swap, int flags, symbols_fn *fn, void *ctx) {
+    char *strtab = NULL;
+    char *nlv = NULL;
+    int res = 0;
+    
+    if ((strtab = symbols_read_strtab(core, symtab)) == NULL) {
         goto error;
     }
     
-    for (size_t i = 0; i < symtab->nsyms; ++i) {
-        struct nlist sym;
-        fread_one_chk(sym, core->vm);
-
-        // check symbol type
-        if ((sym.n_type & N_EXT)) {
-            // external, so ignore
-            continue;
-        }
-        switch (sym.n_type & N_TYPE) {
-            case N_SECT:
-                break;
-            default:
-                continue;
-        }
-        
-        /* check if stroff is in bounds */
-        const size_t strx = sym.n_un.n_strx;
-        if (strx >= symtab->strsize) {
-            continue;
+    off_t vm_symoff;
+    if ((vm_symoff = core_ftovm(core, symtab->symoff)) < 0) {
+        goto error;
+    }
+    
+    struct symbols_range rangev[2];
+    const size_t rangec = symbols_ranges(symtab, dysymtab, flags, rangev);
+    size_t largest = 0;
+    for (size_t r = 0; r < rangec; ++r) {
+        largest = max(largest, rangev[r].count);
+    }
+    malloc_chk(nlv, nlsize * max(min(largest, SYMBOLS_NLIST_CHUNK), 1));
+    
+    for (size_t r = 0; r < rangec && res == 0; ++r) {
+        fseek_chk(core->vm, vm_symoff + (off_t) rangev[r].first * nlsize, SEEK_SET);
+        for (size_t done = 0, nlc; done < rangev[r].count && res == 0; done += nlc) {
+            nlc = min(rangev[r].count - done, SYMBOLS_NLIST_CHUNK);
+            fread_chk(nlv, nlc * nlsize, core->vm);
+            if (core->swap) {
+                swap(nlv, nlc);
+            }
+            
+            for (size_t i = 0; i < nlc; ++i) {
+                const char *entry = nlv + i * nlsize;
+                const struct nlist *sym = (const struct nlist *) entry;
+                const uint64_t n_value = nlsize == sizeof(struct nlist_64) ? ((const struct nlist_64 *) entry)->n_value : sym->n_value;
+                
+                const char *s;
+                if ((s = symbols_filter(symtab, strtab, sym->n_type, sym->n_un.n_strx, flags)) == NULL) {
+                    continue;
+                }
+                
+                if ((res = fn(s, n_value, ctx)) != 0) {
+                    break;
+                }
+            }
         }
-        
-        const char *s = strtab + strx;
-        if (strx == 0 || *s == '\0') {
-            continue;
+    }
+    
+    free(nlv);
+    free(strtab);
+    return res;
+    
+error:
+    fprintf(stderr, "%s error\n", __FUNCTION__);
+    free(nlv);
+    free(strtab);
+    return -1;
+}
+
+/* load commands of a 32- or 64-bit image, told apart by nlist entry size */
+static int symbols_open_macho(struct core *core, struct symbols *syms, int flags, size_t nlsize, symbols_swap_fn *swap,
+                              symbols_fn *fn, void *ctx) {
+    struct symtab_command *symtab = NULL;
+    struct dysymtab_command *dysymtab = NULL;
+    
+    /* the 64-bit header only adds a reserved word */
+    struct mach_header_64 hdr;
+    const size_t hdrsize = nlsize == sizeof(struct nlist_64) ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    fread_chk((char *) &hdr, hdrsize, core->f);
+    if (core->swap) {
+        macho_swap_header((struct mach_header *) &hdr);
+    }
+    assert(hdr.magic == (hdrsize == sizeof(struct mach_header_64) ? MH_MAGIC_64 : MH_MAGIC));
+    
+    for (size_t i = 0; i < hdr.ncmds; ++i) {
+        struct load_command *cmd;
+        if ((cmd = macho_parse_lc_swap(core->f, core->swap, core->cputype)) == NULL) {
+            goto error;
         }
         
-        if ((sym.n_type & N_STAB)) {
-            continue;
+        switch (cmd->cmd) {
+            case LC_SYMTAB: {
+                /* handled once LC_DYSYMTAB, which may come later, has been seen */
+                free(symtab);
+                symtab = (struct symtab_command *) cmd;
+                cmd = NULL;
+                break;
+            }
+                
+            case LC_DYSYMTAB: {
+                free(dysymtab);
+                dysymtab = (struct dysymtab_command *) cmd;
+                cmd = NULL;
+                break;
+            }
+                
+            case LC_FUNCTION_STARTS: {
+                if (!(flags & SYMBOLS_FUNCTION_STARTS)) {
+                    break;
+                }
+                fpos_t pos;
+                fgetpos_chk(core->f, &pos);
+                if (symbols_handle_function_starts(core, syms, (struct linkedit_data_command *) cmd) < 0) {
+                    goto error;
+                }
+                fsetpos_chk(core->f, &pos);
+                break;
+            }
         }
         
-        // fprintf(stderr, "name=%s desc=%hx sect=%hhx pext=%hhx\n", s, sym.n_desc, sym.n_sect, sym.n_type & N_PEXT);
-        
-        struct symbol sym_;
-        if ((sym_.name = strdup(s)) == NULL) {
-            errfn = "strdup";
-            goto error;
-        }
-        sym_.vmaddr = sym.n_value;
-        symbols_add(syms, &sym_);
+        free(cmd);
     }
     
-    return 0;
+    int res = 0;
+    if (symtab != NULL) {
+        res = symbols_handle_symtab(core, symtab, dysymtab, nlsize, swap, flags, fn, ctx);
+    }
+    
+    free(symtab);
+    free(dysymtab);
+    return res;
     
 error:
-    fprintf(stderr, "%s error\n", __FUNCTION__);
+    free(symtab);
+    free(dysymtab);
     return -1;
 }
@@ -14,19 +14,68 @@ struct symbol {
     char *name;
 };
 
+enum symbols_flags {
+    SYMBOLS_PAGE_INDEX = 1 << 0, // build page-granular address index over __TEXT
+    SYMBOLS_EXTDEF     = 1 << 1, // also keep external (N_EXT) definitions
+    SYMBOLS_FUNCTION_STARTS = 1 << 2, // decode LC_FUNCTION_STARTS into function bounds
+    SYMBOLS_EXPORTS    = 1 << 3, // add exports from the dyld export trie (for stripped images)
+    SYMBOLS_NO_LOCAL   = 1 << 4, // drop local (non-N_EXT) symbols, e.g. with SYMBOLS_EXTDEF for public names only
+};
+
+/* with LC_DYSYMTAB, only the partitions of the symbol table holding kept symbols are read */
+
+struct function {
+    uint64_t vmbase;
+    uint64_t vmsize;
+};
+
 struct symbols {
     size_t symc;
     struct symbol *symv;
+    
+    /* optional page index: symv[pagev[(vmaddr - pagebase) >> CORE_PAGE_SHIFT] - 1] covers the start of that page */
+    uint64_t pagebase;
+    size_t pagec;
+    uint32_t *pagev;
+    
+    /* name hash: open-addressed table of symv indices plus one (0 = empty), built on first lookup */
+    size_t hashc;
+    uint32_t *hashv;
+    
+    /* function bounds from LC_FUNCTION_STARTS, sorted; each runs to the next start or the end of __TEXT */
+    size_t funcc;
+    struct function *funcv;
 };
 
 int symbols_open(struct core *core, struct symbols *syms);
+int symbols_open_flags(struct core *core, struct symbols *syms, int flags);
+void symbols_close(struct symbols *syms);
+
+/* called for each symbol with its unslid address; name is only valid during the call. return nonzero to stop */
+typedef int symbols_fn(const char *name, uint64_t vmaddr, void *ctx);
+
+/* stream the symbols symbols_open_flags would keep, in symbol table order, without building a table;
+ * only SYMBOLS_EXTDEF and SYMBOLS_NO_LOCAL apply. returns 0, -1 on error, or the nonzero value returned by fn. */
+int symbols_foreach(struct core *core, int flags, symbols_fn *fn, void *ctx);
 
 #if 0
 void symbols_perror(const char *s);
 #endif
 
+/* with function bounds, an address in the __TEXT range they cover resolves only to a symbol starting in its own function */
 const struct symbol *symbols_find(const struct symbols *syms, uint64_t vmaddr);
 
+/* function containing vmaddr; requires SYMBOLS_FUNCTION_STARTS */
+const struct function *symbols_find_function(const struct symbols *syms, uint64_t vmaddr);
+
+/* name to symbol lookup; builds the name hash on first use */
+const struct symbol *symbols_lookup_name(struct symbols *syms, const char *name);
+int symbols_hash_save(struct symbols *syms, FILE *f);
+
+/* install a table written by symbols_hash_save; fails with EINVAL, keeping the current table,
+ * if it is malformed or was saved for a different symbol table */
+int symbols_hash_load(struct symbols *syms, FILE *f);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,151 @@
+/* symd's listening socket and poll loop; requests are served by symd.c */
+ 
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "core.h"
+#include "symd.h"
+#include "util.h"
+
+#define SYMD_MAX_CLIENTS 256
+#define SYMD_MAX_CORES 256
+#define SYMD_ACCEPT_BACKOFF 100 // ms the listening socket is left alone after accept fails
+
+static int symd_listen(const char *path) {
+    int fd = -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        errfn = __FUNCTION__;
+        goto error;
+    }
+    strcpy(addr.sun_path, path);
+    
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        errfn = "socket";
+        goto error;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        errfn = "bind";
+        goto error;
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        errfn = "listen";
+        goto error;
+    }
+    return fd;
+    
+error:
+    if (fd >= 0) {
+        close(fd);
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t budget = 1024UL << 20, maxcores = SYMD_MAX_CORES;
+    
+    int ch;
+    while ((ch = getopt(argc, argv, "m:n:")) != -1) {
+        switch (ch) {
+            case 'm':
+                budget = strtoul(optarg, NULL, 0) << 20;
+                break;
+            case 'n':
+                maxcores = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                goto usage;
+        }
+    }
+    if (argc - optind != 1) {
+        goto usage;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    struct symd_cache cache;
+    symd_cache_init(&cache, budget, maxcores);
+    
+    int lfd;
+    if ((lfd = symd_listen(argv[optind])) < 0) {
+        core_perror("symd_listen");
+        return EXIT_FAILURE;
+    }
+    
+    struct symd_client clientv[SYMD_MAX_CLIENTS];
+    struct pollfd pfdv[SYMD_MAX_CLIENTS + 1];
+    size_t clientc = 0;
+    bool paused = false; // accept failed; retried once a client goes away or the backoff runs out
+    
+    while (1) {
+        pfdv[0].fd = lfd;
+        pfdv[0].events = clientc < SYMD_MAX_CLIENTS && !paused ? POLLIN : 0;
+        for (size_t i = 0; i < clientc; ++i) {
+            pfdv[i + 1].fd = clientv[i].fd;
+            pfdv[i + 1].events = (!clientv[i].eof && clientv[i].out.len < SYMD_MAX_BACKLOG ? POLLIN : 0) | (clientv[i].out.len > 0 ? POLLOUT : 0);
+        }
+        int ready;
+        if ((ready = poll(pfdv, clientc + 1, paused ? SYMD_ACCEPT_BACKOFF : -1)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return EXIT_FAILURE;
+        }
+        if (ready == 0) {
+            paused = false;
+        }
+        
+        /* service clients, compacting out the ones that went away */
+        size_t j = 0;
+        for (size_t i = 0; i < clientc; ++i) {
+            struct symd_client *client = &clientv[i];
+            if (pfdv[i + 1].revents != 0 && symd_service(&cache, client, pfdv[i + 1].revents) < 0) {
+                symd_client_close(client);
+                continue;
+            }
+            clientv[j++] = *client;
+        }
+        if (j < clientc) {
+            paused = false;
+        }
+        clientc = j;
+        
+        if ((pfdv[0].revents & POLLIN)) {
+            int fd;
+            if ((fd = accept(lfd, NULL, NULL)) >= 0) {
+                /* responses are queued in client->out and sent as the socket drains, never blocking the loop */
+                if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+                    perror("fcntl");
+                    close(fd);
+                    continue;
+                }
+                struct symd_client *client = &clientv[clientc++];
+                memset(client, 0, sizeof(*client));
+                client->fd = fd;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED) {
+                /* out of descriptors: close an idle core, or stop polling the socket, which stays readable, for a while */
+                if (!((errno == EMFILE || errno == ENFILE) && symd_cache_evict(&cache, NULL))) {
+                    perror("accept");
+                    paused = true;
+                }
+            }
+        }
+    }
+    
+usage:
+    fprintf(stderr, "usage: %s [-m budget_mb] [-n max_cores] <socket>\n", argv[0]);
+    return EXIT_FAILURE;
+}
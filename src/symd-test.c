@@ -0,0 +1,206 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "core.h"
+#include "symd.h"
+#include "test.h"
+
+/* requests written to one end of a socketpair come back answered, in order, from symd_service on the other */
+
+#define TEST_IMAGE_BASE 0x100000000ULL
+#define TEST_IMAGE_TEXT (4 * CORE_PAGE_SIZE)
+#define TEST_IMAGE_SLID 0x7000000ULL
+
+/* core holding one image, slid to TEST_IMAGE_SLID */
+static void test_save_core(const char *path, const struct test_symbol *symv, size_t symc) {
+    struct test_image img, cimg;
+    test_image_init(&img, true, false, MH_EXECUTE);
+    test_image_symtab(&img, symv, symc);
+    test_image_segments(&img, TEST_IMAGE_BASE, TEST_IMAGE_TEXT);
+    fclose(test_image_file(&img)); // writes img's header
+    
+    test_image_init(&cimg, true, false, MH_CORE);
+    const size_t text = test_image_data(&cimg, NULL, TEST_IMAGE_TEXT, CORE_PAGE_SIZE);
+    memcpy(cimg.buf + text, img.buf, TEST_IMAGE_DATA);
+    test_image_segment(&cimg, "", TEST_IMAGE_SLID, TEST_IMAGE_TEXT, text, TEST_IMAGE_TEXT, VM_PROT_READ | VM_PROT_EXECUTE, 0);
+    const size_t size = img.size - TEST_IMAGE_DATA;
+    const size_t linkedit = test_image_data(&cimg, img.buf + TEST_IMAGE_DATA, size, CORE_PAGE_SIZE);
+    test_image_segment(&cimg, "", TEST_IMAGE_SLID + TEST_IMAGE_TEXT, size, linkedit, size, VM_PROT_READ, 0);
+    test_image_save(&cimg, path);
+    test_image_free(&cimg);
+    test_image_free(&img);
+}
+
+struct test_batch {
+    char data[4096];
+    size_t len;
+};
+
+static void test_batch_append(struct test_batch *batch, const void *data, size_t len) {
+    test_check(batch->len + len <= sizeof(batch->data));
+    memcpy(batch->data + batch->len, data, len);
+    batch->len += len;
+}
+
+static void test_batch_request(struct test_batch *batch, const char *path, const uint64_t *addrv, uint32_t addrc) {
+    const struct symd_request req = {SYMD_MAGIC, strlen(path), addrc};
+    test_batch_append(batch, &req, sizeof(req));
+    test_batch_append(batch, path, req.pathlen);
+    test_batch_append(batch, addrv, addrc * sizeof(uint64_t));
+}
+
+/* send the whole batch at once, serve it until the client is done, and collect the responses */
+static void test_round_trip(struct symd_cache *cache, const struct test_batch *req, struct test_batch *res) {
+    int sv[2];
+    test_check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    test_check(fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK) == 0);
+    test_check(write(sv[1], req->data, req->len) == (ssize_t) req->len);
+    test_check(shutdown(sv[1], SHUT_WR) == 0);
+    
+    struct symd_client client;
+    memset(&client, 0, sizeof(client));
+    client.fd = sv[0];
+    while (symd_service(cache, &client, POLLIN | POLLOUT) == 0) {}
+    test_check(client.eof && client.in.len == 0 && client.out.len == 0);
+    symd_client_close(&client);
+    
+    res->len = 0;
+    ssize_t n;
+    while ((n = read(sv[1], res->data + res->len, sizeof(res->data) - res->len)) > 0) {
+        res->len += n;
+    }
+    test_check(n == 0);
+    close(sv[1]);
+}
+
+struct test_reader {
+    const struct test_batch *batch;
+    size_t off;
+};
+
+static void test_read(struct test_reader *r, void *data, size_t len) {
+    test_check(r->off + len <= r->batch->len);
+    memcpy(data, r->batch->data + r->off, len);
+    r->off += len;
+}
+
+static void test_expect_response(struct test_reader *r, int32_t status, uint32_t resultc) {
+    struct symd_response res;
+    test_read(r, &res, sizeof(res));
+    test_check(res.magic == SYMD_MAGIC && res.status == status && res.resultc == resultc);
+}
+
+/* name NULL for no symbol */
+static void test_expect_result(struct test_reader *r, const char *name, uint64_t symaddr) {
+    struct symd_result result;
+    test_read(r, &result, sizeof(result));
+    if (name == NULL) {
+        test_check(result.symaddr == 0 && result.namelen == 0);
+        return;
+    }
+    char buf[64];
+    test_check(result.symaddr == symaddr && result.namelen == strlen(name));
+    test_read(r, buf, result.namelen);
+    test_check(memcmp(buf, name, result.namelen) == 0);
+}
+
+static void test_pipelined(void) {
+    const struct test_symbol symv[] = {
+        {"_b", N_SECT, 1, TEST_IMAGE_BASE + 0x200},
+        {"_a", N_SECT, 1, TEST_IMAGE_BASE + 0x100},
+    };
+    const struct test_symbol otherv[] = {
+        {"_c", N_SECT, 1, TEST_IMAGE_BASE + 0x100},
+    };
+    char dir[] = "/tmp/symd-test.XXXXXX";
+    test_check(mkdtemp(dir) != NULL);
+    char path[64], other[64];
+    snprintf(path, sizeof(path), "%s/core", dir);
+    snprintf(other, sizeof(other), "%s/other", dir);
+    test_save_core(path, symv, 2);
+    test_save_core(other, otherv, 1);
+    
+    /* one open core at a time, so every switch of core evicts the other */
+    struct symd_cache cache;
+    symd_cache_init(&cache, 1UL << 30, 1);
+    
+    struct test_batch req = {.len = 0}, res;
+    const uint64_t addrv[] = {TEST_IMAGE_SLID + 0x180, TEST_IMAGE_SLID + 0x10, 0x5000};
+    test_batch_request(&req, path, addrv, 3);
+    test_batch_request(&req, "/nonexistent/core", addrv, 1);
+    const uint64_t addr = TEST_IMAGE_SLID + 0x250;
+    test_batch_request(&req, path, &addr, 1);
+    test_batch_request(&req, other, &addr, 1);
+    test_round_trip(&cache, &req, &res);
+    
+    struct test_reader r = {&res, 0};
+    test_expect_response(&r, 0, 3);
+    test_expect_result(&r, "_a", TEST_IMAGE_SLID + 0x100);
+    test_expect_result(&r, NULL, 0); // in the image, before its first symbol
+    test_expect_result(&r, NULL, 0); // in no image
+    test_expect_response(&r, ENOENT, 0);
+    test_expect_response(&r, 0, 1);
+    test_expect_result(&r, "_b", TEST_IMAGE_SLID + 0x200);
+    test_expect_response(&r, 0, 1);
+    test_expect_result(&r, "_c", TEST_IMAGE_SLID + 0x100);
+    test_check(r.off == res.len);
+    test_check(cache.corec == 1);
+    
+    /* a core rewritten in place under the same path is opened afresh */
+    test_save_core(other, symv, 2);
+    struct timeval tv[2];
+    test_check(gettimeofday(&tv[0], NULL) == 0);
+    tv[0].tv_sec += 100;
+    tv[1] = tv[0];
+    test_check(utimes(other, tv) == 0);
+    req.len = 0;
+    test_batch_request(&req, other, &addr, 1);
+    test_round_trip(&cache, &req, &res);
+    r.off = 0;
+    test_expect_response(&r, 0, 1);
+    test_expect_result(&r, "_b", TEST_IMAGE_SLID + 0x200);
+    test_check(r.off == res.len && cache.corec == 1);
+    
+    symd_cache_close(&cache);
+    test_check(cache.corec == 0 && cache.bytes == 0 && cache.head == NULL && cache.tail == NULL);
+    unlink(path);
+    unlink(other);
+    rmdir(dir);
+}
+
+/* a bad request drops the client without answering it */
+static void test_bad_request(void) {
+    struct symd_cache cache;
+    symd_cache_init(&cache, 1UL << 30, 4);
+    struct test_batch req = {.len = 0}, res;
+    const struct symd_request bad = {SYMD_MAGIC + 1, 1, 0};
+    test_batch_append(&req, &bad, sizeof(bad));
+    test_batch_append(&req, "x", 1);
+    
+    int sv[2];
+    test_check(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    test_check(fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK) == 0);
+    test_check(write(sv[1], req.data, req.len) == (ssize_t) req.len);
+    struct symd_client client;
+    memset(&client, 0, sizeof(client));
+    client.fd = sv[0];
+    test_check(symd_service(&cache, &client, POLLIN) == -1 && client.out.len == 0);
+    symd_client_close(&client);
+    test_check(read(sv[1], res.data, sizeof(res.data)) == 0);
+    close(sv[1]);
+    symd_cache_close(&cache);
+}
+
+int main(void) {
+    test_pipelined();
+    test_bad_request();
+    return EXIT_SUCCESS;
+}
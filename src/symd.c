@@ -0,0 +1,375 @@
+/* symd: resident symbolication daemon over a Unix-domain socket.
+ * Keeps opened cores and their images' symbol tables warm, evicting the least
+ * recently used cores once the memory budget or the open core limit is exceeded.
+ * Addresses outside the core's own images are looked up in the dyld shared cache,
+ * if one is mapped. */
+ 
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "images.h"
+#include "dsc.h"
+#include "symbols.h"
+#include "symd.h"
+#include "util.h"
+
+#define SYMD_MAX_ADDRS (1 << 20)
+
+/* cached core, keyed by the file it was opened from; list is kept in most-recently-used order */
+struct symd_core {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime; // a core rewritten in place is opened afresh
+    struct core core;
+    struct core_images imgs;
+    bool dsc_open; // the core maps a shared cache
+    struct dsc dsc;
+    size_t bytes; // approximate resident footprint
+    struct symd_core *prev;
+    struct symd_core *next;
+};
+
+static int symd_buf_reserve(struct symd_buf *buf, size_t len) {
+    if (buf->len + len > buf->cap) {
+        buf->cap = max(buf->cap * 2, buf->len + len);
+        if ((buf->data = reallocf(buf->data, buf->cap)) == NULL) {
+            errfn = "reallocf";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int symd_buf_append(struct symd_buf *buf, const void *data, size_t len) {
+    if (symd_buf_reserve(buf, len) < 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
+}
+
+static void symd_buf_consume(struct symd_buf *buf, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+static void symd_cache_unlink(struct symd_cache *cache, struct symd_core *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        cache->head = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        cache->tail = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+}
+
+static void symd_cache_push(struct symd_cache *cache, struct symd_core *entry) {
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head != NULL) {
+        cache->head->prev = entry;
+    } else {
+        cache->tail = entry;
+    }
+    cache->head = entry;
+}
+
+static void symd_core_free(struct symd_core *entry) {
+    if (entry->dsc_open) {
+        dsc_close(&entry->dsc);
+    }
+    core_images_close(&entry->imgs);
+    core_close(&entry->core);
+    free(entry);
+}
+
+static void symd_cache_drop(struct symd_cache *cache, struct symd_core *entry) {
+    symd_cache_unlink(cache, entry);
+    cache->bytes -= entry->bytes;
+    --cache->corec;
+    symd_core_free(entry);
+}
+
+void symd_cache_init(struct symd_cache *cache, size_t budget, size_t maxcores) {
+    cache->head     = NULL;
+    cache->tail     = NULL;
+    cache->corec    = 0;
+    cache->maxcores = max(maxcores, 1);
+    cache->bytes    = 0;
+    cache->budget   = budget;
+}
+
+void symd_cache_close(struct symd_cache *cache) {
+    while (cache->head != NULL) {
+        symd_cache_drop(cache, cache->head);
+    }
+}
+
+bool symd_cache_evict(struct symd_cache *cache, const struct symd_core *keep) {
+    if (cache->tail == NULL || cache->tail == keep) {
+        return false;
+    }
+    symd_cache_drop(cache, cache->tail);
+    return true;
+}
+
+/* evict least recently used cores, sparing keep */
+static void symd_cache_trim(struct symd_cache *cache, const struct symd_core *keep) {
+    while (cache->bytes > cache->budget && symd_cache_evict(cache, keep)) {}
+}
+
+static struct symd_core *symd_cache_get(struct symd_cache *cache, const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        errfn = "stat";
+        goto error;
+    }
+    for (struct symd_core *entry = cache->head; entry != NULL; entry = entry->next) {
+        if (entry->dev != st.st_dev || entry->ino != st.st_ino) {
+            continue;
+        }
+        if (entry->mtime != st.st_mtime) {
+            symd_cache_drop(cache, entry); // rewritten since it was opened
+            break;
+        }
+        symd_cache_unlink(cache, entry);
+        symd_cache_push(cache, entry);
+        return entry;
+    }
+    
+    struct symd_core *entry;
+    if ((entry = calloc(1, sizeof(*entry))) == NULL) {
+        errfn = "calloc";
+        goto error;
+    }
+    
+    /* every open core holds a descriptor; make room under the limit, and evict more if the process runs out anyway */
+    while (cache->corec >= cache->maxcores && symd_cache_evict(cache, NULL)) {}
+    int res;
+    while ((res = core_fopen(path, &entry->core)) < 0 && (errno == EMFILE || errno == ENFILE) && symd_cache_evict(cache, NULL)) {}
+    if (res < 0) {
+        free(entry);
+        goto error;
+    }
+    
+    /* key on the file actually opened, in case path was replaced since the stat */
+    if (fstat(fileno(entry->core.f), &st) < 0) {
+        errfn = "fstat";
+        core_close(&entry->core);
+        free(entry);
+        goto error;
+    }
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtime;
+    
+    if (core_images_open(&entry->core, &entry->imgs) < 0) {
+        core_close(&entry->core);
+        free(entry);
+        goto error;
+    }
+    /* a cache that is missing or does not parse only leaves its addresses unresolved */
+    entry->dsc_open = dsc_open_core(&entry->core, &entry->dsc) == 0;
+    entry->bytes = sizeof(*entry) + entry->core.segc * sizeof(struct core_segment) +
+    entry->imgs.imgc * sizeof(struct core_image);
+    if (entry->dsc_open) {
+        entry->bytes += entry->dsc.mapc * sizeof(struct dsc_mapping) + entry->dsc.imgc * sizeof(struct dsc_image);
+    }
+    
+    symd_cache_push(cache, entry);
+    ++cache->corec;
+    cache->bytes += entry->bytes;
+    return entry;
+    
+error:
+    return NULL;
+}
+
+static size_t symd_symbols_bytes(const struct symbols *syms) {
+    size_t bytes = syms->symc * sizeof(struct symbol) + syms->pagec * sizeof(uint32_t);
+    for (size_t i = 0; i < syms->symc; ++i) {
+        bytes += strlen(syms->symv[i].name) + 1;
+    }
+    return bytes;
+}
+
+/* shared cache images are opened on first use, like the core's own */
+static const struct symbol *symd_lookup_dsc(struct symd_cache *cache, struct symd_core *entry, uint64_t addr, int64_t *slidep) {
+    struct dsc *dsc = &entry->dsc;
+    struct dsc_image *img;
+    if (!entry->dsc_open || (img = dsc_find_image(dsc, addr - dsc->slide)) == NULL) {
+        return NULL;
+    }
+    
+    const bool loaded = img->open;
+    const struct symbols *syms;
+    if ((syms = dsc_image_symbols(dsc, img)) == NULL) {
+        return NULL;
+    }
+    if (!loaded) {
+        const size_t bytes = symd_symbols_bytes(syms);
+        entry->bytes += bytes;
+        cache->bytes += bytes;
+    }
+    
+    *slidep = dsc->slide;
+    return symbols_find(syms, addr - dsc->slide);
+}
+
+static const struct symbol *symd_lookup(struct symd_cache *cache, struct symd_core *entry, uint64_t addr, int64_t *slidep) {
+    struct core_image *img;
+    if ((img = core_images_find(&entry->imgs, addr)) == NULL) {
+        return symd_lookup_dsc(cache, entry, addr, slidep);
+    }
+    
+    const bool loaded = img->syms_open;
+    const struct symbols *syms;
+    if ((syms = core_image_symbols(img, SYMBOLS_PAGE_INDEX)) == NULL) {
+        return NULL;
+    }
+    if (!loaded) {
+        const size_t bytes = symd_symbols_bytes(syms);
+        entry->bytes += bytes;
+        cache->bytes += bytes;
+    }
+    
+    *slidep = img->slide;
+    return symbols_find(syms, addr - img->slide);
+}
+
+ssize_t symd_handle(struct symd_cache *cache, struct symd_client *client) {
+    struct symd_request req;
+    if (client->in.len < sizeof(req)) {
+        return 0;
+    }
+    memcpy(&req, client->in.data, sizeof(req));
+    if (req.magic != SYMD_MAGIC || req.pathlen == 0 || req.pathlen >= PATH_MAX || req.addrc > SYMD_MAX_ADDRS) {
+        return -1;
+    }
+    const size_t size = sizeof(req) + req.pathlen + req.addrc * sizeof(uint64_t);
+    if (client->in.len < size) {
+        return 0;
+    }
+    
+    char path[PATH_MAX];
+    memcpy(path, client->in.data + sizeof(req), req.pathlen);
+    path[req.pathlen] = '\0';
+    const char *addrs = client->in.data + sizeof(req) + req.pathlen;
+    
+    struct symd_response res = {SYMD_MAGIC, 0, 0};
+    struct symd_core *entry;
+    errno = 0;
+    if ((entry = symd_cache_get(cache, path)) == NULL) {
+        res.status = errno != 0 ? errno : EINVAL;
+        if (symd_buf_append(&client->out, &res, sizeof(res)) < 0) {
+            return -1;
+        }
+        return size;
+    }
+    
+    res.resultc = req.addrc;
+    if (symd_buf_append(&client->out, &res, sizeof(res)) < 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < req.addrc; ++i) {
+        uint64_t addr;
+        memcpy(&addr, addrs + i * sizeof(addr), sizeof(addr));
+        
+        int64_t slide = 0;
+        const struct symbol *sym = symd_lookup(cache, entry, addr, &slide);
+        struct symd_result result = {0, 0};
+        if (sym != NULL) {
+            result.symaddr = sym->vmaddr + slide;
+            result.namelen = strlen(sym->name);
+        }
+        if (symd_buf_append(&client->out, &result, sizeof(result)) < 0 ||
+            symd_buf_append(&client->out, sym != NULL ? sym->name : "", result.namelen) < 0) {
+            return -1;
+        }
+    }
+    
+    symd_cache_trim(cache, entry);
+    return size;
+}
+
+/* write as much of client->out as the socket takes without blocking; returns -1 to drop the client */
+static int symd_flush(struct symd_client *client) {
+    size_t off = 0;
+    while (off < client->out.len) {
+        const ssize_t n = write(client->fd, client->out.data + off, client->out.len - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            errfn = "write";
+            return -1;
+        }
+        off += n;
+    }
+    symd_buf_consume(&client->out, off);
+    return 0;
+}
+
+/* answer complete requests in client->in until the unsent responses exceed the backlog */
+static int symd_answer(struct symd_cache *cache, struct symd_client *client) {
+    ssize_t size = 0;
+    while (client->out.len < SYMD_MAX_BACKLOG && (size = symd_handle(cache, client)) > 0) {
+        symd_buf_consume(&client->in, size);
+    }
+    return size < 0 ? -1 : 0;
+}
+
+int symd_service(struct symd_cache *cache, struct symd_client *client, short revents) {
+    if ((revents & POLLOUT) && symd_flush(client) < 0) {
+        return -1;
+    }
+    
+    /* a client that does not read its responses is not read from either */
+    if ((revents & (POLLIN | POLLHUP | POLLERR)) && !client->eof && client->out.len < SYMD_MAX_BACKLOG) {
+        if (symd_buf_reserve(&client->in, 64 * 1024) < 0) {
+            return -1;
+        }
+        const ssize_t n = read(client->fd, client->in.data + client->in.len, client->in.cap - client->in.len);
+        if (n == 0) {
+            client->eof = true;
+        }
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            errfn = "read";
+            return -1;
+        }
+        if (n > 0) {
+            client->in.len += n;
+        }
+    }
+    
+    if (symd_answer(cache, client) < 0 || symd_flush(client) < 0) {
+        return -1;
+    }
+    return client->eof && client->out.len == 0 ? -1 : 0;
+}
+
+void symd_client_close(struct symd_client *client) {
+    close(client->fd);
+    free(client->in.data);
+    free(client->out.data);
+}
+
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* wire format of the symbolication daemon, in host byte order.
+ *
+ * request:  struct symd_request, pathlen bytes of core path, addrc uint64_t addresses
+ * response: struct symd_response, then for each address a struct symd_result followed by namelen bytes of name
+ *
+ * Requests may be pipelined; responses come back in request order. */
+
+#define SYMD_MAGIC 0x646d7973 // 'symd'
+
+struct symd_request {
+    uint32_t magic;
+    uint32_t pathlen;
+    uint32_t addrc;
+};
+
+struct symd_response {
+    uint32_t magic;
+    int32_t status;   // 0, or errno if the core could not be opened
+    uint32_t resultc; // addrc of the request, or 0 on error
+};
+
+struct symd_result {
+    uint64_t symaddr; // slid address of the symbol, 0 if none
+    uint32_t namelen; // 0 if none
+};
+
+/* server side, driven by symd's poll loop */
+
+#define SYMD_MAX_BACKLOG (4 << 20) // unsent response bytes per client before it stops being read
+
+struct symd_core;
+
+/* opened cores, least recently used evicted first */
+struct symd_cache {
+    struct symd_core *head;
+    struct symd_core *tail;
+    size_t corec;
+    size_t maxcores; // each open core holds a file descriptor
+    size_t bytes;
+    size_t budget;
+};
+
+struct symd_buf {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+struct symd_client {
+    int fd; // non-blocking
+    struct symd_buf in;
+    struct symd_buf out;
+    bool eof; // peer is done sending; dropped once its responses are out
+};
+
+void symd_cache_init(struct symd_cache *cache, size_t budget, size_t maxcores);
+void symd_cache_close(struct symd_cache *cache);
+
+/* close the least recently used core unless it is keep; returns whether one was closed */
+bool symd_cache_evict(struct symd_cache *cache, const struct symd_core *keep);
+
+/* handle one complete request at the start of client->in; returns its size, 0 if incomplete, -1 to drop the client */
+ssize_t symd_handle(struct symd_cache *cache, struct symd_client *client);
+
+/* read what is available, answer what can be answered, and send what the socket takes; returns -1 to drop the client */
+int symd_service(struct symd_cache *cache, struct symd_client *client, short revents);
+
+void symd_client_close(struct symd_client *client); // closes fd
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,224 @@
+#include <string.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+
+#include "test.h"
+#include "util.h"
+
+void test_image_init(struct test_image *img, bool wide, bool swap, uint32_t filetype) {
+    img->wide = wide;
+    img->swap = swap;
+    img->cputype = wide ? CPU_TYPE_ARM64 : CPU_TYPE_ARM;
+    img->filetype = filetype;
+    img->ncmds = 0;
+    img->cmdend = wide ? sizeof(struct mach_header_64) : sizeof(struct mach_header);
+    img->size = TEST_IMAGE_DATA;
+    img->cap = 2 * TEST_IMAGE_DATA;
+    test_check((img->buf = calloc(img->cap, 1)) != NULL);
+}
+
+void test_image_free(struct test_image *img) {
+    free(img->buf);
+    img->buf = NULL;
+}
+
+static void test_image_reserve(struct test_image *img, size_t size) {
+    if (size > img->cap) {
+        const size_t cap = max(img->cap * 2, size);
+        test_check((img->buf = realloc(img->buf, cap)) != NULL);
+        memset(img->buf + img->cap, 0, cap - img->cap);
+        img->cap = cap;
+    }
+    img->size = max(img->size, size);
+}
+
+void test_image_put(struct test_image *img, size_t off, uint64_t value, size_t size) {
+    test_image_reserve(img, off + size);
+    for (size_t i = 0; i < size; ++i) {
+        const size_t shift = 8 * (img->swap ? size - 1 - i : i);
+        img->buf[off + i] = value >> shift;
+    }
+}
+
+void test_image_bytes(struct test_image *img, size_t off, const void *data, size_t len) {
+    test_image_reserve(img, off + len);
+    memcpy(img->buf + off, data, len);
+}
+
+size_t test_image_cmd(struct test_image *img, uint32_t cmd, size_t cmdsize) {
+    const size_t off = img->cmdend;
+    test_check(off + cmdsize <= TEST_IMAGE_DATA);
+    test_image_field(img, off, struct load_command, cmd, cmd);
+    test_image_field(img, off, struct load_command, cmdsize, cmdsize);
+    img->cmdend += cmdsize;
+    ++img->ncmds;
+    return off;
+}
+
+size_t test_image_data(struct test_image *img, const void *data, size_t len, size_t align) {
+    const size_t off = (img->size + align - 1) / align * align;
+    test_image_reserve(img, off + len);
+    if (data != NULL) {
+        memcpy(img->buf + off, data, len);
+    }
+    return off;
+}
+
+static void test_image_name(struct test_image *img, size_t off, const char *name) {
+    char buf[16] = {0};
+    strncpy(buf, name, sizeof(buf));
+    test_image_bytes(img, off, buf, sizeof(buf));
+}
+
+size_t test_image_segment(struct test_image *img, const char *name, uint64_t vmaddr, uint64_t vmsize,
+                          uint64_t fileoff, uint64_t filesize, vm_prot_t prot, uint32_t nsects) {
+    size_t seg;
+    if (img->wide) {
+        seg = test_image_cmd(img, LC_SEGMENT_64, sizeof(struct segment_command_64) + nsects * sizeof(struct section_64));
+        test_image_name(img, seg + offsetof(struct segment_command_64, segname), name);
+        test_image_field(img, seg, struct segment_command_64, vmaddr, vmaddr);
+        test_image_field(img, seg, struct segment_command_64, vmsize, vmsize);
+        test_image_field(img, seg, struct segment_command_64, fileoff, fileoff);
+        test_image_field(img, seg, struct segment_command_64, filesize, filesize);
+        test_image_field(img, seg, struct segment_command_64, maxprot, prot);
+        test_image_field(img, seg, struct segment_command_64, initprot, prot);
+        test_image_field(img, seg, struct segment_command_64, nsects, nsects);
+    } else {
+        seg = test_image_cmd(img, LC_SEGMENT, sizeof(struct segment_command) + nsects * sizeof(struct section));
+        test_image_name(img, seg + offsetof(struct segment_command, segname), name);
+        test_image_field(img, seg, struct segment_command, vmaddr, vmaddr);
+        test_image_field(img, seg, struct segment_command, vmsize, vmsize);
+        test_image_field(img, seg, struct segment_command, fileoff, fileoff);
+        test_image_field(img, seg, struct segment_command, filesize, filesize);
+        test_image_field(img, seg, struct segment_command, maxprot, prot);
+        test_image_field(img, seg, struct segment_command, initprot, prot);
+        test_image_field(img, seg, struct segment_command, nsects, nsects);
+    }
+    return seg;
+}
+
+void test_image_section(struct test_image *img, size_t seg, uint32_t i, const char *name,
+                        uint64_t addr, uint64_t size, uint32_t offset) {
+    char segname[16];
+    if (img->wide) {
+        const size_t sect = seg + sizeof(struct segment_command_64) + i * sizeof(struct section_64);
+        test_image_name(img, sect + offsetof(struct section_64, sectname), name);
+        memcpy(segname, img->buf + seg + offsetof(struct segment_command_64, segname), sizeof(segname));
+        test_image_bytes(img, sect + offsetof(struct section_64, segname), segname, sizeof(segname));
+        test_image_field(img, sect, struct section_64, addr, addr);
+        test_image_field(img, sect, struct section_64, size, size);
+        test_image_field(img, sect, struct section_64, offset, offset);
+    } else {
+        const size_t sect = seg + sizeof(struct segment_command) + i * sizeof(struct section);
+        test_image_name(img, sect + offsetof(struct section, sectname), name);
+        memcpy(segname, img->buf + seg + offsetof(struct segment_command, segname), sizeof(segname));
+        test_image_bytes(img, sect + offsetof(struct section, segname), segname, sizeof(segname));
+        test_image_field(img, sect, struct section, addr, addr);
+        test_image_field(img, sect, struct section, size, size);
+        test_image_field(img, sect, struct section, offset, offset);
+    }
+}
+
+size_t test_image_symtab(struct test_image *img, const struct test_symbol *symv, size_t symc) {
+    /* string table: a leading NUL, so that index 0 is the empty name */
+    size_t strsize = 1;
+    for (size_t i = 0; i < symc; ++i) {
+        strsize += strlen(symv[i].name) + 1;
+    }
+    const size_t stroff = test_image_data(img, NULL, strsize, 8);
+    size_t strx = 1;
+    for (size_t i = 0; i < symc; ++i) {
+        const size_t len = strlen(symv[i].name) + 1;
+        memcpy(img->buf + stroff + strx, symv[i].name, len);
+        strx += len;
+    }
+    
+    const size_t nlsize = img->wide ? sizeof(struct nlist_64) : sizeof(struct nlist);
+    const size_t symoff = test_image_data(img, NULL, nlsize * symc, 8);
+    strx = 1;
+    for (size_t i = 0; i < symc; ++i) {
+        const size_t nl = symoff + i * nlsize;
+        if (img->wide) {
+            test_image_field(img, nl, struct nlist_64, n_un.n_strx, strx);
+            test_image_field(img, nl, struct nlist_64, n_type, symv[i].type);
+            test_image_field(img, nl, struct nlist_64, n_sect, symv[i].sect);
+            test_image_field(img, nl, struct nlist_64, n_value, symv[i].vmaddr);
+        } else {
+            test_image_field(img, nl, struct nlist, n_un.n_strx, strx);
+            test_image_field(img, nl, struct nlist, n_type, symv[i].type);
+            test_image_field(img, nl, struct nlist, n_sect, symv[i].sect);
+            test_image_field(img, nl, struct nlist, n_value, symv[i].vmaddr);
+        }
+        strx += strlen(symv[i].name) + 1;
+    }
+    
+    const size_t cmd = test_image_cmd(img, LC_SYMTAB, sizeof(struct symtab_command));
+    test_image_field(img, cmd, struct symtab_command, symoff, symoff);
+    test_image_field(img, cmd, struct symtab_command, nsyms, symc);
+    test_image_field(img, cmd, struct symtab_command, stroff, stroff);
+    test_image_field(img, cmd, struct symtab_command, strsize, strsize);
+    return cmd;
+}
+
+void test_image_dysymtab(struct test_image *img, uint32_t nlocal, uint32_t nextdef, uint32_t nundef) {
+    const size_t cmd = test_image_cmd(img, LC_DYSYMTAB, sizeof(struct dysymtab_command));
+    test_image_field(img, cmd, struct dysymtab_command, ilocalsym, 0);
+    test_image_field(img, cmd, struct dysymtab_command, nlocalsym, nlocal);
+    test_image_field(img, cmd, struct dysymtab_command, iextdefsym, nlocal);
+    test_image_field(img, cmd, struct dysymtab_command, nextdefsym, nextdef);
+    test_image_field(img, cmd, struct dysymtab_command, iundefsym, nlocal + nextdef);
+    test_image_field(img, cmd, struct dysymtab_command, nundefsym, nundef);
+}
+
+void test_image_linkedit(struct test_image *img, uint32_t cmd, const void *data, size_t len) {
+    const size_t off = test_image_data(img, data, len, 8);
+    const size_t lc = test_image_cmd(img, cmd, sizeof(struct linkedit_data_command));
+    test_image_field(img, lc, struct linkedit_data_command, dataoff, off);
+    test_image_field(img, lc, struct linkedit_data_command, datasize, len);
+}
+
+void test_image_uuid(struct test_image *img, const uint8_t uuid[16]) {
+    const size_t cmd = test_image_cmd(img, LC_UUID, sizeof(struct uuid_command));
+    test_image_bytes(img, cmd + offsetof(struct uuid_command, uuid), uuid, 16);
+}
+
+void test_image_segments(struct test_image *img, uint64_t base, uint64_t textsize) {
+    test_check(textsize >= TEST_IMAGE_DATA);
+    test_image_segment(img, SEG_TEXT, base, textsize, 0, TEST_IMAGE_DATA, VM_PROT_READ | VM_PROT_EXECUTE, 0);
+    const size_t size = img->size - TEST_IMAGE_DATA;
+    test_image_segment(img, SEG_LINKEDIT, base + textsize, size, TEST_IMAGE_DATA, size, VM_PROT_READ, 0);
+}
+
+static void test_image_header(struct test_image *img) {
+    if (img->wide) {
+        test_image_field(img, 0, struct mach_header_64, magic, MH_MAGIC_64);
+        test_image_field(img, 0, struct mach_header_64, cputype, img->cputype);
+        test_image_field(img, 0, struct mach_header_64, filetype, img->filetype);
+        test_image_field(img, 0, struct mach_header_64, ncmds, img->ncmds);
+        test_image_field(img, 0, struct mach_header_64, sizeofcmds, img->cmdend - sizeof(struct mach_header_64));
+    } else {
+        test_image_field(img, 0, struct mach_header, magic, MH_MAGIC);
+        test_image_field(img, 0, struct mach_header, cputype, img->cputype);
+        test_image_field(img, 0, struct mach_header, filetype, img->filetype);
+        test_image_field(img, 0, struct mach_header, ncmds, img->ncmds);
+        test_image_field(img, 0, struct mach_header, sizeofcmds, img->cmdend - sizeof(struct mach_header));
+    }
+}
+
+FILE *test_image_file(struct test_image *img) {
+    test_image_header(img);
+    FILE *f;
+    test_check((f = tmpfile()) != NULL);
+    test_check(fwrite(img->buf, 1, img->size, f) == img->size);
+    test_check(fflush(f) == 0);
+    rewind(f);
+    return f;
+}
+
+void test_image_save(struct test_image *img, const char *path) {
+    test_image_header(img);
+    FILE *f;
+    test_check((f = fopen(path, "w")) != NULL);
+    test_check(fwrite(img->buf, 1, img->size, f) == img->size);
+    test_check(fclose(f) == 0);
+}
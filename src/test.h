@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <mach/vm_prot.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* helpers for the self-checking tests run by ctest */
+
+#define test_check(cond) do { \
+if (!(cond)) { \
+fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+exit(EXIT_FAILURE); \
+} \
+} while (0)
+
+/* Mach-O file under construction, written in either byte order.
+ * Load commands go after the header; data is appended from TEST_IMAGE_DATA on. */
+struct test_image {
+    bool wide;   // 64-bit
+    bool swap;   // opposite-endian (MH_CIGAM*)
+    int cputype; // CPU_TYPE_ARM64 or CPU_TYPE_ARM by default
+    uint32_t filetype;
+    uint32_t ncmds;
+    size_t cmdend;
+    size_t size;
+    size_t cap;
+    uint8_t *buf;
+};
+
+#define TEST_IMAGE_DATA 0x1000
+
+struct test_symbol {
+    const char *name;
+    uint8_t type;    // n_type
+    uint8_t sect;    // n_sect
+    uint64_t vmaddr; // n_value
+};
+
+void test_image_init(struct test_image *img, bool wide, bool swap, uint32_t filetype);
+void test_image_free(struct test_image *img);
+
+/* integer of size bytes at off, in the image's byte order */
+void test_image_put(struct test_image *img, size_t off, uint64_t value, size_t size);
+#define test_image_field(img, off, type, field, value) \
+test_image_put(img, (off) + offsetof(type, field), value, sizeof(((type *) 0)->field))
+void test_image_bytes(struct test_image *img, size_t off, const void *data, size_t len);
+
+/* zeroed load command; returns its file offset */
+size_t test_image_cmd(struct test_image *img, uint32_t cmd, size_t cmdsize);
+
+/* append len bytes of data (zeroes if data is NULL) at the next multiple of align; returns its file offset */
+size_t test_image_data(struct test_image *img, const void *data, size_t len, size_t align);
+
+/* LC_SEGMENT(_64) with room for nsects sections, filled in by test_image_section; returns its file offset */
+size_t test_image_segment(struct test_image *img, const char *name, uint64_t vmaddr, uint64_t vmsize,
+                          uint64_t fileoff, uint64_t filesize, vm_prot_t prot, uint32_t nsects);
+void test_image_section(struct test_image *img, size_t seg, uint32_t i, const char *name,
+                        uint64_t addr, uint64_t size, uint32_t offset);
+                        
+/* symbol table and string table as data plus LC_SYMTAB; returns the LC_SYMTAB offset */
+size_t test_image_symtab(struct test_image *img, const struct test_symbol *symv, size_t symc);
+
+/* LC_DYSYMTAB partitioning the symbol table into locals, external definitions and undefined symbols */
+void test_image_dysymtab(struct test_image *img, uint32_t nlocal, uint32_t nextdef, uint32_t nundef);
+
+/* data plus a linkedit_data_command (e.g. LC_DYLD_EXPORTS_TRIE) pointing at it */
+void test_image_linkedit(struct test_image *img, uint32_t cmd, const void *data, size_t len);
+
+void test_image_uuid(struct test_image *img, const uint8_t uuid[16]);
+
+/* __TEXT of textsize bytes at base, backed by the header and load commands, followed by __LINKEDIT over all data */
+void test_image_segments(struct test_image *img, uint64_t base, uint64_t textsize);
+
+/* write the header and return the image as a temporary file positioned at its start */
+FILE *test_image_file(struct test_image *img);
+
+/* same, at a path */
+void test_image_save(struct test_image *img, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,15 @@ goto error; \
 
 #define fread_one_chk(var, file) fread_chk(&var, 1, file)
 
+#define fwrite_chk(ptr, nitems, file) do { \
+if (fwrite(ptr, sizeof(*ptr), nitems, file) != nitems) { \
+errfn = "fwrite"; \
+goto error; \
+} \
+} while (0)
+
+#define fwrite_one_chk(var, file) fwrite_chk(&var, 1, file)
+
 #define ftell_chk(var, file) do { \
 if ((var = ftell(file)) < 0) { \
 errfn = "ftell"; \